@@ -0,0 +1,112 @@
+#ifndef TEMPLATE_ADMISSION_H
+#define TEMPLATE_ADMISSION_H
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/**
+ * @brief Request classes, in priority order. Writes may use every in-flight
+ * slot, plain reads leave some free for writes and bulk reads have their own,
+ * smaller cap.
+ *
+ */
+enum admission_class
+{
+    ADMISSION_WRITE,
+    ADMISSION_READ,
+    ADMISSION_BULK_READ
+};
+
+/**
+ * @brief Outcome of an admission check
+ *
+ */
+enum admission_verdict
+{
+    ADMISSION_ADMIT,
+    ADMISSION_OVERLOADED,  // answer 503 SERVICE_UNAVAILABLE
+    ADMISSION_THROTTLED    // answer 429 TOO_MANY_REQUESTS
+};
+
+/**
+ * @brief Limits and live counts. A limit of 0 means unlimited.
+ *
+ */
+struct admission
+{
+    unsigned int max_connections;
+    unsigned int max_queued;
+    unsigned int max_in_flight;
+    unsigned int max_bulk_reads;
+    unsigned int retry_after;
+    atomic_uint connections;
+    atomic_uint in_flight;
+    atomic_uint bulk_reads;
+};
+
+/**
+ * @brief Sets the limits and zeroes the counts
+ *
+ * @param admission
+ * @param max_connections open connections before new ones are shed
+ * @param max_queued accept-queue length before new connections are shed
+ * @param max_in_flight requests being handled at once
+ * @param max_bulk_reads ?all reads being handled at once
+ * @param retry_after seconds sent in Retry-After
+ */
+void admission_init(struct admission *admission, unsigned int max_connections,
+                    unsigned int max_queued, unsigned int max_in_flight,
+                    unsigned int max_bulk_reads, unsigned int retry_after);
+/**
+ * @brief Decides whether to serve a freshly accepted connection. Over a limit,
+ * a connection whose first bytes are already in and start a PUT is still let
+ * through so ingestion keeps flowing.
+ *
+ * @param admission
+ * @param client_fd
+ * @param listen_fd used to read the accept-queue length
+ * @return ADMISSION_ADMIT, after which admission_connection_done must be
+ * called, or ADMISSION_OVERLOADED
+ */
+enum admission_verdict admission_connection(struct admission *admission,
+                                            int client_fd, int listen_fd);
+/**
+ * @brief Releases a connection admitted by admission_connection
+ *
+ * @param admission
+ */
+void admission_connection_done(struct admission *admission);
+/**
+ * @brief Decides whether to handle a parsed request now
+ *
+ * @param admission
+ * @param cls
+ * @return ADMISSION_ADMIT, after which admission_request_done must be called
+ * with the same class, or the status to refuse it with
+ */
+enum admission_verdict admission_request(struct admission *admission,
+                                         enum admission_class cls);
+/**
+ * @brief Releases a request admitted by admission_request
+ *
+ * @param admission
+ * @param cls
+ */
+void admission_request_done(struct admission *admission,
+                            enum admission_class cls);
+/**
+ * @brief Connections accepted by the kernel but not yet by us
+ *
+ * @param listen_fd
+ * @return queue length, or -1 where the platform cannot tell
+ */
+int admission_accept_queue_length(int listen_fd);
+/**
+ * @brief Answers 503 on a connection that was never admitted, without
+ * blocking on a slow client. The caller still closes client_fd.
+ *
+ * @param admission
+ * @param client_fd
+ */
+void admission_reject_connection(const struct admission *admission,
+                                 int client_fd);
+#endif  // TEMPLATE_ADMISSION_H
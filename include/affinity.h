@@ -0,0 +1,58 @@
+#ifndef TEMPLATE_AFFINITY_H
+#define TEMPLATE_AFFINITY_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Pins the calling thread, and every thread it starts from then on, to
+ * a set of CPUs. Done before anything large is allocated, the kernel's
+ * first-touch placement then puts buffers, caches and arenas on the node
+ * those CPUs are on.
+ *
+ * @param list CPU numbers and ranges, as in "0-7,16"
+ * @return the lowest CPU in the list, or -1 if it does not parse or the
+ * kernel refused the set
+ */
+int affinity_pin(const char *list);
+/**
+ * @brief Pins the calling thread alone to one CPU
+ *
+ * @param cpu
+ * @return false if the kernel refused
+ */
+bool affinity_pin_thread(int cpu);
+/**
+ * @brief Lists the CPUs the calling thread may run on
+ *
+ * @param cpus set to them, lowest first
+ * @param max room in cpus
+ * @return how many were listed, at most max
+ */
+size_t affinity_cpus(int *cpus, size_t max);
+/**
+ * @brief When the calling thread's CPUs all sit on one NUMA node, makes that
+ * node the preferred one for its allocations, and those of the threads it
+ * starts, from then on
+ *
+ * @return true if there was one node to prefer and the kernel took it
+ */
+bool affinity_prefer_local_node(void);
+/**
+ * @brief Shares fd's port with other sockets that asked the same. Before
+ * bind.
+ *
+ * @param fd
+ * @return false if the kernel refused
+ */
+bool affinity_share_port(int fd);
+/**
+ * @brief Asks the kernel to give fd, among the sockets sharing its port, the
+ * connections and datagrams whose packets were received on cpu, so they are
+ * served on the core that took the interrupt and whose caches are warm
+ *
+ * @param fd
+ * @param cpu
+ * @return false if the kernel refused or has no such option
+ */
+bool affinity_steer(int fd, int cpu);
+#endif  // TEMPLATE_AFFINITY_H
@@ -0,0 +1,84 @@
+#ifndef TEMPLATE_ARENA_H
+#define TEMPLATE_ARENA_H
+#include <stddef.h>
+
+/**
+ * @brief Overflow block chained onto an arena once its main block is full
+ *
+ */
+struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+/**
+ * @brief Bump allocator for request-scoped memory. Every allocation made while
+ * handling a request comes from here and is released all at once by
+ * arena_reset.
+ *
+ */
+struct arena
+{
+    char *base;
+    size_t size;
+    size_t used;
+    struct arena_chunk *overflow;
+};
+
+/**
+ * @brief Creates an arena with a main block of size bytes
+ *
+ * @param size
+ * @return struct arena* or NULL if out of memory
+ */
+struct arena *arena_create(size_t size);
+/**
+ * @brief Returns size bytes of uninitialized, suitably aligned memory
+ *
+ * @param arena
+ * @param size
+ * @return void* or NULL if out of memory
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+/**
+ * @brief Returns count * size bytes of zeroed memory
+ *
+ * @param arena
+ * @param count
+ * @param size
+ * @return void* or NULL if out of memory
+ */
+void *arena_calloc(struct arena *arena, size_t count, size_t size);
+/**
+ * @brief Copies str into the arena
+ *
+ * @param arena
+ * @param str
+ * @return char*
+ */
+char *arena_strdup(struct arena *arena, const char *str);
+/**
+ * @brief Copies at most n bytes of str into the arena, always NUL terminated
+ *
+ * @param arena
+ * @param str
+ * @param n
+ * @return char*
+ */
+char *arena_strndup(struct arena *arena, const char *str, size_t n);
+/**
+ * @brief Releases everything allocated from the arena. O(1) unless the request
+ * spilled into overflow chunks.
+ *
+ * @param arena
+ */
+void arena_reset(struct arena *arena);
+/**
+ * @brief Frees the arena and sets *parena to NULL
+ *
+ * @param parena
+ */
+void arena_destroy(struct arena **parena);
+#endif  // TEMPLATE_ARENA_H
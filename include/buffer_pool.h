@@ -0,0 +1,46 @@
+#ifndef TEMPLATE_BUFFER_POOL_H
+#define TEMPLATE_BUFFER_POOL_H
+#include <stddef.h>
+
+/**
+ * @brief Size of the small buffer class, used for single values
+ *
+ */
+#define BUFFER_SMALL_SIZE 1024
+/**
+ * @brief Size of the large buffer class, big enough for a whole request or
+ * response
+ *
+ */
+#define BUFFER_LARGE_SIZE 8192
+
+/**
+ * @brief Takes a buffer of at least size bytes from the calling thread's cache,
+ * refilling it from the shared free lists or a new slab when empty. The
+ * contents are NOT zeroed.
+ *
+ * @param size must be at most BUFFER_LARGE_SIZE
+ * @return void* or NULL if size is too big or out of memory
+ */
+void *buffer_pool_get(size_t size);
+/**
+ * @brief Returns a buffer obtained from buffer_pool_get. NULL is ignored.
+ *
+ * @param buf
+ */
+void buffer_pool_put(void *buf);
+/**
+ * @brief Capacity of a buffer obtained from buffer_pool_get
+ *
+ * @param buf
+ * @return size_t
+ */
+size_t buffer_pool_capacity(const void *buf);
+/**
+ * @brief Hands the calling thread's cached buffers back to the shared free
+ * lists. Threads that serve requests or stores call it before they exit, a
+ * cache left behind can never be taken from again.
+ *
+ */
+void buffer_pool_thread_flush(void);
+#endif  // TEMPLATE_BUFFER_POOL_H
@@ -0,0 +1,197 @@
+#ifndef TEMPLATE_CHANGE_FEED_H
+#define TEMPLATE_CHANGE_FEED_H
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Changes a subscriber can fall behind by before the oldest are dropped
+ *
+ */
+#define CHANGE_FEED_BUFFER 64
+/**
+ * @brief Changes a subscriber may lose before it is cut off as too slow to
+ * be worth keeping up with
+ *
+ */
+#define CHANGE_FEED_SLOW_LIMIT (4 * CHANGE_FEED_BUFFER)
+/**
+ * @brief Latest changes kept for change_feed_since
+ *
+ */
+#define CHANGE_FEED_LOG 4096
+/**
+ * @brief change_feed_wait results once a subscriber is done
+ *
+ */
+#define CHANGE_FEED_CLOSED (-1)
+#define CHANGE_FEED_SLOW (-2)
+/**
+ * @brief change_feed_since result for a sequence number the log no longer
+ * (or never did) reach back to
+ *
+ */
+#define CHANGE_FEED_GONE (-3)
+
+/**
+ * @brief One stored value, shared by every subscriber it was queued for and
+ * freed with the last reference
+ *
+ */
+struct change
+{
+    atomic_uint refs;
+    uint64_t seq;
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+    char data[];
+};
+
+struct change_feed;
+
+/**
+ * @brief A consumer of the feed with its own bounded queue. Only changes
+ * whose key starts with prefix, and whose value carries major=N if major is
+ * not negative, are queued.
+ *
+ */
+struct change_subscriber
+{
+    struct change_feed *feed;
+    struct change_subscriber *next;
+    char *prefix;
+    size_t prefix_len;
+    long major;
+    struct change *queue[CHANGE_FEED_BUFFER];
+    size_t head;
+    size_t count;
+    uint64_t dropped;
+    bool slow;
+    pthread_cond_t ready;
+};
+
+/**
+ * @brief In-process publish/subscribe of stored values. Publishing never
+ * waits on a subscriber: a full queue loses its oldest change instead.
+ *
+ * Every change gets the next sequence number and goes into a ring of the
+ * latest CHANGE_FEED_LOG, which always holds changes log_start + 1 to seq.
+ * Numbering starts from the clock in microseconds, so numbers handed out
+ * before a restart are too old rather than wrong.
+ *
+ */
+struct change_feed
+{
+    pthread_mutex_t lock;
+    pthread_cond_t left;
+    struct change_subscriber *subscribers;
+    size_t count;
+    size_t max_subscribers;
+    uint64_t seq;
+    struct change *log[CHANGE_FEED_LOG];
+    size_t log_head;
+    size_t log_count;
+    uint64_t log_start;
+    bool closed;
+};
+
+/**
+ * @brief Creates a feed
+ *
+ * @param max_subscribers 0 for unlimited
+ * @return struct change_feed* or NULL if out of memory
+ */
+struct change_feed *change_feed_create(size_t max_subscribers);
+/**
+ * @brief Closes the feed, waits a little for subscribers to notice and leave,
+ * then frees it
+ *
+ * @param pfeed
+ */
+void change_feed_destroy(struct change_feed **pfeed);
+/**
+ * @brief Numbers a stored value, logs it and queues it for every subscriber
+ * it matches. Publishers must publish in the order the values were stored.
+ *
+ * @param feed
+ * @param key
+ * @param value
+ * @return the change's sequence number. A change that could not be kept
+ * still takes one, but empties the log and counts as dropped for every
+ * subscriber.
+ */
+uint64_t change_feed_publish(struct change_feed *feed, const char *key,
+                             const char *value);
+/**
+ * @brief Adds a subscriber that sees changes published from now on
+ *
+ * @param feed
+ * @param prefix key prefix, not NUL terminated
+ * @param prefix_len 0 for every key
+ * @param major negative for any
+ * @return struct change_subscriber* or NULL if the feed is full or closed
+ */
+struct change_subscriber *change_feed_subscribe(struct change_feed *feed,
+                                                const char *prefix,
+                                                size_t prefix_len, long major);
+/**
+ * @brief Removes a subscriber and releases what it had queued
+ *
+ * @param sub
+ */
+void change_feed_unsubscribe(struct change_subscriber *sub);
+/**
+ * @brief Takes up to max queued changes, waiting up to timeout_ms for one.
+ * The caller releases each with change_release.
+ *
+ * @param sub
+ * @param out
+ * @param max
+ * @param dropped set to the changes lost since the last call
+ * @param timeout_ms
+ * @return number taken, 0 on timeout, CHANGE_FEED_CLOSED once the feed closed
+ * or CHANGE_FEED_SLOW once the subscriber was cut off
+ */
+int change_feed_wait(struct change_subscriber *sub, struct change **out,
+                     size_t max, uint64_t *dropped, int timeout_ms);
+/**
+ * @brief Takes up to max of the logged changes after since, oldest first. The
+ * caller releases each with change_release.
+ *
+ * @param feed
+ * @param since
+ * @param out
+ * @param max
+ * @param seq set to the sequence number the changes taken bring a consumer
+ * up to, or to the latest if since is gone
+ * @return number taken, CHANGE_FEED_GONE if the changes after since are no
+ * longer all logged
+ */
+int change_feed_since(struct change_feed *feed, uint64_t since,
+                      struct change **out, size_t max, uint64_t *seq);
+/**
+ * @brief The latest sequence number handed out
+ *
+ * @param feed
+ * @return uint64_t
+ */
+uint64_t change_feed_seq(struct change_feed *feed);
+/**
+ * @brief Drops a reference to a change
+ *
+ * @param change
+ */
+void change_release(struct change *change);
+/**
+ * @brief Finds the number after major= in a beacon value
+ *
+ * @param value
+ * @param len
+ * @return long, -1 if the value has none
+ */
+long change_major(const char *value, size_t len);
+#endif  // TEMPLATE_CHANGE_FEED_H
@@ -10,7 +10,8 @@
  */
 int display(const char *str);
 
-#define DEFAULT_PORT 80;
+#define DEFAULT_PORT 80
 #define MAX_REQUEST_SIZE 8000
+#define REQUEST_ARENA_SIZE (4 * MAX_REQUEST_SIZE)
 
 #endif // TEMPLATE_COMMON_H
@@ -2,6 +2,20 @@
 #define TEMPLATE_DBSTUFF_H
 #include <dc_posix/dc_fcntl.h>
 #include <dc_posix/dc_ndbm.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Room for a quoted entity tag from db_etag, with its NUL
+ *
+ */
+#define DB_ETAG_SIZE 40
+/**
+ * @brief Most threads db_warm reads with
+ *
+ */
+#define DB_WARM_MAX_THREADS 64
 
 /**
  * @brief Stores a key-value pair in the db
@@ -20,19 +34,107 @@ void db_store(const struct dc_posix_env *env, struct dc_error *err,
  * @param env 
  * @param err 
  * @param key_str 
- * @param val_str 
+ * @param val_str BUFFER_SMALL_SIZE bytes, gets "KEY : VALUE" cut to fit 
  * @param dbLocation 
  */
 void db_fetch(const struct dc_posix_env *env, struct dc_error *err,
               const char *key_str, const char *val_str, const char *dbLocation);
 /**
- * @brief Returns all values from the db
+ * @brief Called for each pair db_fetch_all walks. The key and value are only
+ * valid during the call and are not NUL terminated.
+ *
+ * @return false to stop the walk
+ */
+typedef bool (*db_visitor)(void *arg, const char *key, size_t key_len,
+                           const char *val, size_t val_len);
+/**
+ * @brief Walks every key-value pair in the db, handing each to visit as it is
+ * read so nothing has to hold the whole db at once
  * 
  * @param env 
  * @param err 
- * @param val_str 
+ * @param visit 
+ * @param arg passed to visit
  * @param dbLocation 
  */
-void db_fetch_all(const struct dc_posix_env *env, struct dc_error *err, 
-    const char*val_str, const char *dbLocation);
+void db_fetch_all(const struct dc_posix_env *env, struct dc_error *err,
+                  db_visitor visit, void *arg, const char *dbLocation);
+/**
+ * @brief Flushes the db's files to disk, so stores made before the call
+ * survive a crash of the machine
+ *
+ * @param dbLocation
+ * @return false if no db file was found or one could not be synced
+ */
+bool db_sync(const char *dbLocation);
+/**
+ * @brief Holds stores to the db off its files, in memory where db_fetch and
+ * db_fetch_all see them, so the files stay as they are while they are copied.
+ * Like db_store, the caller keeps readers and writers out while it is called.
+ *
+ * @param dbLocation
+ * @return false if dbLocation is too long to hold for
+ */
+bool db_hold(const char *dbLocation);
+/**
+ * @brief Writes the stores held since db_hold to the files, the latest value
+ * of each key, and stores go to the files again. Like db_store, the caller
+ * keeps readers and writers out while it is called.
+ *
+ * @param env
+ * @param err
+ * @param dbLocation
+ */
+void db_release(const struct dc_posix_env *env, struct dc_error *err,
+                const char *dbLocation);
+/**
+ * @brief Copies every file of the db at from over the same file of to,
+ * cloning them where the filesystem has reflinks. The caller keeps writers out
+ * for the duration, or holds their stores with db_hold, as the files are only
+ * consistent with no store going on.
+ *
+ * @param from
+ * @param to
+ * @param clone_only fail rather than copy a file byte by byte, which takes
+ * time in proportion to the db
+ * @return false if no db file was found or one could not be copied, with
+ * errno EOPNOTSUPP if one only could not be cloned
+ */
+bool db_copy(const char *from, const char *to, bool clone_only);
+/**
+ * @brief Whether any file of a db is at dbLocation
+ *
+ * @param dbLocation
+ * @return true if one is
+ */
+bool db_exists(const char *dbLocation);
+/**
+ * @brief Renames every file of the db at from to the same file of to
+ *
+ * @param from
+ * @param to
+ * @return false if no db file was found or one could not be renamed
+ */
+bool db_rename(const char *from, const char *to);
+/**
+ * @brief Reads every file of the db into the page cache, a chunk at a time
+ * from up to threads threads so a cold disk sees several reads at once, and
+ * the first requests after a start are not served at disk latency
+ *
+ * @param dbLocation
+ * @param threads readers, the calling thread among them
+ * @return uint64_t the bytes read, 0 for no db yet
+ */
+uint64_t db_warm(const char *dbLocation, unsigned threads);
+/**
+ * @brief Formats the entity tag of a key's current value, or of the whole db
+ * for key_str NULL. Tags change with every db_store of the key (any key for
+ * the whole db) and with every restart, so a matching tag means the client
+ * still has the value and the db need not be read at all. Keys may share a
+ * version, which only costs an unneeded full response.
+ *
+ * @param key_str
+ * @param etag DB_ETAG_SIZE bytes
+ */
+void db_etag(const char *key_str, char *etag);
 #endif  // TEMPLATE_DBSTUFF_H
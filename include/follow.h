@@ -0,0 +1,59 @@
+#ifndef TEMPLATE_FOLLOW_H
+#define TEMPLATE_FOLLOW_H
+#include <dc_posix/dc_posix_env.h>
+#include <stdint.h>
+
+#include "ingest.h"
+
+/**
+ * @brief How long the primary may go quiet mid-response before the follower
+ * reconnects
+ *
+ */
+#define FOLLOW_TIMEOUT_MS 10000
+
+/*
+ * A follower tails a primary's changelog over HTTP:
+ *
+ *     GET /ibeacons/changes?since=SEQ&format=binary
+ *
+ * starting from SEQ 0, which gets every beacon, then from each response's
+ * X-Change-Seq on. The body is records in the ingestion encoding, u16 key
+ * length, u16 value length, key, value, so any key or value survives the
+ * trip. A primary that restarted, and numbers on from its start time, or
+ * that the follower fell too far behind answers with every beacon again;
+ * with no deletes, storing them over the follower's copy brings it level.
+ */
+struct follower;
+
+/**
+ * @brief Tails the primary from a thread of its own, handing what it reads
+ * to store a batch at a time
+ *
+ * @param env shared with the thread, has to outlive the follower
+ * @param primary HOST:PORT, [HOST]:PORT for an IPv6 address
+ * @param poll_ms wait between polls once caught up
+ * @param store called on the follower's thread, has to keep the db's other
+ * readers and writers out while it stores
+ * @param arg passed to store
+ * @return struct follower* or NULL if primary does not parse or no thread
+ * could be started
+ */
+struct follower *follow_start(const struct dc_posix_env *env,
+                              const char *primary, int poll_ms,
+                              ingest_store store, const void *arg);
+/**
+ * @brief The primary's sequence number the follower has applied up to, 0
+ * until the first sync finished
+ *
+ * @param follower
+ * @return uint64_t
+ */
+uint64_t follow_seq(const struct follower *follower);
+/**
+ * @brief Stops the thread, abandoning any response in flight
+ *
+ * @param pfollower
+ */
+void follow_stop(struct follower **pfollower);
+#endif  // TEMPLATE_FOLLOW_H
@@ -0,0 +1,65 @@
+#ifndef TEMPLATE_FORM_H
+#define TEMPLATE_FORM_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief One name=value pair of an application/x-www-form-urlencoded string.
+ * Both point into the parsed string and are still percent-encoded. A bare
+ * token ("?all") has a NULL value.
+ *
+ */
+struct form_field
+{
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+};
+
+/**
+ * @brief Cursor over a form-encoded string
+ *
+ */
+struct form_iter
+{
+    const char *pos;
+    const char *end;
+};
+
+/**
+ * @brief Starts iterating the fields of str
+ *
+ * @param iter
+ * @param str query string or request body, without the leading '?'
+ * @param len
+ */
+void form_iter_init(struct form_iter *iter, const char *str, size_t len);
+/**
+ * @brief Advances to the next field. Empty fields ("a=1&&b=2") are skipped.
+ *
+ * @param iter
+ * @param field
+ * @return true if a field was produced, false at the end of the string
+ */
+bool form_next(struct form_iter *iter, struct form_field *field);
+/**
+ * @brief Checks a field's undecoded name
+ *
+ * @param field
+ * @param name
+ * @return true if equal
+ */
+bool form_name_is(const struct form_field *field, const char *name);
+/**
+ * @brief Percent-decodes src ('+' becomes a space) into dest and NUL
+ * terminates it. Invalid escapes are copied through unchanged, %00 decodes to
+ * a NUL that only the returned length tells from the end.
+ *
+ * @param src
+ * @param len
+ * @param dest must hold at least len + 1 bytes
+ * @return length of the decoded string
+ */
+size_t form_decode(const char *src, size_t len, char *dest);
+#endif  // TEMPLATE_FORM_H
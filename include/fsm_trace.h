@@ -0,0 +1,70 @@
+#ifndef TEMPLATE_FSM_TRACE_H
+#define TEMPLATE_FSM_TRACE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Events kept per thread; older ones are overwritten
+ *
+ */
+#define FSM_TRACE_RING_EVENTS 4096
+
+/**
+ * @brief One completed FSM state, as recorded by the did_change_state hook
+ *
+ */
+struct fsm_trace_event
+{
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint32_t connection;
+    int16_t from_state;
+    int16_t to_state;
+};
+
+/**
+ * @brief Turns tracing on. Until this is called fsm_trace_record does nothing.
+ *
+ * @param state_names name per state id, used when dumping
+ * @param state_count number of entries in state_names
+ */
+void fsm_trace_enable(const char *const state_names[], size_t state_count);
+/**
+ * @brief Whether fsm_trace_enable has been called
+ *
+ * @return bool
+ */
+bool fsm_trace_enabled(void);
+/**
+ * @brief Hands out ids for fsm_trace_set_connection
+ *
+ * @return uint32_t
+ */
+uint32_t fsm_trace_next_connection(void);
+/**
+ * @brief Tags the calling thread's following events with a connection id
+ *
+ * @param connection
+ */
+void fsm_trace_set_connection(uint32_t connection);
+/**
+ * @brief Appends an event to the calling thread's ring buffer
+ *
+ * @param from_state
+ * @param to_state state that just ran
+ * @param start_ns when to_state was entered, CLOCK_MONOTONIC
+ * @param end_ns when it returned
+ */
+void fsm_trace_record(int from_state, int to_state, uint64_t start_ns,
+                      uint64_t end_ns);
+/**
+ * @brief Writes every thread's buffered events to fd as Chrome trace JSON
+ * (loadable in chrome://tracing or Perfetto). Only uses write(2), so it is
+ * safe to call from a signal handler.
+ *
+ * @param fd
+ * @return 0 on success, -1 if a write failed
+ */
+int fsm_trace_dump(int fd);
+#endif  // TEMPLATE_FSM_TRACE_H
@@ -1,5 +1,10 @@
 #ifndef TEMPLATE_HTTP__H
 #define TEMPLATE_HTTP__H
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "arena.h"
 #undef OK
 typedef enum response_codes response_codes_t;
 typedef enum request_method request_method_t;
@@ -97,6 +102,7 @@ struct request_line
 {
     char *req_method;
     char *path;
+    char *query;
     char *HTTP_VER;
 };
 /**
@@ -119,6 +125,7 @@ struct http_request
     struct request_line *req_line;
     char *headers;
     char *message_body;
+    bool keep_alive;
 };
 
 /**
@@ -133,19 +140,51 @@ struct http_response
     char *message_body;
 };
 /**
- * @brief Parses an HTTP request string into a struct
+ * @brief Parses an HTTP request string into a struct. Every string the struct
+ * points at is allocated from arena.
  *
  * @param request
  * @param req
+ * @param arena
  */
-void process_request(char *request, struct http_request *req);
+void process_request(char *request, struct http_request *req,
+                     struct arena *arena);
 /**
  * @brief Parses request line out of http request string
  *
  * @param str_in
  * @param req
+ * @param arena
+ */
+void process_request_line(char *req_line_str, struct request_line *req_line,
+                          struct arena *arena);
+/**
+ * @brief Finds a header by case-insensitive name in a block of header lines
+ *
+ * @param headers
+ * @param name
+ * @param value set to the start of the value, not NUL terminated
+ * @return length of the value, 0 if the header is absent
+ */
+size_t find_header(const char *headers, const char *name, const char **value);
+/**
+ * @brief Checks an If-None-Match value against the current entity tag. Weak
+ * tags compare by their opaque part, "*" matches anything.
+ *
+ * @param value header value, not NUL terminated
+ * @param len
+ * @param etag quoted entity tag
+ * @return true if a 304 may be sent
+ */
+bool etag_matches(const char *value, size_t len, const char *etag);
+/**
+ * @brief Parses an HTTP request string for content-length, and returns value if
+ * found or 0 if not.
+ *
+ * @param inputStr
+ * @return ssize_t
  */
-void process_request_line(char *req_line_str, struct request_line *req_line);
+ssize_t getContentLengthFromString(const char *inputStr);
 /**
  * @brief Parses headers out of http request string
  *
@@ -0,0 +1,95 @@
+#ifndef TEMPLATE_HTTP_COMPRESS_H
+#define TEMPLATE_HTTP_COMPRESS_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+/**
+ * @brief Bodies smaller than this go out uncompressed, the headers and the
+ * compressor's work would eat what little they save
+ *
+ */
+#define HTTP_COMPRESS_MIN 1024
+
+/**
+ * @brief Content codings the server can produce
+ *
+ */
+enum http_coding
+{
+    HTTP_CODING_IDENTITY,
+    HTTP_CODING_GZIP,
+    HTTP_CODING_DEFLATE
+};
+
+/**
+ * @brief Response body built up piece by piece in the request arena. Past
+ * HTTP_COMPRESS_MIN bytes everything appended is streamed through this
+ * thread's compressor, so only the compressed form is ever held in full.
+ *
+ */
+struct http_body
+{
+    struct arena *arena;
+    enum http_coding coding;
+    void *stream;
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t raw_len;
+    bool failed;
+};
+
+/**
+ * @brief Picks the coding to answer an Accept-Encoding with: the highest
+ * q-value the server supports, gzip over deflate on a tie
+ *
+ * @param value header value, not NUL terminated, NULL if absent
+ * @param len
+ * @return enum http_coding, HTTP_CODING_IDENTITY if nothing fits
+ */
+enum http_coding http_coding_negotiate(const char *value, size_t len);
+/**
+ * @brief Content-Encoding token of a coding
+ *
+ * @param coding
+ * @return const char* NULL for identity
+ */
+const char *http_coding_name(enum http_coding coding);
+/**
+ * @brief Makes a strong entity tag specific to the coding, since each coding
+ * is a different representation
+ *
+ * @param etag quoted tag, rewritten in place
+ * @param size room at etag
+ * @param coding
+ */
+void http_coding_tag(char *etag, size_t size, enum http_coding coding);
+/**
+ * @brief Starts an empty body
+ *
+ * @param body
+ * @param arena
+ * @param coding negotiated coding, applied only if the body gets large enough
+ */
+void http_body_init(struct http_body *body, struct arena *arena,
+                    enum http_coding coding);
+/**
+ * @brief Appends to the body, compressing from HTTP_COMPRESS_MIN bytes on
+ *
+ * @param body
+ * @param data
+ * @param len
+ * @return false once out of memory or the compressor failed
+ */
+bool http_body_append(struct http_body *body, const char *data, size_t len);
+/**
+ * @brief Flushes the compressor. A body that stayed small is left as it was
+ * appended, with coding reset to HTTP_CODING_IDENTITY.
+ *
+ * @param body
+ * @return false if anything failed along the way
+ */
+bool http_body_finish(struct http_body *body);
+#endif  // TEMPLATE_HTTP_COMPRESS_H
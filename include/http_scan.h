@@ -0,0 +1,111 @@
+#ifndef TEMPLATE_HTTP_SCAN_H
+#define TEMPLATE_HTTP_SCAN_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Bytes of input classified per kernel call
+ *
+ */
+#define HTTP_SCAN_BLOCK 64
+/**
+ * @brief Content length of a message that would not fit MAX_REQUEST_SIZE
+ *
+ */
+#define HTTP_SCAN_TOO_LARGE SIZE_MAX
+
+/**
+ * @brief Delimiter positions in one block, bit i set if byte i matches
+ *
+ */
+struct http_scan_marks
+{
+    uint64_t cr;
+    uint64_t lf;
+    uint64_t colon;
+    uint64_t space;
+};
+
+/**
+ * @brief Delimiter classes understood by http_scan_find
+ *
+ */
+enum http_scan_class
+{
+    HTTP_SCAN_CR,
+    HTTP_SCAN_LF,
+    HTTP_SCAN_COLON,
+    HTTP_SCAN_SPACE
+};
+
+/**
+ * @brief Kernels http_scan_block can classify a block with
+ *
+ */
+enum http_scan_kernel
+{
+    HTTP_SCAN_KERNEL_AUTO,  // the best one the CPU has
+    HTTP_SCAN_KERNEL_SCALAR,
+    HTTP_SCAN_KERNEL_SSE2,
+    HTTP_SCAN_KERNEL_AVX2
+};
+
+/**
+ * @brief Makes every scan from then on use one kernel rather than the one
+ * picked for the CPU, so tests and benchmarks can hold them against each
+ * other. Not to be called while another thread scans.
+ *
+ * @param which
+ * @return false if this build or CPU has no such kernel, the kernel in use
+ * is kept
+ */
+bool http_scan_use(enum http_scan_kernel which);
+/**
+ * @brief Classifies up to HTTP_SCAN_BLOCK bytes in one pass. Uses AVX2 or SSE2
+ * when the CPU has them, picked once at runtime, and a scalar loop otherwise.
+ *
+ * @param buf
+ * @param len at most HTTP_SCAN_BLOCK
+ * @param marks
+ */
+void http_scan_block(const char *buf, size_t len,
+                     struct http_scan_marks *marks);
+/**
+ * @brief Finds the first byte of a delimiter class
+ *
+ * @param buf
+ * @param len
+ * @param cls
+ * @return pointer to the byte, or NULL if not found
+ */
+const char *http_scan_find(const char *buf, size_t len,
+                           enum http_scan_class cls);
+/**
+ * @brief Finds the "\r\n\r\n" that ends an HTTP header block
+ *
+ * @param buf
+ * @param len
+ * @return pointer to the '\r' that starts it, or NULL if not found
+ */
+const char *http_scan_end_of_headers(const char *buf, size_t len);
+/**
+ * @brief Reads the Content-Length header out of a request or response
+ *
+ * @param buf
+ * @param len
+ * @return content length, 0 if the header is absent or the headers are not
+ * complete, HTTP_SCAN_TOO_LARGE if it is over MAX_REQUEST_SIZE
+ */
+size_t http_scan_content_length(const char *buf, size_t len);
+/**
+ * @brief Length of the request at the start of buf, headers plus body
+ *
+ * @param buf
+ * @param len
+ * @return bytes the whole request takes, which may be more than len, 0 if
+ * the headers are not complete yet, or HTTP_SCAN_TOO_LARGE if its body alone
+ * would not fit MAX_REQUEST_SIZE
+ */
+size_t http_scan_request_length(const char *buf, size_t len);
+#endif  // TEMPLATE_HTTP_SCAN_H
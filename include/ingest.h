@@ -0,0 +1,118 @@
+#ifndef TEMPLATE_INGEST_H
+#define TEMPLATE_INGEST_H
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer_pool.h"
+
+/*
+ * Binary beacon ingestion. A gateway sends frames, each a header followed by
+ * records, every integer big-endian:
+ *
+ *     header  u16 magic "IB", u8 version, u8 0, u32 length of the records
+ *     record  u16 key length, u16 value length, key, value
+ *
+ * and gets one ack per frame, in the order the frames were sent:
+ *
+ *     ack     u16 magic "IB", u8 version, u8 status, u32 records stored
+ *
+ * so it can keep frames in flight rather than wait on each. Over UDP each
+ * datagram is one frame and nothing is acked: a datagram that is lost, too
+ * big or malformed is dropped.
+ */
+#define INGEST_MAGIC 0x4942
+#define INGEST_VERSION 1
+#define INGEST_HEADER_SIZE 8
+#define INGEST_RECORD_HEADER_SIZE 4
+/**
+ * @brief Largest records section a frame may carry
+ *
+ */
+#define INGEST_MAX_FRAME (1024 * 1024)
+/**
+ * @brief Largest key plus value, "key : value" has to fit the buffer db_fetch
+ * answers in
+ *
+ */
+#define INGEST_MAX_RECORD (BUFFER_SMALL_SIZE - 4)
+/**
+ * @brief Records handed to the store at a time
+ *
+ */
+#define INGEST_BATCH 256
+/**
+ * @brief Gateways connected at once, more are closed as they come
+ *
+ */
+#define INGEST_MAX_CONNECTIONS 64
+/**
+ * @brief Largest datagram taken, bigger ones are dropped
+ *
+ */
+#define INGEST_MAX_DATAGRAM 8192
+/**
+ * @brief Datagrams taken off the socket per receive
+ *
+ */
+#define INGEST_UDP_BATCH 64
+/**
+ * @brief Most listeners started side by side on one port, one per CPU
+ *
+ */
+#define INGEST_MAX_LISTENERS 64
+
+enum ingest_status
+{
+    INGEST_OK = 0,
+    INGEST_BAD_FRAME,     // nothing stored, the connection closes after the ack
+    INGEST_STORE_FAILED,  // the records before the failing one were stored
+};
+
+/**
+ * @brief One decoded record, both strings NUL terminated
+ *
+ */
+struct ingest_record
+{
+    const char *key;
+    const char *value;
+};
+
+/**
+ * @brief Stores a batch of records in order
+ *
+ * @return the number stored, fewer than count if one failed
+ */
+typedef size_t (*ingest_store)(const struct dc_posix_env *env,
+                               struct dc_error *err, const void *arg,
+                               const struct ingest_record *records,
+                               size_t count);
+
+struct ingest_listener;
+
+/**
+ * @brief Serves frames from a thread of its own, so gateways never wait on
+ * HTTP clients or the other way round
+ *
+ * @param env shared with the thread, has to outlive the listener
+ * @param listen_fd listening TCP socket or -1, taken over
+ * @param udp_fd bound UDP socket or -1, taken over
+ * @param cpu the one CPU the thread runs on, -1 to leave it wherever the
+ * caller may run
+ * @param store
+ * @param arg passed to store
+ * @return struct ingest_listener* or NULL if no thread could be started,
+ * the sockets stay the caller's
+ */
+struct ingest_listener *ingest_start(const struct dc_posix_env *env,
+                                     int listen_fd, int udp_fd, int cpu,
+                                     ingest_store store, const void *arg);
+/**
+ * @brief Stops the thread and closes the listener and its connections
+ *
+ * @param plistener
+ */
+void ingest_stop(struct ingest_listener **plistener);
+#endif  // TEMPLATE_INGEST_H
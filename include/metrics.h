@@ -0,0 +1,158 @@
+#ifndef TEMPLATE_METRICS_H
+#define TEMPLATE_METRICS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Route ids are route table slots; the last id counts requests that
+ * matched no route
+ *
+ */
+#define METRICS_MAX_ROUTES 64
+#define METRICS_ROUTE_UNMATCHED (METRICS_MAX_ROUTES - 1)
+
+/**
+ * @brief Processing-FSM states with a latency histogram
+ *
+ */
+enum metrics_state
+{
+    METRICS_STATE_PROCESS,
+    METRICS_STATE_GET,
+    METRICS_STATE_PUT,
+    METRICS_STATE_INVALID,
+    METRICS_STATE_COUNT
+};
+
+/**
+ * @brief Timed db layer operations
+ *
+ */
+enum metrics_db_op
+{
+    METRICS_DB_STORE,
+    METRICS_DB_FETCH,
+    METRICS_DB_FETCH_ALL,
+    METRICS_DB_OP_COUNT
+};
+
+/**
+ * @brief Caches reporting hits and misses
+ *
+ */
+enum metrics_cache
+{
+    METRICS_CACHE_CONNECTION_POOL,
+    METRICS_CACHE_BUFFER_POOL,
+    METRICS_CACHE_COUNT
+};
+
+/**
+ * @brief Transports of the binary ingestion port, and a follower's feed from
+ * its primary
+ *
+ */
+enum metrics_ingest
+{
+    METRICS_INGEST_TCP,
+    METRICS_INGEST_UDP,
+    METRICS_INGEST_FOLLOW,
+    METRICS_INGEST_COUNT
+};
+
+/**
+ * @brief Phases of startup, timed once each
+ *
+ */
+enum metrics_startup
+{
+    METRICS_STARTUP_ASSETS,
+    METRICS_STARTUP_WAL_REPLAY,
+    METRICS_STARTUP_WARM,
+    METRICS_STARTUP_TOTAL,
+    METRICS_STARTUP_COUNT
+};
+
+/**
+ * @brief Monotonic clock in nanoseconds, for timing
+ *
+ * @return uint64_t
+ */
+uint64_t metrics_now_ns(void);
+/**
+ * @brief Counts a finished request
+ *
+ * @param route_id route table slot or METRICS_ROUTE_UNMATCHED
+ * @param status HTTP status sent
+ */
+void metrics_request(size_t route_id, int status);
+/**
+ * @brief Counts bytes read from and written to clients
+ *
+ * @param in
+ * @param out
+ */
+void metrics_bytes(uint64_t in, uint64_t out);
+/**
+ * @brief Tracks active connections
+ *
+ */
+void metrics_connection_opened(void);
+/**
+ * @brief Tracks active connections
+ *
+ */
+void metrics_connection_closed(void);
+/**
+ * @brief Records one db operation and how long it took
+ *
+ * @param op
+ * @param ns
+ */
+void metrics_db_op(enum metrics_db_op op, uint64_t ns);
+/**
+ * @brief Records time spent in a Processing-FSM state
+ *
+ * @param state
+ * @param ns
+ */
+void metrics_state(enum metrics_state state, uint64_t ns);
+/**
+ * @brief Records a cache hit or miss
+ *
+ * @param cache
+ * @param hit
+ */
+void metrics_cache(enum metrics_cache cache, bool hit);
+/**
+ * @brief Counts records stored from ingested frames and frames turned away,
+ * which over UDP are lost without anyone being told. A follower counts the
+ * records it applied and the syncs with its primary that failed.
+ *
+ * @param transport
+ * @param records
+ * @param rejected
+ */
+void metrics_ingest(enum metrics_ingest transport, uint64_t records,
+                    uint64_t rejected);
+/**
+ * @brief Records how long a startup phase took
+ *
+ * @param phase
+ * @param ns
+ */
+void metrics_startup(enum metrics_startup phase, uint64_t ns);
+/**
+ * @brief Sums every thread's counters and writes them in Prometheus text
+ * format. Like snprintf, returns the length needed even when it exceeds cap.
+ *
+ * @param buf
+ * @param cap
+ * @param route_names label per route id, NULL for unused ids
+ * @param route_count number of entries in route_names
+ * @return size_t length of the full output, excluding the NUL
+ */
+size_t metrics_render(char *buf, size_t cap, const char *const route_names[],
+                      size_t route_count);
+#endif  // TEMPLATE_METRICS_H
@@ -0,0 +1,34 @@
+#ifndef TEMPLATE_ROUTE_HASH_H
+#define TEMPLATE_ROUTE_HASH_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Seeded FNV-1a over a method and path. Shared by route_gen, which
+ * searches for a seed that makes the route table collision free, and the
+ * runtime lookup.
+ *
+ * @param method
+ * @param path
+ * @param len
+ * @param seed
+ * @return uint32_t
+ */
+static inline uint32_t route_hash(int method, const char *path, size_t len,
+                                  uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    size_t i;
+
+    hash ^= (uint32_t)method;
+    hash *= 16777619u;
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)path[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 15;
+
+    return hash;
+}
+#endif  // TEMPLATE_ROUTE_HASH_H
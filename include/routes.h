@@ -0,0 +1,145 @@
+#ifndef TEMPLATE_ROUTES_H
+#define TEMPLATE_ROUTES_H
+#include <dc_posix/dc_posix_env.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http_.h"
+#include "server.h"
+
+/**
+ * @brief Writes the response for a matched route into the server's response
+ * buffer
+ *
+ */
+typedef void (*route_handler)(const struct dc_posix_env *env,
+                              struct dc_error *err, struct server *server);
+
+/**
+ * @brief One slot of the generated route table. Empty slots have a NULL path.
+ *
+ */
+struct route
+{
+    request_method_t method;
+    const char *path;
+    size_t path_len;
+    route_handler handler;
+};
+
+/**
+ * @brief Generated by route_gen from routes.def
+ *
+ */
+extern const struct route route_table[];
+extern const uint32_t route_table_mask;
+extern const uint32_t route_seed;
+
+/**
+ * @brief Parses an HTTP method token
+ *
+ * @param method
+ * @return request_method_t, or -1 if the method is not supported
+ */
+int parse_method(const char *method);
+/**
+ * @brief Inverse of parse_method
+ *
+ * @param method
+ * @return const char* method token, or "?" if unknown
+ */
+const char *method_name(int method);
+/**
+ * @brief Finds the route for an exact method and path
+ *
+ * @param method
+ * @param path
+ * @param path_len
+ * @return const struct route* or NULL if nothing matches
+ */
+const struct route *route_lookup(int method, const char *path,
+                                 size_t path_len);
+
+/**
+ * @brief GET / - welcome text
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void getIndex(const struct dc_posix_env *env, struct dc_error *err,
+              struct server *server);
+/**
+ * @brief GET /ibeacons/data?all or ?KEY - reads beacons from the db
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void getBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server);
+/**
+ * @brief PUT /ibeacons/data - stores a beacon from the request body
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void putBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server);
+/**
+ * @brief GET /ibeacons/watch - streams every stored beacon from now on as a
+ * server-sent event, ?prefix=P and ?major=N narrow the stream
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void watchBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server);
+/**
+ * @brief GET /ibeacons/changes?since=SEQ - the beacons stored after SEQ, or
+ * every beacon if the changelog no longer reaches back to SEQ. X-Change-Seq
+ * carries the SEQ to ask from next time. &format=binary sends them in the
+ * ingestion encoding instead, which is what a follower asks for.
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void getChanges(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server);
+/**
+ * @brief GET /metrics - server counters and latency histograms in Prometheus
+ * text format
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void getMetrics(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server);
+/**
+ * @brief GET /debug/trace - buffered FSM transitions as Chrome trace JSON,
+ * empty unless the server was started with --trace
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void getTrace(const struct dc_posix_env *env, struct dc_error *err,
+              struct server *server);
+/**
+ * @brief PUT /admin/snapshot - writes a point-in-time copy of the db to
+ * --snapshot-dir while stores go on, answering with its name and the
+ * X-Change-Seq it was taken at. 404 unless a snapshot dir is set, 409 while
+ * another snapshot runs or if one of that name exists, 501 if the db files
+ * cannot be cloned and there is no write-ahead log to copy them by.
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void putSnapshot(const struct dc_posix_env *env, struct dc_error *err,
+                 struct server *server);
+#endif  // TEMPLATE_ROUTES_H
@@ -0,0 +1,133 @@
+#ifndef TEMPLATE_SERVER_H
+#define TEMPLATE_SERVER_H
+#include <dc_fsm/fsm.h>
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "admission.h"
+#include "arena.h"
+#include "http_.h"
+
+struct route;
+
+/**
+ * @brief receive_data result when the client missed a deadline, alongside
+ * EXIT_SUCCESS and EXIT_FAILURE
+ *
+ */
+#define RECEIVE_TIMED_OUT 2
+/**
+ * @brief receive_data result when the request's Content-Length is more than
+ * the buffer holds
+ *
+ */
+#define RECEIVE_TOO_LARGE 3
+
+/**
+ * @brief How long a client gets for each phase of a request, in milliseconds
+ *
+ */
+struct server_timeouts
+{
+    int idle_ms;
+    int header_ms;
+    int body_ms;
+};
+
+/**
+ * @brief Server info used in Processing-FSM. One per connection, checked out
+ * of a server_pool on accept and returned on close. With defer_io set the
+ * request handlers never touch client_socket_fd: the whole response is left
+ * in out, spilling into the arena if it outgrows the pooled buffer kept in
+ * out_pooled, for the io_uring backend to send. A large body that lives
+ * elsewhere (a mapped static file) is referenced by out_ref and sent after out.
+ *
+ */
+struct server
+{
+    const char *dbLoc;
+    int client_socket_fd;
+    struct dc_fsm_info *fsm_info;
+    struct arena *arena;
+    char *recv_buf;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    bool pooled;
+    bool defer_io;
+    char *out_pooled;
+    const char *out_ref;
+    size_t out_ref_len;
+    const struct server_timeouts *timeouts;
+    struct admission *admission;
+    bool admitted;
+    enum admission_class admission_class;
+    const struct route *route;
+    int status;
+    struct http_request req;
+    struct http_response res;
+};
+
+/**
+ * @brief Pool of pre-initialized connection contexts
+ *
+ */
+struct server_pool
+{
+    struct server *contexts;
+    struct server **free_list;
+    size_t size;
+    size_t free_count;
+    const char *dbLoc;
+    struct server_timeouts timeouts;
+    struct admission admission;
+};
+
+/**
+ * @brief Creates a pool of size connection contexts, each with its FSM info,
+ * request arena, receive buffer and response buffer already allocated.
+ * Timeouts start out as -1 (wait forever) and admission limits as 0
+ * (unlimited) until the caller sets them.
+ *
+ * @param env
+ * @param err
+ * @param size
+ * @param dbLoc
+ * @return struct server_pool*
+ */
+struct server_pool *server_pool_create(const struct dc_posix_env *env,
+                                       struct dc_error *err, size_t size,
+                                       const char *dbLoc);
+/**
+ * @brief Takes a context out of the pool for client_socket_fd. Falls back to
+ * a freshly allocated context when the pool is exhausted.
+ *
+ * @param env
+ * @param err
+ * @param pool
+ * @param client_socket_fd
+ * @return struct server* or NULL if out of memory
+ */
+struct server *server_pool_checkout(const struct dc_posix_env *env,
+                                    struct dc_error *err,
+                                    struct server_pool *pool,
+                                    int client_socket_fd);
+/**
+ * @brief Returns a context to the pool once its connection is closed
+ *
+ * @param env
+ * @param pool
+ * @param server
+ */
+void server_pool_checkin(const struct dc_posix_env *env,
+                         struct server_pool *pool, struct server *server);
+/**
+ * @brief Frees the pool and every context in it
+ *
+ * @param env
+ * @param ppool
+ */
+void server_pool_destroy(const struct dc_posix_env *env,
+                         struct server_pool **ppool);
+#endif  // TEMPLATE_SERVER_H
@@ -0,0 +1,83 @@
+#ifndef TEMPLATE_STATIC_ASSETS_H
+#define TEMPLATE_STATIC_ASSETS_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Bodies up to this size are kept in memory right behind their
+ * headers, so a hit is a single copy of a ready response. Bigger files stay
+ * in the page cache and are sent from there.
+ *
+ */
+#define STATIC_INLINE_MAX (64 * 1024)
+
+/**
+ * @brief One file (or built-in page) with its responses prepared at load
+ * time. Arrays indexed by keep-alive hold the Connection: close and
+ * Connection: keep-alive variants.
+ *
+ */
+struct static_asset
+{
+    char *path;
+    size_t path_len;
+    int status;
+    char etag[20];
+    const char *body;
+    size_t body_len;
+    void *mapped;
+    int fd;
+    char *response[2];
+    size_t response_len[2];
+    size_t head_len[2];
+    char *not_modified[2];
+    size_t not_modified_len[2];
+};
+
+/**
+ * @brief Every asset, hashed on path
+ *
+ */
+struct static_assets
+{
+    struct static_asset *slots;
+    size_t mask;
+    size_t count;
+    struct static_asset index;
+    struct static_asset not_found;
+};
+
+/**
+ * @brief Prepares the built-in welcome text and 404 page, then every regular
+ * file under dir. dir/index.html and dir/404.html replace the built-ins;
+ * any other file is served at its path relative to dir.
+ *
+ * @param dir NULL for the built-ins only
+ * @return struct static_assets* or NULL if out of memory
+ */
+struct static_assets *static_assets_load(const char *dir);
+/**
+ * @brief Releases the assets and their mappings
+ *
+ * @param passets
+ */
+void static_assets_destroy(struct static_assets **passets);
+/**
+ * @brief Finds the file served at path
+ *
+ * @param assets
+ * @param path
+ * @param len
+ * @return const struct static_asset* or NULL
+ */
+const struct static_asset *static_assets_find(const struct static_assets *assets,
+                                              const char *path, size_t len);
+/**
+ * @brief Whether the body is sent apart from the prepared headers, from fd
+ * or the mapping at body
+ *
+ * @param asset
+ * @return true for files over STATIC_INLINE_MAX
+ */
+bool static_asset_is_large(const struct static_asset *asset);
+#endif  // TEMPLATE_STATIC_ASSETS_H
@@ -0,0 +1,50 @@
+#ifndef TEMPLATE_URING_SERVER_H
+#define TEMPLATE_URING_SERVER_H
+#include <dc_posix/dc_posix_env.h>
+#include <signal.h>
+#include <stdbool.h>
+
+#include "server.h"
+
+/**
+ * @brief Submission queue entries; the completion queue gets twice as many
+ *
+ */
+#define URING_SERVER_ENTRIES 256
+
+/**
+ * @brief Serves one request framed in server->recv_buf, leaving the response
+ * in server->out
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param received EXIT_SUCCESS, EXIT_FAILURE, RECEIVE_TIMED_OUT or
+ * RECEIVE_TOO_LARGE, as from receive_data
+ * @return true to keep the connection open once the response is sent
+ */
+typedef bool (*uring_server_handler)(const struct dc_posix_env *env,
+                                     struct dc_error *err,
+                                     struct server *server, int received);
+
+/**
+ * @brief Serves listen_fd from one io_uring until *stop is set: a multishot
+ * accept, reads into the pool's receive buffers registered with the kernel,
+ * deadline timeouts linked to each read and every response sent with a
+ * linked close when the connection ends. Connections pass admission control
+ * and use the pool's timeouts as on the blocking path.
+ *
+ * @param env
+ * @param err
+ * @param pool
+ * @param listen_fd
+ * @param handler
+ * @param stop
+ * @return 0 once stopped, or -1 with errno set if io_uring is not available,
+ * before any connection was taken
+ */
+int uring_server_run(const struct dc_posix_env *env, struct dc_error *err,
+                     struct server_pool *pool, int listen_fd,
+                     uring_server_handler handler,
+                     volatile sig_atomic_t *stop);
+#endif  // TEMPLATE_URING_SERVER_H
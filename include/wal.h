@@ -0,0 +1,105 @@
+#ifndef TEMPLATE_WAL_H
+#define TEMPLATE_WAL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Once the log grows past this it is checkpointed: the db is synced
+ * and the log emptied
+ *
+ */
+#define WAL_CHECKPOINT_BYTES (64 * 1024 * 1024)
+/**
+ * @brief Largest key plus value a record may carry
+ *
+ */
+#define WAL_MAX_RECORD (64 * 1024)
+
+/**
+ * @brief When appended records reach the disk
+ *
+ */
+enum wal_sync
+{
+    WAL_SYNC_NONE,    // left to the kernel, survives a crash of the server only
+    WAL_SYNC_BATCH,   // synced every batch_ms, that long may be lost
+    WAL_SYNC_ALWAYS,  // synced before wal_commit returns
+};
+
+/**
+ * @brief Called for each record on replay, oldest first
+ *
+ * @return false to stop the replay, which then fails
+ */
+typedef bool (*wal_visitor)(void *arg, const char *key, const char *value);
+
+/**
+ * @brief An append-only log of stores, written before the db so a store the
+ * db lost can be redone. Records are a u32 length, a u32 CRC-32 and the
+ * body: u16 key length, u16 value length, key, value, integers big-endian.
+ *
+ */
+struct wal;
+
+/**
+ * @brief Opens the log at path, creating it if need be, and replays every
+ * record in it through visit. A torn or corrupt tail, left by a crash part
+ * way through an append, ends the replay and is cut off.
+ *
+ * @param path
+ * @param sync
+ * @param batch_ms sync interval for WAL_SYNC_BATCH
+ * @param visit
+ * @param arg passed to visit
+ * @return struct wal* or NULL if the log could not be opened or replayed
+ */
+struct wal *wal_open(const char *path, enum wal_sync sync, int batch_ms,
+                     wal_visitor visit, void *arg);
+/**
+ * @brief Syncs and closes the log
+ *
+ * @param pwal
+ */
+void wal_close(struct wal **pwal);
+/**
+ * @brief Buffers a record, nothing is written until wal_commit
+ *
+ * @param wal
+ * @param key
+ * @param value
+ * @return false if the record is too big or out of memory
+ */
+bool wal_append(struct wal *wal, const char *key, const char *value);
+/**
+ * @brief Writes the buffered records and syncs them as the policy says. A
+ * caller applies them to the db only after this succeeded.
+ *
+ * @param wal
+ * @return false if the log could not be written, the records are dropped
+ */
+bool wal_commit(struct wal *wal);
+/**
+ * @brief Bytes in the log
+ *
+ * @param wal
+ * @return uint64_t
+ */
+uint64_t wal_size(const struct wal *wal);
+/**
+ * @brief Empties the log. Only safe once everything in it is durable in the
+ * db.
+ *
+ * @param wal
+ * @return false if the log could not be truncated
+ */
+bool wal_checkpoint(struct wal *wal);
+/**
+ * @brief Parses always, batch or none
+ *
+ * @param name
+ * @param sync
+ * @return false if name is none of them
+ */
+bool wal_parse_sync(const char *name, enum wal_sync *sync);
+#endif  // TEMPLATE_WAL_H
@@ -0,0 +1,30 @@
+#ifndef TEMPLATE_WATCH_H
+#define TEMPLATE_WATCH_H
+#include <stdbool.h>
+
+#include "change_feed.h"
+
+/**
+ * @brief A watcher with nothing to send gets a comment this often, which
+ * keeps proxies from timing the stream out and finds clients that left
+ *
+ */
+#define WATCH_KEEPALIVE_MS 15000
+/**
+ * @brief A client that takes longer than this to accept an event is dropped
+ *
+ */
+#define WATCH_SEND_TIMEOUT_MS 10000
+
+/**
+ * @brief Streams a subscriber's changes to a client as server-sent events from
+ * a thread of its own, so an open watch never holds a serving thread. The
+ * thread writes the response headers itself; the caller must not send
+ * anything on fd.
+ *
+ * @param sub taken over, unsubscribed when the stream ends
+ * @param fd taken over, closed when the stream ends
+ * @return false if no thread could be started, sub and fd stay the caller's
+ */
+bool watch_start(struct change_subscriber *sub, int fd);
+#endif  // TEMPLATE_WATCH_H
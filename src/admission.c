@@ -0,0 +1,182 @@
+// struct tcp_info is a BSD extension glibc hides under strict POSIX
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include "admission.h"
+#include "http_.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool under(atomic_uint *count, unsigned int limit);
+static bool peeks_put(int client_fd);
+
+void admission_init(struct admission *admission, unsigned int max_connections,
+                    unsigned int max_queued, unsigned int max_in_flight,
+                    unsigned int max_bulk_reads, unsigned int retry_after)
+{
+    admission->max_connections = max_connections;
+    admission->max_queued = max_queued;
+    admission->max_in_flight = max_in_flight;
+    admission->max_bulk_reads = max_bulk_reads;
+    admission->retry_after = retry_after;
+    atomic_init(&admission->connections, 0);
+    atomic_init(&admission->in_flight, 0);
+    atomic_init(&admission->bulk_reads, 0);
+}
+
+enum admission_verdict admission_connection(struct admission *admission,
+                                            int client_fd, int listen_fd)
+{
+    int queued;
+    bool overloaded = false;
+
+    if (admission->max_queued)
+    {
+        queued = admission_accept_queue_length(listen_fd);
+        overloaded = queued >= 0 && (unsigned int)queued > admission->max_queued;
+    }
+
+    if (!overloaded && under(&admission->connections, admission->max_connections))
+    {
+        return ADMISSION_ADMIT;
+    }
+
+    // writes get a quarter again as many connections on top of the limit
+    if (peeks_put(client_fd) &&
+        under(&admission->connections,
+              admission->max_connections + (admission->max_connections + 3) / 4))
+    {
+        return ADMISSION_ADMIT;
+    }
+
+    return ADMISSION_OVERLOADED;
+}
+
+void admission_connection_done(struct admission *admission)
+{
+    atomic_fetch_sub_explicit(&admission->connections, 1, memory_order_relaxed);
+}
+
+enum admission_verdict admission_request(struct admission *admission,
+                                         enum admission_class cls)
+{
+    unsigned int limit = admission->max_in_flight;
+
+    // plain reads leave a quarter of the slots to writes
+    if (cls != ADMISSION_WRITE && limit)
+    {
+        limit -= limit / 4;
+    }
+
+    if (cls == ADMISSION_BULK_READ && !under(&admission->bulk_reads, admission->max_bulk_reads))
+    {
+        return ADMISSION_THROTTLED;
+    }
+
+    if (!under(&admission->in_flight, limit))
+    {
+        if (cls == ADMISSION_BULK_READ)
+        {
+            atomic_fetch_sub_explicit(&admission->bulk_reads, 1, memory_order_relaxed);
+        }
+        return ADMISSION_OVERLOADED;
+    }
+
+    return ADMISSION_ADMIT;
+}
+
+void admission_request_done(struct admission *admission,
+                            enum admission_class cls)
+{
+    if (cls == ADMISSION_BULK_READ)
+    {
+        atomic_fetch_sub_explicit(&admission->bulk_reads, 1, memory_order_relaxed);
+    }
+    atomic_fetch_sub_explicit(&admission->in_flight, 1, memory_order_relaxed);
+}
+
+int admission_accept_queue_length(int listen_fd)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    // for a listening socket Linux reports the accept queue in tcpi_unacked
+    if (getsockopt(listen_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+    {
+        return (int)info.tcpi_unacked;
+    }
+#else
+    (void)listen_fd;
+#endif
+    return -1;
+}
+
+void admission_reject_connection(const struct admission *admission,
+                                 int client_fd)
+{
+    char response[192];
+    char drain[512];
+    int len;
+
+    len = snprintf(response, sizeof(response),
+                   "HTTP/1.0 %d Service Unavailable\r\nContent-Type: "
+                   "text/plain\r\nRetry-After: %u\r\nConnection: "
+                   "close\r\nContent-Length: 24\r\n\r\n503 Service Unavailable\n",
+                   SERVICE_UNAVAILABLE, admission->retry_after);
+    // a fresh socket has room for this; a client that cannot take it loses it
+    send(client_fd, response, (size_t)len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(client_fd, SHUT_WR);
+    // closing with unread input resets the connection and may discard the
+    // response, so take whatever has already arrived
+    while (recv(client_fd, drain, sizeof(drain), MSG_DONTWAIT) > 0)
+    {
+    }
+}
+
+/**
+ * @brief Takes a slot if fewer than limit are in use
+ *
+ * @param count
+ * @param limit 0 for unlimited
+ * @return true if a slot was taken
+ */
+static bool under(atomic_uint *count, unsigned int limit)
+{
+    unsigned int current = atomic_load_explicit(count, memory_order_relaxed);
+
+    do
+    {
+        if (limit && current >= limit)
+        {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(count, &current, current + 1,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+
+    return true;
+}
+
+/**
+ * @brief Checks, without consuming or waiting, whether the client has already
+ * sent the start of a PUT
+ *
+ * @param client_fd
+ * @return true if so
+ */
+static bool peeks_put(int client_fd)
+{
+    char method[4];
+
+    return recv(client_fd, method, sizeof(method), MSG_PEEK | MSG_DONTWAIT) ==
+               (ssize_t)sizeof(method) &&
+           memcmp(method, "PUT ", sizeof(method)) == 0;
+}
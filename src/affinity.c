@@ -0,0 +1,270 @@
+// sched_setaffinity(2) and cpu_set_t are GNU extensions
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "affinity.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief Most NUMA nodes looked for
+ *
+ */
+#define MAX_NODES 64
+
+static bool parse_cpus(const char *list, cpu_set_t *set);
+static bool read_node_cpus(int node, cpu_set_t *set);
+
+int affinity_pin(const char *list)
+{
+    cpu_set_t set;
+    size_t cpu;
+
+    if (!parse_cpus(list, &set) || sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+        return -1;
+    }
+    for (cpu = 0; !CPU_ISSET(cpu, &set); cpu++)
+    {
+    }
+
+    // below CPU_SETSIZE
+    return (int)cpu;
+}
+
+bool affinity_pin_thread(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    CPU_ZERO(&set);
+    CPU_SET((size_t)cpu, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+size_t affinity_cpus(int *cpus, size_t max)
+{
+    cpu_set_t set;
+    size_t count = 0;
+    size_t cpu;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return 0;
+    }
+    for (cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set))
+        {
+            cpus[count++] = (int)cpu;
+        }
+    }
+
+    return count;
+}
+
+bool affinity_prefer_local_node(void)
+{
+    cpu_set_t mine;
+    cpu_set_t node_cpus;
+    unsigned long mask;
+    int found = -1;
+    int node;
+
+    if (sched_getaffinity(0, sizeof(mine), &mine) != 0)
+    {
+        return false;
+    }
+    for (node = 0; node < MAX_NODES; node++)
+    {
+        if (!read_node_cpus(node, &node_cpus))
+        {
+            continue;
+        }
+        CPU_AND(&node_cpus, &node_cpus, &mine);
+        if (CPU_COUNT(&node_cpus) == 0)
+        {
+            continue;
+        }
+        // spread over nodes, local first-touch placement already does best
+        if (found >= 0)
+        {
+            return false;
+        }
+        found = node;
+    }
+    if (found < 0)
+    {
+        return false;
+    }
+
+    mask = 1ul << found;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                   (unsigned long)MAX_NODES + 1) == 0;
+}
+
+bool affinity_share_port(int fd)
+{
+    int one = 1;
+
+    return setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0;
+}
+
+bool affinity_steer(int fd, int cpu)
+{
+#ifdef SO_INCOMING_CPU
+    return setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == 0;
+#else
+    (void)fd;
+    (void)cpu;
+    errno = ENOPROTOOPT;
+    return false;
+#endif
+}
+
+/**
+ * @brief Parses a CPU list, comma separated CPU numbers and ranges
+ *
+ * @param list "0-7,16"
+ * @param set
+ * @return false if it does not parse, names a CPU past CPU_SETSIZE or none
+ */
+static bool parse_cpus(const char *list, cpu_set_t *set)
+{
+    const char *at = list;
+    char *end;
+    unsigned long first;
+    unsigned long last;
+
+    CPU_ZERO(set);
+    while (*at)
+    {
+        first = strtoul(at, &end, 10);
+        last = first;
+        if (end == at)
+        {
+            return false;
+        }
+        if (*end == '-')
+        {
+            at = end + 1;
+            last = strtoul(at, &end, 10);
+            if (end == at)
+            {
+                return false;
+            }
+        }
+        if (first > last || last >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        for (; first <= last; first++)
+        {
+            CPU_SET(first, set);
+        }
+        at = end;
+        if (*at == ',')
+        {
+            at++;
+        }
+        else if (*at != '\0' && *at != '\n')
+        {
+            return false;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+
+/**
+ * @brief The CPUs of a NUMA node, from sysfs
+ *
+ * @param node
+ * @param set
+ * @return false if there is no such node
+ */
+static bool read_node_cpus(int node, cpu_set_t *set)
+{
+    char path[64];
+    char list[1024];
+    FILE *file;
+    bool ok;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+    ok = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+
+    // a node without CPUs has an empty list
+    if (ok && !parse_cpus(list, set))
+    {
+        CPU_ZERO(set);
+    }
+
+    return ok;
+}
+#else
+int affinity_pin(const char *list)
+{
+    (void)list;
+    errno = ENOSYS;
+    return -1;
+}
+
+bool affinity_pin_thread(int cpu)
+{
+    (void)cpu;
+    errno = ENOSYS;
+    return false;
+}
+
+size_t affinity_cpus(int *cpus, size_t max)
+{
+    (void)cpus;
+    (void)max;
+    return 0;
+}
+
+bool affinity_prefer_local_node(void)
+{
+    return false;
+}
+
+bool affinity_share_port(int fd)
+{
+    int one = 1;
+
+    return setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0;
+}
+
+bool affinity_steer(int fd, int cpu)
+{
+    (void)fd;
+    (void)cpu;
+    errno = ENOPROTOOPT;
+    return false;
+}
+#endif
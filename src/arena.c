@@ -0,0 +1,132 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(struct arena_chunk))
+
+struct arena *arena_create(size_t size)
+{
+    struct arena *arena = (struct arena *)malloc(sizeof(struct arena));
+
+    if (!arena)
+    {
+        return NULL;
+    }
+
+    arena->base = (char *)malloc(size);
+    if (!arena->base)
+    {
+        free(arena);
+        return NULL;
+    }
+    arena->size = size;
+    arena->used = 0;
+    arena->overflow = NULL;
+
+    return arena;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+    size_t chunkSize;
+    void *ptr;
+
+    size = ALIGN_UP(size);
+
+    // fast path: bump the main block
+    if (size <= arena->size - arena->used)
+    {
+        ptr = arena->base + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+
+    // then the most recent overflow chunk
+    chunk = arena->overflow;
+    if (chunk && size <= chunk->size - chunk->used)
+    {
+        ptr = (char *)chunk + CHUNK_HEADER_SIZE + chunk->used;
+        chunk->used += size;
+        return ptr;
+    }
+
+    // request outgrew the arena, chain another chunk until the next reset
+    chunkSize = size > arena->size ? size : arena->size;
+    chunk = (struct arena_chunk *)malloc(CHUNK_HEADER_SIZE + chunkSize);
+    if (!chunk)
+    {
+        return NULL;
+    }
+    chunk->next = arena->overflow;
+    chunk->size = chunkSize;
+    chunk->used = size;
+    arena->overflow = chunk;
+
+    return (char *)chunk + CHUNK_HEADER_SIZE;
+}
+
+void *arena_calloc(struct arena *arena, size_t count, size_t size)
+{
+    void *ptr;
+
+    if (size && count > (size_t)-1 / size)
+    {
+        return NULL;
+    }
+
+    ptr = arena_alloc(arena, count * size);
+    if (ptr)
+    {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t n)
+{
+    size_t len = strnlen(str, n);
+    char *copy = (char *)arena_alloc(arena, len + 1);
+
+    if (copy)
+    {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+
+    return copy;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+    return arena_strndup(arena, str, strlen(str));
+}
+
+void arena_reset(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+
+    while (arena->overflow)
+    {
+        chunk = arena->overflow;
+        arena->overflow = chunk->next;
+        free(chunk);
+    }
+    arena->used = 0;
+}
+
+void arena_destroy(struct arena **parena)
+{
+    struct arena *arena = *parena;
+
+    if (arena)
+    {
+        arena_reset(arena);
+        free(arena->base);
+        free(arena);
+        *parena = NULL;
+    }
+}
@@ -0,0 +1,196 @@
+#include "buffer_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "metrics.h"
+
+#define BUFFER_CLASSES 2
+#define SLAB_BUFFERS 32
+#define THREAD_CACHE_MAX 16
+
+/**
+ * @brief Sits in front of every buffer so buffer_pool_put can find its class
+ * and the free lists can be threaded through it
+ *
+ */
+union buffer_header
+{
+    struct
+    {
+        union buffer_header *next;
+        unsigned int cls;
+    } h;
+    max_align_t align;
+};
+
+/**
+ * @brief Shared free list for one size class
+ *
+ */
+struct buffer_depot
+{
+    pthread_mutex_t lock;
+    union buffer_header *free;
+};
+
+/**
+ * @brief Per-thread stack of buffers for one size class
+ *
+ */
+struct buffer_cache
+{
+    union buffer_header *free;
+    unsigned int count;
+};
+
+static const size_t class_sizes[BUFFER_CLASSES] = {BUFFER_SMALL_SIZE,
+                                                   BUFFER_LARGE_SIZE};
+static struct buffer_depot depots[BUFFER_CLASSES] = {
+    {PTHREAD_MUTEX_INITIALIZER, NULL},
+    {PTHREAD_MUTEX_INITIALIZER, NULL},
+};
+static _Thread_local struct buffer_cache caches[BUFFER_CLASSES];
+
+static void refill(unsigned int cls);
+
+void *buffer_pool_get(size_t size)
+{
+    unsigned int cls;
+    union buffer_header *buf;
+
+    for (cls = 0; cls < BUFFER_CLASSES && size > class_sizes[cls]; cls++)
+    {
+    }
+    if (cls == BUFFER_CLASSES)
+    {
+        return NULL;
+    }
+
+    metrics_cache(METRICS_CACHE_BUFFER_POOL, caches[cls].free != NULL);
+    if (caches[cls].free == NULL)
+    {
+        refill(cls);
+        if (caches[cls].free == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    buf = caches[cls].free;
+    caches[cls].free = buf->h.next;
+    caches[cls].count--;
+
+    return buf + 1;
+}
+
+void buffer_pool_put(void *ptr)
+{
+    union buffer_header *buf;
+    struct buffer_cache *cache;
+    struct buffer_depot *depot;
+    unsigned int i;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    buf = (union buffer_header *)ptr - 1;
+    cache = &caches[buf->h.cls];
+    buf->h.next = cache->free;
+    cache->free = buf;
+    cache->count++;
+
+    // cache full, give half back so one thread cannot hoard the pool
+    if (cache->count > THREAD_CACHE_MAX)
+    {
+        union buffer_header *head = cache->free;
+        union buffer_header *tail = head;
+
+        for (i = 1; i < THREAD_CACHE_MAX / 2; i++)
+        {
+            tail = tail->h.next;
+        }
+        cache->free = tail->h.next;
+        cache->count -= THREAD_CACHE_MAX / 2;
+
+        depot = &depots[buf->h.cls];
+        pthread_mutex_lock(&depot->lock);
+        tail->h.next = depot->free;
+        depot->free = head;
+        pthread_mutex_unlock(&depot->lock);
+    }
+}
+
+size_t buffer_pool_capacity(const void *ptr)
+{
+    const union buffer_header *buf = (const union buffer_header *)ptr - 1;
+
+    return class_sizes[buf->h.cls];
+}
+
+void buffer_pool_thread_flush(void)
+{
+    unsigned int cls;
+    union buffer_header *tail;
+
+    for (cls = 0; cls < BUFFER_CLASSES; cls++)
+    {
+        if (caches[cls].free == NULL)
+        {
+            continue;
+        }
+        for (tail = caches[cls].free; tail->h.next; tail = tail->h.next)
+        {
+        }
+        pthread_mutex_lock(&depots[cls].lock);
+        tail->h.next = depots[cls].free;
+        depots[cls].free = caches[cls].free;
+        pthread_mutex_unlock(&depots[cls].lock);
+        caches[cls].free = NULL;
+        caches[cls].count = 0;
+    }
+}
+
+static void refill(unsigned int cls)
+{
+    struct buffer_depot *depot = &depots[cls];
+    struct buffer_cache *cache = &caches[cls];
+    size_t stride;
+    char *slab;
+    union buffer_header *buf;
+    unsigned int i;
+
+    // take up to half a cache's worth from the shared list
+    pthread_mutex_lock(&depot->lock);
+    while (depot->free && cache->count < THREAD_CACHE_MAX / 2)
+    {
+        buf = depot->free;
+        depot->free = buf->h.next;
+        buf->h.next = cache->free;
+        cache->free = buf;
+        cache->count++;
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    if (cache->free)
+    {
+        return;
+    }
+
+    // nothing shared either, carve a new slab. Slabs live for the process.
+    stride = sizeof(union buffer_header) + class_sizes[cls];
+    slab = malloc(stride * SLAB_BUFFERS);
+    if (slab == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < SLAB_BUFFERS; i++)
+    {
+        buf = (union buffer_header *)(slab + i * stride);
+        buf->h.cls = cls;
+        buf->h.next = cache->free;
+        cache->free = buf;
+        cache->count++;
+    }
+}
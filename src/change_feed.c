@@ -0,0 +1,388 @@
+#include "change_feed.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief How long change_feed_destroy gives subscribers to leave
+ *
+ */
+#define DRAIN_MS 2000
+
+static bool matches(const struct change_subscriber *sub,
+                    const struct change *change);
+static void deadline_in(struct timespec *ts, int ms);
+static void log_change(struct change_feed *feed, struct change *change);
+static void log_clear(struct change_feed *feed);
+
+struct change_feed *change_feed_create(size_t max_subscribers)
+{
+    struct change_feed *feed;
+    struct timespec now;
+    pthread_condattr_t attr;
+
+    feed = calloc(1, sizeof(struct change_feed));
+    if (feed == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&feed->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&feed->left, &attr);
+    pthread_condattr_destroy(&attr);
+    feed->max_subscribers = max_subscribers;
+    clock_gettime(CLOCK_REALTIME, &now);
+    feed->seq = (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+    feed->log_start = feed->seq;
+
+    return feed;
+}
+
+void change_feed_destroy(struct change_feed **pfeed)
+{
+    struct change_feed *feed = *pfeed;
+    struct change_subscriber *sub;
+    struct timespec deadline;
+    bool drained;
+
+    if (feed == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&feed->lock);
+    feed->closed = true;
+    for (sub = feed->subscribers; sub; sub = sub->next)
+    {
+        pthread_cond_signal(&sub->ready);
+    }
+    deadline_in(&deadline, DRAIN_MS);
+    while (feed->count > 0 &&
+           pthread_cond_timedwait(&feed->left, &feed->lock, &deadline) == 0)
+    {
+    }
+    drained = feed->count == 0;
+    pthread_mutex_unlock(&feed->lock);
+
+    // a subscriber still stuck in a send holds on to the feed, leave it be
+    if (drained)
+    {
+        log_clear(feed);
+        pthread_cond_destroy(&feed->left);
+        pthread_mutex_destroy(&feed->lock);
+        free(feed);
+    }
+    *pfeed = NULL;
+}
+
+uint64_t change_feed_publish(struct change_feed *feed, const char *key,
+                             const char *value)
+{
+    struct change_subscriber *sub;
+    struct change *change;
+    size_t keyLen = strlen(key);
+    size_t valueLen = strlen(value);
+    uint64_t seq;
+
+    change = malloc(sizeof(struct change) + keyLen + valueLen + 2);
+    if (change == NULL)
+    {
+        pthread_mutex_lock(&feed->lock);
+        // nobody can be handed this one, so nobody may think they have it
+        seq = ++feed->seq;
+        log_clear(feed);
+        for (sub = feed->subscribers; sub; sub = sub->next)
+        {
+            sub->dropped++;
+            pthread_cond_signal(&sub->ready);
+        }
+        pthread_mutex_unlock(&feed->lock);
+        return seq;
+    }
+    memcpy(change->data, key, keyLen + 1);
+    memcpy(change->data + keyLen + 1, value, valueLen + 1);
+    change->key = change->data;
+    change->key_len = keyLen;
+    change->value = change->data + keyLen + 1;
+    change->value_len = valueLen;
+    // the log's reference
+    atomic_init(&change->refs, 1);
+
+    pthread_mutex_lock(&feed->lock);
+    seq = change->seq = ++feed->seq;
+    log_change(feed, change);
+    for (sub = feed->subscribers; sub; sub = sub->next)
+    {
+        if (sub->slow || !matches(sub, change))
+        {
+            continue;
+        }
+        if (sub->count == CHANGE_FEED_BUFFER)
+        {
+            change_release(sub->queue[sub->head]);
+            sub->head = (sub->head + 1) % CHANGE_FEED_BUFFER;
+            sub->count--;
+            sub->dropped++;
+            sub->slow = sub->dropped >= CHANGE_FEED_SLOW_LIMIT;
+        }
+        atomic_fetch_add_explicit(&change->refs, 1, memory_order_relaxed);
+        sub->queue[(sub->head + sub->count) % CHANGE_FEED_BUFFER] = change;
+        sub->count++;
+        pthread_cond_signal(&sub->ready);
+    }
+    pthread_mutex_unlock(&feed->lock);
+
+    return seq;
+}
+
+struct change_subscriber *change_feed_subscribe(struct change_feed *feed,
+                                                const char *prefix,
+                                                size_t prefix_len, long major)
+{
+    struct change_subscriber *sub;
+    pthread_condattr_t attr;
+
+    sub = calloc(1, sizeof(struct change_subscriber));
+    if (sub == NULL)
+    {
+        return NULL;
+    }
+    sub->prefix = malloc(prefix_len + 1);
+    if (sub->prefix == NULL)
+    {
+        free(sub);
+        return NULL;
+    }
+    memcpy(sub->prefix, prefix, prefix_len);
+    sub->prefix[prefix_len] = '\0';
+    sub->prefix_len = prefix_len;
+    sub->major = major;
+    sub->feed = feed;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sub->ready, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&feed->lock);
+    if (feed->closed ||
+        (feed->max_subscribers && feed->count >= feed->max_subscribers))
+    {
+        pthread_mutex_unlock(&feed->lock);
+        pthread_cond_destroy(&sub->ready);
+        free(sub->prefix);
+        free(sub);
+        return NULL;
+    }
+    sub->next = feed->subscribers;
+    feed->subscribers = sub;
+    feed->count++;
+    pthread_mutex_unlock(&feed->lock);
+
+    return sub;
+}
+
+void change_feed_unsubscribe(struct change_subscriber *sub)
+{
+    struct change_feed *feed = sub->feed;
+    struct change_subscriber **link;
+
+    pthread_mutex_lock(&feed->lock);
+    for (link = &feed->subscribers; *link; link = &(*link)->next)
+    {
+        if (*link == sub)
+        {
+            *link = sub->next;
+            break;
+        }
+    }
+    feed->count--;
+    pthread_cond_signal(&feed->left);
+    pthread_mutex_unlock(&feed->lock);
+
+    while (sub->count)
+    {
+        change_release(sub->queue[sub->head]);
+        sub->head = (sub->head + 1) % CHANGE_FEED_BUFFER;
+        sub->count--;
+    }
+    pthread_cond_destroy(&sub->ready);
+    free(sub->prefix);
+    free(sub);
+}
+
+int change_feed_wait(struct change_subscriber *sub, struct change **out,
+                     size_t max, uint64_t *dropped, int timeout_ms)
+{
+    struct change_feed *feed = sub->feed;
+    struct timespec deadline;
+    size_t taken = 0;
+
+    deadline_in(&deadline, timeout_ms);
+    pthread_mutex_lock(&feed->lock);
+    while (sub->count == 0 && !feed->closed && !sub->slow &&
+           pthread_cond_timedwait(&sub->ready, &feed->lock, &deadline) == 0)
+    {
+    }
+    if (sub->slow)
+    {
+        pthread_mutex_unlock(&feed->lock);
+        return CHANGE_FEED_SLOW;
+    }
+    if (feed->closed)
+    {
+        pthread_mutex_unlock(&feed->lock);
+        return CHANGE_FEED_CLOSED;
+    }
+    while (taken < max && sub->count)
+    {
+        out[taken++] = sub->queue[sub->head];
+        sub->head = (sub->head + 1) % CHANGE_FEED_BUFFER;
+        sub->count--;
+    }
+    *dropped = sub->dropped;
+    sub->dropped = 0;
+    pthread_mutex_unlock(&feed->lock);
+
+    return (int)taken;
+}
+
+int change_feed_since(struct change_feed *feed, uint64_t since,
+                      struct change **out, size_t max, uint64_t *seq)
+{
+    size_t newer;
+    size_t taken;
+    size_t at;
+
+    pthread_mutex_lock(&feed->lock);
+    if (since < feed->log_start || since > feed->seq)
+    {
+        *seq = feed->seq;
+        pthread_mutex_unlock(&feed->lock);
+        return CHANGE_FEED_GONE;
+    }
+
+    // numbers in the log run without gaps, so since picks the start directly
+    newer = (size_t)(feed->seq - since);
+    at = feed->log_head + feed->log_count - newer;
+    for (taken = 0; taken < newer && taken < max; taken++)
+    {
+        out[taken] = feed->log[(at + taken) % CHANGE_FEED_LOG];
+        atomic_fetch_add_explicit(&out[taken]->refs, 1, memory_order_relaxed);
+    }
+    *seq = since + taken;
+    pthread_mutex_unlock(&feed->lock);
+
+    return (int)taken;
+}
+
+uint64_t change_feed_seq(struct change_feed *feed)
+{
+    uint64_t seq;
+
+    pthread_mutex_lock(&feed->lock);
+    seq = feed->seq;
+    pthread_mutex_unlock(&feed->lock);
+
+    return seq;
+}
+
+void change_release(struct change *change)
+{
+    if (atomic_fetch_sub_explicit(&change->refs, 1, memory_order_acq_rel) == 1)
+    {
+        free(change);
+    }
+}
+
+long change_major(const char *value, size_t len)
+{
+    const char *end = value + len;
+    const char *at;
+    long major;
+
+    for (at = value; at + 6 < end; at++)
+    {
+        // major= at the start of the value or of one of its fields
+        if (memcmp(at, "major=", 6) == 0 &&
+            (at == value || at[-1] == '&' || at[-1] == ' ' || at[-1] == ';' ||
+             at[-1] == ','))
+        {
+            at += 6;
+            if (*at < '0' || *at > '9')
+            {
+                return -1;
+            }
+            for (major = 0; at < end && *at >= '0' && *at <= '9' && major < 65536;
+                 at++)
+            {
+                major = major * 10 + (*at - '0');
+            }
+            return major;
+        }
+    }
+
+    return -1;
+}
+
+static bool matches(const struct change_subscriber *sub,
+                    const struct change *change)
+{
+    return (sub->prefix_len == 0 ||
+            (change->key_len >= sub->prefix_len &&
+             memcmp(change->key, sub->prefix, sub->prefix_len) == 0)) &&
+           (sub->major < 0 ||
+            change_major(change->value, change->value_len) == sub->major);
+}
+
+static void deadline_in(struct timespec *ts, int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * @brief Appends change to the log, which takes over the caller's reference
+ * and lets go of the oldest change once full. Called with the lock held.
+ *
+ * @param feed
+ * @param change
+ */
+static void log_change(struct change_feed *feed, struct change *change)
+{
+    struct change *oldest;
+
+    if (feed->log_count == CHANGE_FEED_LOG)
+    {
+        oldest = feed->log[feed->log_head];
+        feed->log_start = oldest->seq;
+        change_release(oldest);
+        feed->log_head = (feed->log_head + 1) % CHANGE_FEED_LOG;
+        feed->log_count--;
+    }
+    feed->log[(feed->log_head + feed->log_count) % CHANGE_FEED_LOG] = change;
+    feed->log_count++;
+}
+
+/**
+ * @brief Empties the log, whatever came before seq is gone. Called with the
+ * lock held.
+ *
+ * @param feed
+ */
+static void log_clear(struct change_feed *feed)
+{
+    while (feed->log_count)
+    {
+        change_release(feed->log[feed->log_head]);
+        feed->log_head = (feed->log_head + 1) % CHANGE_FEED_LOG;
+        feed->log_count--;
+    }
+    feed->log_start = feed->seq;
+}
@@ -1,5 +1,7 @@
 #include "common.h"
+#include "fsm_trace.h"
 #include "http_.h"
+#include "http_scan.h"
 #include <dc_application/command_line.h>
 #include <dc_application/config.h>
 #include <dc_application/defaults.h>
@@ -28,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <netinet/in.h>
 
@@ -76,6 +79,7 @@ static void bad_change_state(const struct dc_posix_env *env,
                              int                        from_state_id,
                              int                        to_state_id);
 static void quit_handler(int sig_num);
+static uint64_t now_ns(void);
 
 /**
  * @brief Reads an HTTP response from int file descriptor into destination
@@ -212,6 +216,31 @@ enum application_states
  */
 static volatile sig_atomic_t exit_flag;
 
+/**
+ * @brief When the current FSM state was entered, for tracing
+ *
+ */
+static uint64_t state_started_ns;
+
+/**
+ * @brief Names of the client FSM states for trace dumps
+ *
+ */
+static const char *const state_names[] = {
+    [DC_FSM_INIT] = "INIT",
+    [DC_FSM_EXIT] = "EXIT",
+    [SETUP_WINDOW] = "SETUP_WINDOW",
+    [SETUP] = "SETUP",
+    [AWAIT_INPUT] = "AWAIT_INPUT",
+    [GET_ALL] = "GET_ALL",
+    [BY_KEY] = "BY_KEY",
+    [AWAIT_RESPONSE] = "AWAIT_RESPONSE",
+    [PARSE_RESPONSE] = "PARSE_RESPONSE",
+    [DISPLAY_RESPONSE] = "DISPLAY_RESPONSE",
+    [CLOSE] = "CLOSE",
+    [QUIT] = "QUIT",
+};
+
 int                          main(void)
 {
     dc_error_reporter               reporter;
@@ -219,6 +248,7 @@ int                          main(void)
     struct dc_error                 err;
     struct dc_posix_env             env;
     int                             ret_val;
+    const char                     *trace_path;
 
     struct dc_fsm_info             *fsm_info;
     static struct dc_fsm_transition transitions[] = {{DC_FSM_INIT, SETUP_WINDOW, setup_window},
@@ -244,8 +274,14 @@ int                          main(void)
 
     // FSM setup
     fsm_info = dc_fsm_info_create(&env, &err, "iBeaconClient");
-    // dc_fsm_info_set_will_change_state(fsm_info, will_change_state);
-    // dc_fsm_info_set_did_change_state(fsm_info, did_change_state);
+    // IBEACON_TRACE=<file> records every transition and dumps them on exit
+    trace_path = getenv("IBEACON_TRACE");
+    if(trace_path)
+    {
+        fsm_trace_enable(state_names, sizeof(state_names) / sizeof(state_names[0]));
+        dc_fsm_info_set_will_change_state(fsm_info, will_change_state);
+        dc_fsm_info_set_did_change_state(fsm_info, did_change_state);
+    }
     // dc_fsm_info_set_bad_change_state(fsm_info, bad_change_state);
 
     if(dc_error_has_no_error(&err))
@@ -266,6 +302,17 @@ int                          main(void)
         free(client);
     }
 
+    if(trace_path)
+    {
+        int trace_fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if(trace_fd >= 0)
+        {
+            fsm_trace_dump(trace_fd);
+            close(trace_fd);
+        }
+    }
+
     return ret_val;
 }
 
@@ -569,7 +616,7 @@ int receive_data(const struct dc_posix_env *env, struct dc_error *err, int fd, c
     ssize_t        count;
     ssize_t        totalWritten          = 0;
     const char    *endOfHeadersDelimiter = "\r\n\r\n";
-    char          *endOfHeaders;
+    const char    *endOfHeaders;
     ssize_t        spaceInDest;
     int            totalLength       = MAX_REQUEST_SIZE;
     int            headerLength;
@@ -588,7 +635,7 @@ int receive_data(const struct dc_posix_env *env, struct dc_error *err, int fd, c
 
         if(!foundEndOfHeaders)
         {
-            endOfHeaders = strstr(dest, endOfHeadersDelimiter);
+            endOfHeaders = http_scan_end_of_headers(dest, (size_t)totalWritten);
             if(endOfHeaders)
             {
                 foundEndOfHeaders = true;
@@ -624,13 +671,21 @@ trace_reporter(const struct dc_posix_env *env, const char *file_name, const char
     fprintf(stderr, "Entering: %s : %s @ %zu %d\n", file_name, function_name, line_number, env->null_free);
 }
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
 static void will_change_state(const struct dc_posix_env *env,
                               struct dc_error           *err,
                               const struct dc_fsm_info  *info,
                               int                        from_state_id,
                               int                        to_state_id)
 {
-    printf("%s: will change %d -> %d\n", dc_fsm_info_get_name(info), from_state_id, to_state_id);
+    state_started_ns = now_ns();
 }
 
 static void did_change_state(const struct dc_posix_env *env,
@@ -640,7 +695,7 @@ static void did_change_state(const struct dc_posix_env *env,
                              int                        to_state_id,
                              int                        next_id)
 {
-    printf("%s: did change %d -> %d moving to %d\n", dc_fsm_info_get_name(info), from_state_id, to_state_id, next_id);
+    fsm_trace_record(from_state_id, to_state_id, state_started_ns, now_ns());
 }
 
 static void bad_change_state(const struct dc_posix_env *env,
@@ -1,35 +1,160 @@
+// copy_file_range(2) is a GNU extension
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 
+#include "buffer_pool.h"
 #include "dbstuff.h"
+#include "metrics.h"
 #include <dc_posix/dc_fcntl.h>
 #include <dc_posix/dc_ndbm.h>
 #include <dc_posix/dc_posix_env.h>
 #include <dc_posix/dc_stdlib.h>
 #include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+/**
+ * @brief Slots keys hash into for their versions
+ *
+ */
+#define VERSION_SLOTS 4096
+
+/**
+ * @brief Version of the whole db, and the version each slot last saw a store
+ * at. Only this process writes the db, so the counters can live in memory;
+ * the epoch keeps tags handed out before a restart from matching.
+ *
+ */
+static atomic_uint_fast64_t db_version = 0;
+static atomic_uint_fast64_t slot_versions[VERSION_SLOTS];
+static atomic_uint_fast64_t epoch = 0;
+/**
+ * @brief Files a db is kept in: ndbm has a .pag and a .dir, Berkeley DB's
+ * ndbm one .db
+ *
+ */
+static const char *db_suffixes[] = {".pag", ".dir", ".db"};
+#define DB_FILES (sizeof(db_suffixes) / sizeof(db_suffixes[0]))
+/**
+ * @brief Bytes a warm-up reader takes at a time
+ *
+ */
+#define WARM_CHUNK (1024 * 1024)
+/**
+ * @brief Most of a missing key db_fetch echoes, leaving room for " : Not found"
+ *
+ */
+#define MISS_KEY_MAX ((int)(BUFFER_SMALL_SIZE - sizeof(" : Not found")))
+
+/**
+ * @brief A store db_hold keeps off the files: the latest value of a key,
+ * key\0value\0 in one allocation
+ *
+ */
+struct held
+{
+    char *key;
+    size_t key_len;
+    char *value;
+};
+/**
+ * @brief Stores held off the files of the db at held_location, open
+ * addressed by key. Changed only by db_store, db_hold and db_release, which
+ * the caller keeps readers out of, so readers need no lock of their own.
+ *
+ */
+static bool holding = false;
+static char held_location[PATH_MAX];
+static struct held *held = NULL;
+static size_t held_cap = 0;
+static size_t held_count = 0;
+
+/**
+ * @brief The db's files cut into chunks, which warm-up readers take the next
+ * of until none are left
+ *
+ */
+struct warm
+{
+    int fds[DB_FILES];
+    uint64_t chunks[DB_FILES];
+    atomic_uint_fast64_t next;
+    atomic_uint_fast64_t bytes;
+};
+
+static uint32_t key_hash(const char *key, size_t key_len);
+static size_t version_slot(const char *key_str);
+static bool is_held(const char *dbLocation);
+static struct held *held_find(const char *key, size_t key_len);
+static bool hold_store(const char *key_str, const char *val_str);
+static uint64_t version_epoch(void);
+static bool copy_file(const char *from, const char *to, bool clone_only);
+static void *warm_reader(void *arg);
 
 void db_store(const struct dc_posix_env *env, struct dc_error *err, const char *key_str, const char *val_str, const char *dbLocation)
 {
     DBM *db;
     datum key = {key_str, dc_strlen(env, key_str)};
     datum val = {val_str, dc_strlen(env, val_str)};
+    uint64_t start = metrics_now_ns();
 
-    if(dc_error_has_no_error(err))
+    if (dc_error_has_no_error(err) && is_held(dbLocation))
+    {
+        if (!hold_store(key_str, val_str))
+        {
+            DC_ERROR_RAISE_USER(err, "Out of memory", -1);
+        }
+    }
+    else if(dc_error_has_no_error(err))
     {
         db = dc_dbm_open(env, err, dbLocation, DC_O_RDWR | DC_O_CREAT, DC_S_IRUSR | DC_S_IWUSR | DC_S_IWGRP | DC_S_IRGRP | DC_S_IROTH | DC_S_IWOTH); 
         dc_dbm_store(env, err, db, key, val, 1);
         dc_dbm_close(env, err, db);
     }
- 
+    // bumped once the value is in, a reader that tags before fetching can
+    // pair an old tag with a new value but never the other way round
+    if (dc_error_has_no_error(err))
+    {
+        atomic_store(&slot_versions[version_slot(key_str)],
+                     atomic_fetch_add(&db_version, 1) + 1);
+    }
+    metrics_db_op(METRICS_DB_STORE, metrics_now_ns() - start);
 }
 
 void db_fetch(const struct dc_posix_env *env, struct dc_error *err, const char *key_str, const char *val_str, const char *dbLocation)
 {
     DBM *db;
-    char *return_str = (char *)calloc(1024, sizeof(char));
+    char *return_str = (char *)buffer_pool_get(BUFFER_SMALL_SIZE);
+    const struct held *hit = NULL;
+    uint64_t start = metrics_now_ns();
 
-    if(dc_error_has_no_error(err))
+    if (return_str == NULL)
+    {
+        DC_ERROR_RAISE_USER(err, "Out of memory", -1);
+    }
+    if (dc_error_has_no_error(err) && is_held(dbLocation))
+    {
+        hit = held_find(key_str, strlen(key_str));
+        hit = hit != NULL && hit->key != NULL ? hit : NULL;
+    }
+    if(dc_error_has_no_error(err) && hit == NULL)
     {
         db = dc_dbm_open(env, err, dbLocation, DC_O_RDWR | DC_O_CREAT, DC_S_IRUSR | DC_S_IWUSR | DC_S_IWGRP | DC_S_IRGRP | DC_S_IROTH | DC_S_IWOTH); 
     }
@@ -37,49 +162,552 @@ void db_fetch(const struct dc_posix_env *env, struct dc_error *err, const char *
     datum key = {key_str, dc_strlen(env, key_str)};
     if(dc_error_has_no_error(err))
     {
-        val = dc_dbm_fetch(env, err, db, key);
-        strncat(return_str, key.dptr, key.dsize);
-        strcat(return_str, " : ");
-        
+        // held stores are newer than anything in the files
+        if (hit != NULL) {
+            val.dptr = hit->value;
+            val.dsize = (int)strlen(hit->value);
+        }
+        else {
+            val = dc_dbm_fetch(env, err, db, key);
+        }
+        // bounded, a pair stored before PUTs were limited may not fit, but
+        // a miss always keeps its "Not found"
         if (val.dsize == 0) {
-            strcat(return_str, "Not found");
-            dc_strcpy(env, val_str, return_str);
-        } 
+            snprintf(return_str, BUFFER_SMALL_SIZE, "%.*s : Not found",
+                     key.dsize < MISS_KEY_MAX ? (int)key.dsize : MISS_KEY_MAX,
+                     (const char *)key.dptr);
+        }
         else {
-            strncat(return_str, val.dptr, val.dsize);
-            dc_strcpy(env, val_str, return_str);
+            snprintf(return_str, BUFFER_SMALL_SIZE, "%.*s : %.*s",
+                     (int)key.dsize, (const char *)key.dptr,
+                     (int)val.dsize, (const char *)val.dptr);
         }
+        dc_strcpy(env, val_str, return_str);
     }
 
-    if(dc_error_has_no_error(err))
+    if(dc_error_has_no_error(err) && hit == NULL)
     {
         dc_dbm_close(env, err, db);
     }
 
-    free(return_str);
+    buffer_pool_put(return_str);
+    metrics_db_op(METRICS_DB_FETCH, metrics_now_ns() - start);
 }
 
-void db_fetch_all(const struct dc_posix_env *env, struct dc_error *err, const char *val_str, const char *dbLocation) {
+void db_fetch_all(const struct dc_posix_env *env, struct dc_error *err,
+                  db_visitor visit, void *arg, const char *dbLocation)
+{
     DBM *db;
     datum key;
     datum val;
-    char *return_str = (char *)calloc(1024, sizeof(char));
+    const struct held *hit;
+    bool held_too = is_held(dbLocation);
+    size_t i;
+    uint64_t start = metrics_now_ns();
 
     if (dc_error_has_no_error(err)) {
         db = dc_dbm_open(env, err, dbLocation, DC_O_RDWR | DC_O_CREAT, DC_S_IRUSR | DC_S_IWUSR | DC_S_IWGRP | DC_S_IRGRP | DC_S_IROTH | DC_S_IWOTH); 
         for (key = dc_dbm_firstkey(env, err, db); key.dptr != NULL; key = dc_dbm_nextkey(env, err, db) ) {
+            // a held key is walked once, with its held value, below
+            hit = held_too ? held_find(key.dptr, (size_t)key.dsize) : NULL;
+            if (hit != NULL && hit->key != NULL) {
+                continue;
+            }
             val = dc_dbm_fetch(env, err, db, key);
-            strncat(return_str, key.dptr, key.dsize);
-            strcat(return_str, " : ");
-            strncat(return_str, val.dptr, val.dsize);
-            strcat(return_str, "\n");
+            if (!visit(arg, key.dptr, (size_t)key.dsize, val.dptr, (size_t)val.dsize)) {
+                held_too = false;
+                break;
+            }
         }
     }
 
     if(dc_error_has_no_error(err)) {
         dc_dbm_close(env, err, db);
     }
-    
-    dc_strcpy(env, val_str, return_str);
-    free(return_str);
+    for (i = 0; held_too && dc_error_has_no_error(err) && i < held_cap; i++) {
+        if (held[i].key != NULL &&
+            !visit(arg, held[i].key, held[i].key_len, held[i].value,
+                   strlen(held[i].value))) {
+            break;
+        }
+    }
+
+    metrics_db_op(METRICS_DB_FETCH_ALL, metrics_now_ns() - start);
+}
+
+bool db_sync(const char *dbLocation)
+{
+    char path[PATH_MAX];
+    size_t i;
+    int fd;
+    bool synced = false;
+
+    for (i = 0; i < sizeof(db_suffixes) / sizeof(db_suffixes[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", dbLocation, db_suffixes[i]);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (fsync(fd) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        close(fd);
+        synced = true;
+    }
+
+    return synced;
+}
+
+bool db_hold(const char *dbLocation)
+{
+    if ((size_t)snprintf(held_location, sizeof(held_location), "%s",
+                         dbLocation) >= sizeof(held_location))
+    {
+        return false;
+    }
+    holding = true;
+
+    return true;
+}
+
+void db_release(const struct dc_posix_env *env, struct dc_error *err,
+                const char *dbLocation)
+{
+    DBM *db;
+    datum key;
+    datum val;
+    size_t i;
+
+    if (!is_held(dbLocation))
+    {
+        return;
+    }
+    holding = false;
+    if (held_count > 0 && dc_error_has_no_error(err))
+    {
+        // one open for them all, their versions moved when they were held
+        db = dc_dbm_open(env, err, dbLocation, DC_O_RDWR | DC_O_CREAT, DC_S_IRUSR | DC_S_IWUSR | DC_S_IWGRP | DC_S_IRGRP | DC_S_IROTH | DC_S_IWOTH);
+        for (i = 0; i < held_cap && dc_error_has_no_error(err); i++)
+        {
+            if (held[i].key != NULL)
+            {
+                key.dptr = held[i].key;
+                key.dsize = (int)held[i].key_len;
+                val.dptr = held[i].value;
+                val.dsize = (int)strlen(held[i].value);
+                dc_dbm_store(env, err, db, key, val, 1);
+            }
+        }
+        if (dc_error_has_no_error(err))
+        {
+            dc_dbm_close(env, err, db);
+        }
+    }
+
+    for (i = 0; i < held_cap; i++)
+    {
+        free(held[i].key);
+    }
+    free(held);
+    held = NULL;
+    held_cap = 0;
+    held_count = 0;
+}
+
+bool db_copy(const char *from, const char *to, bool clone_only)
+{
+    char fromPath[PATH_MAX];
+    char toPath[PATH_MAX];
+    size_t i;
+    bool copied = false;
+
+    for (i = 0; i < sizeof(db_suffixes) / sizeof(db_suffixes[0]); i++)
+    {
+        snprintf(fromPath, sizeof(fromPath), "%s%s", from, db_suffixes[i]);
+        snprintf(toPath, sizeof(toPath), "%s%s", to, db_suffixes[i]);
+        if (access(fromPath, F_OK) != 0)
+        {
+            continue;
+        }
+        if (!copy_file(fromPath, toPath, clone_only))
+        {
+            return false;
+        }
+        copied = true;
+    }
+
+    return copied;
+}
+
+bool db_exists(const char *dbLocation)
+{
+    char path[PATH_MAX];
+    size_t i;
+
+    for (i = 0; i < DB_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", dbLocation, db_suffixes[i]);
+        if (access(path, F_OK) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool db_rename(const char *from, const char *to)
+{
+    char fromPath[PATH_MAX];
+    char toPath[PATH_MAX];
+    size_t i;
+    bool renamed = false;
+
+    for (i = 0; i < sizeof(db_suffixes) / sizeof(db_suffixes[0]); i++)
+    {
+        snprintf(fromPath, sizeof(fromPath), "%s%s", from, db_suffixes[i]);
+        snprintf(toPath, sizeof(toPath), "%s%s", to, db_suffixes[i]);
+        if (access(fromPath, F_OK) != 0)
+        {
+            continue;
+        }
+        if (rename(fromPath, toPath) != 0)
+        {
+            return false;
+        }
+        renamed = true;
+    }
+
+    return renamed;
+}
+
+uint64_t db_warm(const char *dbLocation, unsigned threads)
+{
+    char path[PATH_MAX];
+    pthread_t readers[DB_WARM_MAX_THREADS];
+    struct warm warm;
+    struct stat st;
+    sigset_t all;
+    sigset_t old;
+    uint64_t total = 0;
+    unsigned started = 0;
+    size_t i;
+
+    memset(&warm, 0, sizeof(warm));
+    atomic_init(&warm.next, 0);
+    atomic_init(&warm.bytes, 0);
+    for (i = 0; i < DB_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", dbLocation, db_suffixes[i]);
+        warm.fds[i] = open(path, O_RDONLY);
+        if (warm.fds[i] >= 0 && fstat(warm.fds[i], &st) == 0)
+        {
+            warm.chunks[i] = ((uint64_t)st.st_size + WARM_CHUNK - 1) / WARM_CHUNK;
+            total += warm.chunks[i];
+        }
+    }
+
+    // the calling thread reads too, the rest only while there is work for
+    // them; their signals stay with the thread that acts on them
+    if (threads > DB_WARM_MAX_THREADS)
+    {
+        threads = DB_WARM_MAX_THREADS;
+    }
+    if (threads > total)
+    {
+        threads = (unsigned)total;
+    }
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (started + 1 < threads &&
+           pthread_create(&readers[started], NULL, warm_reader, &warm) == 0)
+    {
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    warm_reader(&warm);
+    while (started > 0)
+    {
+        pthread_join(readers[--started], NULL);
+    }
+
+    for (i = 0; i < DB_FILES; i++)
+    {
+        if (warm.fds[i] >= 0)
+        {
+            close(warm.fds[i]);
+        }
+    }
+
+    return atomic_load(&warm.bytes);
+}
+
+void db_etag(const char *key_str, char *etag)
+{
+    uint64_t version = key_str ? atomic_load(&slot_versions[version_slot(key_str)])
+                               : atomic_load(&db_version);
+
+    snprintf(etag, DB_ETAG_SIZE, "\"%" PRIx64 "-%" PRIx64 "\"",
+             version_epoch(), version);
+}
+
+static uint32_t key_hash(const char *key, size_t key_len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < key_len; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+
+    return hash ^ (hash >> 15);
+}
+
+static size_t version_slot(const char *key_str)
+{
+    return key_hash(key_str, strlen(key_str)) % VERSION_SLOTS;
+}
+
+static bool is_held(const char *dbLocation)
+{
+    return holding && strcmp(dbLocation, held_location) == 0;
+}
+
+/**
+ * @brief Finds a held key
+ *
+ * @param key
+ * @param key_len
+ * @return its entry, the empty one it would go in if it is not held, or NULL
+ * if nothing is
+ */
+static struct held *held_find(const char *key, size_t key_len)
+{
+    size_t i;
+
+    if (held_cap == 0)
+    {
+        return NULL;
+    }
+    for (i = key_hash(key, key_len) & (held_cap - 1);
+         held[i].key != NULL &&
+         (held[i].key_len != key_len || memcmp(held[i].key, key, key_len) != 0);
+         i = (i + 1) & (held_cap - 1))
+    {
+    }
+
+    return &held[i];
+}
+
+/**
+ * @brief Holds a store, replacing what was held for its key, the table kept
+ * at most half full
+ *
+ * @param key_str
+ * @param val_str
+ * @return false if out of memory
+ */
+static bool hold_store(const char *key_str, const char *val_str)
+{
+    size_t key_len = strlen(key_str);
+    size_t val_len = strlen(val_str);
+    struct held *old = held;
+    size_t old_cap = held_cap;
+    struct held *slot;
+    char *pair;
+    size_t i;
+
+    if (2 * (held_count + 1) > held_cap)
+    {
+        held_cap = held_cap ? 2 * held_cap : 256;
+        held = calloc(held_cap, sizeof(struct held));
+        if (held == NULL)
+        {
+            held = old;
+            held_cap = old_cap;
+            return false;
+        }
+        for (i = 0; i < old_cap; i++)
+        {
+            if (old[i].key != NULL)
+            {
+                *held_find(old[i].key, old[i].key_len) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    pair = malloc(key_len + val_len + 2);
+    if (pair == NULL)
+    {
+        return false;
+    }
+    memcpy(pair, key_str, key_len + 1);
+    memcpy(pair + key_len + 1, val_str, val_len + 1);
+    slot = held_find(key_str, key_len);
+    if (slot->key == NULL)
+    {
+        held_count++;
+    }
+    free(slot->key);
+    slot->key = pair;
+    slot->key_len = key_len;
+    slot->value = pair + key_len + 1;
+
+    return true;
+}
+
+static uint64_t version_epoch(void)
+{
+    uint_fast64_t current = atomic_load(&epoch);
+    uint_fast64_t fresh;
+
+    if (current == 0)
+    {
+        fresh = (((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid()) | 1;
+        // whoever gets here first picks it, current then holds the winner
+        if (atomic_compare_exchange_strong(&epoch, &current, fresh))
+        {
+            current = fresh;
+        }
+    }
+
+    return current;
+}
+
+/**
+ * @brief Clones a file where the filesystem has reflinks, otherwise copies it
+ * in the kernel where it can
+ *
+ * @param from
+ * @param to created or truncated
+ * @param clone_only fail rather than copy when it cannot be cloned
+ * @return false if it could not be copied whole, with errno EOPNOTSUPP if it
+ * only could not be cloned
+ */
+static bool copy_file(const char *from, const char *to, bool clone_only)
+{
+    char buf[65536];
+    ssize_t got = -1;
+    ssize_t put;
+    size_t off;
+    int in;
+    int out;
+
+    in = open(from, O_RDONLY);
+    if (in < 0)
+    {
+        return false;
+    }
+    out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+
+#ifdef FICLONE
+    // shares every block with from on filesystems with reflinks, XFS or
+    // btrfs, in the same time whatever the size
+    if (ioctl(out, FICLONE, in) == 0)
+    {
+        close(in);
+        return close(out) == 0;
+    }
+#endif
+    if (clone_only)
+    {
+        close(in);
+        close(out);
+        errno = EOPNOTSUPP;
+        return false;
+    }
+
+#ifdef __linux__
+    do
+    {
+        got = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+    } while (got > 0 || (got < 0 && errno == EINTR));
+    // older kernels and some filesystem pairs refuse, copy by hand from
+    // wherever it stopped
+#endif
+    while (got != 0)
+    {
+        got = read(in, buf, sizeof(buf));
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        for (off = 0; got > 0 && off < (size_t)got; off += (size_t)put)
+        {
+            put = write(out, buf + off, (size_t)got - off);
+            if (put < 0 && errno == EINTR)
+            {
+                put = 0;
+            }
+            else if (put <= 0)
+            {
+                got = -1;
+            }
+        }
+        if (got < 0)
+        {
+            break;
+        }
+    }
+    close(in);
+
+    return close(out) == 0 && got == 0;
+}
+
+/**
+ * @brief Reads chunks of the db into the page cache until none are left,
+ * the thread body of db_warm
+ *
+ * @param arg struct warm
+ * @return NULL
+ */
+static void *warm_reader(void *arg)
+{
+    struct warm *warm = (struct warm *)arg;
+    uint64_t chunk;
+    ssize_t got;
+    size_t i;
+    char *buf;
+
+    buf = malloc(WARM_CHUNK);
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+    for (;;)
+    {
+        chunk = atomic_fetch_add(&warm->next, 1);
+        for (i = 0; i < DB_FILES && chunk >= warm->chunks[i]; i++)
+        {
+            chunk -= warm->chunks[i];
+        }
+        if (i == DB_FILES)
+        {
+            break;
+        }
+        do
+        {
+            got = pread(warm->fds[i], buf, WARM_CHUNK,
+                        (off_t)(chunk * WARM_CHUNK));
+        } while (got < 0 && errno == EINTR);
+        if (got > 0)
+        {
+            atomic_fetch_add(&warm->bytes, (uint64_t)got);
+        }
+    }
+    free(buf);
+
+    return NULL;
 }
@@ -0,0 +1,559 @@
+#include "follow.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * @brief Largest response head taken
+ *
+ */
+#define HEAD_MAX 8192
+/**
+ * @brief Body bytes read at a time, room for the largest record twice over
+ *
+ */
+#define IN_SIZE (4 * (INGEST_RECORD_HEADER_SIZE + 2 * UINT16_MAX))
+/**
+ * @brief Unpacked records of a batch
+ *
+ */
+#define SCRATCH_SIZE (4 * (2 * UINT16_MAX + 2))
+
+struct follower
+{
+    const struct dc_posix_env *env;
+    char host[256];
+    char port[16];
+    int poll_ms;
+    ingest_store store;
+    const void *arg;
+    pthread_t thread;
+    int wake[2];
+    atomic_uint_fast64_t seq;
+    uint8_t *in;
+    size_t in_len;
+    struct ingest_record records[INGEST_BATCH];
+    size_t pending;
+    char *scratch;
+    size_t scratch_len;
+    uint64_t applied;
+};
+
+/**
+ * @brief What the head of a changes response said
+ *
+ */
+struct response
+{
+    int status;
+    size_t content_length;
+    uint64_t seq;
+    bool has_length;
+    bool has_seq;
+};
+
+static void *tail(void *arg);
+static int sync_once(struct follower *follower, uint64_t since,
+                     uint64_t *next);
+static bool read_head(struct follower *follower, int fd,
+                      struct response *response);
+static bool read_body(struct follower *follower, int fd, size_t len);
+static bool apply(struct follower *follower, struct dc_error *err,
+                  size_t *used);
+static bool batch_flush(struct follower *follower, struct dc_error *err);
+static bool parse_primary(struct follower *follower, const char *primary);
+static int connect_primary(const struct follower *follower);
+static bool wait_readable(const struct follower *follower, int fd);
+static bool stopped(const struct follower *follower, int ms);
+static bool send_all(int fd, const char *data, size_t len);
+static size_t get16(const uint8_t *at);
+
+struct follower *follow_start(const struct dc_posix_env *env,
+                              const char *primary, int poll_ms,
+                              ingest_store store, const void *arg)
+{
+    struct follower *follower;
+    sigset_t all;
+    sigset_t old;
+    int rc;
+
+    follower = calloc(1, sizeof(struct follower));
+    if (follower == NULL)
+    {
+        return NULL;
+    }
+    follower->in = malloc(IN_SIZE);
+    follower->scratch = malloc(SCRATCH_SIZE);
+    if (follower->in == NULL || follower->scratch == NULL ||
+        !parse_primary(follower, primary) || pipe(follower->wake) != 0)
+    {
+        free(follower->scratch);
+        free(follower->in);
+        free(follower);
+        return NULL;
+    }
+    follower->env = env;
+    follower->poll_ms = poll_ms > 0 ? poll_ms : 1;
+    follower->store = store;
+    follower->arg = arg;
+    atomic_init(&follower->seq, 0);
+
+    // signals stay with the serving threads, which act on them
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&follower->thread, NULL, tail, follower);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        close(follower->wake[0]);
+        close(follower->wake[1]);
+        free(follower->scratch);
+        free(follower->in);
+        free(follower);
+        return NULL;
+    }
+
+    return follower;
+}
+
+uint64_t follow_seq(const struct follower *follower)
+{
+    return atomic_load(&follower->seq);
+}
+
+void follow_stop(struct follower **pfollower)
+{
+    struct follower *follower = *pfollower;
+
+    if (follower == NULL)
+    {
+        return;
+    }
+
+    if (write(follower->wake[1], "", 1) == 1)
+    {
+        pthread_join(follower->thread, NULL);
+    }
+    close(follower->wake[0]);
+    close(follower->wake[1]);
+    free(follower->scratch);
+    free(follower->in);
+    free(follower);
+    *pfollower = NULL;
+}
+
+static void *tail(void *arg)
+{
+    struct follower *follower = (struct follower *)arg;
+    uint64_t since = 0;
+    uint64_t next;
+    int applied;
+
+    for (;;)
+    {
+        applied = sync_once(follower, since, &next);
+        if (applied >= 0)
+        {
+            since = next;
+            atomic_store(&follower->seq, since);
+        }
+        // straight back for more while behind, else wait for changes (or
+        // for the primary to come back)
+        if (stopped(follower, applied > 0 ? 0 : follower->poll_ms))
+        {
+            break;
+        }
+    }
+    buffer_pool_thread_flush();
+
+    return NULL;
+}
+
+/**
+ * @brief Fetches and applies the changes after since
+ *
+ * @param follower
+ * @param since
+ * @param next set to the sequence number to ask from next time
+ * @return 1 if there were changes, 0 if none, -1 if the primary could not be
+ * reached or the changes not all applied
+ */
+static int sync_once(struct follower *follower, uint64_t since,
+                     uint64_t *next)
+{
+    struct response response;
+    char request[512];
+    int len;
+    int fd;
+    bool ok;
+
+    fd = connect_primary(follower);
+    if (fd < 0)
+    {
+        metrics_ingest(METRICS_INGEST_FOLLOW, 0, 1);
+        return -1;
+    }
+
+    len = snprintf(request, sizeof(request),
+                   "GET /ibeacons/changes?since=%" PRIu64
+                   "&format=binary HTTP/1.0\r\nHost: %s\r\n\r\n",
+                   since, follower->host);
+    ok = send_all(fd, request, (size_t)len) &&
+         read_head(follower, fd, &response) && response.status == 200 &&
+         response.has_length && response.has_seq &&
+         read_body(follower, fd, response.content_length);
+    close(fd);
+
+    metrics_ingest(METRICS_INGEST_FOLLOW, follower->applied, ok ? 0 : 1);
+    follower->applied = 0;
+    if (!ok)
+    {
+        return -1;
+    }
+    *next = response.seq;
+
+    return response.content_length > 0;
+}
+
+/**
+ * @brief Reads the status line and headers, leaving any body bytes that came
+ * with them in the follower's input
+ *
+ * @param follower
+ * @param fd
+ * @param response
+ * @return false if the head was cut short, too big or unreadable
+ */
+static bool read_head(struct follower *follower, int fd,
+                      struct response *response)
+{
+    char head[HEAD_MAX + 1];
+    size_t len = 0;
+    ssize_t got;
+    char *end = NULL;
+    char *line;
+    char *eol;
+
+    memset(response, 0, sizeof(struct response));
+    while (end == NULL)
+    {
+        if (len == HEAD_MAX || !wait_readable(follower, fd))
+        {
+            return false;
+        }
+        got = recv(fd, head + len, HEAD_MAX - len, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        len += (size_t)got;
+        head[len] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+
+    // the body's first bytes
+    end += 4;
+    follower->in_len = len - (size_t)(end - head);
+    memcpy(follower->in, end, follower->in_len);
+    end[-2] = '\0';
+
+    if (sscanf(head, "HTTP/1.%*d %d", &response->status) != 1)
+    {
+        return false;
+    }
+    for (line = strstr(head, "\r\n"); line; line = eol)
+    {
+        line += 2;
+        eol = strstr(line, "\r\n");
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            response->content_length = strtoul(line + 15, NULL, 10);
+            response->has_length = true;
+        }
+        else if (strncasecmp(line, "X-Change-Seq:", 13) == 0)
+        {
+            response->seq = strtoull(line + 13, NULL, 10);
+            response->has_seq = true;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Applies a body of len bytes as it arrives, never holding more than a
+ * read's worth
+ *
+ * @param follower
+ * @param fd
+ * @param len
+ * @return false if the body was cut short, malformed or not all stored
+ */
+static bool read_body(struct follower *follower, int fd, size_t len)
+{
+    struct dc_error err;
+    size_t left;
+    size_t used;
+    ssize_t got;
+    bool ok = follower->in_len <= len;
+
+    dc_error_init(&err, NULL);
+    left = ok ? len - follower->in_len : 0;
+    while (ok)
+    {
+        ok = apply(follower, &err, &used);
+        memmove(follower->in, follower->in + used, follower->in_len - used);
+        follower->in_len -= used;
+        if (!ok || left == 0)
+        {
+            break;
+        }
+
+        ok = wait_readable(follower, fd);
+        if (!ok)
+        {
+            break;
+        }
+        got = recv(fd, follower->in + follower->in_len,
+                   left < IN_SIZE - follower->in_len
+                       ? left
+                       : IN_SIZE - follower->in_len,
+                   0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        ok = got > 0;
+        if (ok)
+        {
+            follower->in_len += (size_t)got;
+            left -= (size_t)got;
+        }
+    }
+
+    // a record left over is one the body cut in half
+    ok = ok && follower->in_len == 0 && batch_flush(follower, &err);
+    follower->pending = 0;
+    follower->scratch_len = 0;
+    dc_error_reset(&err);
+
+    return ok;
+}
+
+/**
+ * @brief Unpacks the whole records in the input into the pending batch,
+ * storing it whenever it fills
+ *
+ * @param follower
+ * @param err
+ * @param used set to the bytes taken
+ * @return false if a record is malformed or a batch not all stored
+ */
+static bool apply(struct follower *follower, struct dc_error *err,
+                  size_t *used)
+{
+    const uint8_t *record;
+    size_t keyLen;
+    size_t valueLen;
+    char *scratch;
+
+    *used = 0;
+    while (follower->in_len - *used >= INGEST_RECORD_HEADER_SIZE)
+    {
+        record = follower->in + *used;
+        keyLen = get16(record);
+        valueLen = get16(record + 2);
+        if (follower->in_len - *used <
+            INGEST_RECORD_HEADER_SIZE + keyLen + valueLen)
+        {
+            break;
+        }
+        record += INGEST_RECORD_HEADER_SIZE;
+        if (memchr(record, '\0', keyLen + valueLen) != NULL)
+        {
+            return false;
+        }
+
+        if ((follower->pending == INGEST_BATCH ||
+             SCRATCH_SIZE - follower->scratch_len < keyLen + valueLen + 2) &&
+            !batch_flush(follower, err))
+        {
+            return false;
+        }
+        scratch = follower->scratch + follower->scratch_len;
+        follower->records[follower->pending].key = scratch;
+        memcpy(scratch, record, keyLen);
+        scratch[keyLen] = '\0';
+        scratch += keyLen + 1;
+        follower->records[follower->pending].value = scratch;
+        memcpy(scratch, record + keyLen, valueLen);
+        scratch[valueLen] = '\0';
+        follower->scratch_len += keyLen + valueLen + 2;
+        follower->pending++;
+        *used += INGEST_RECORD_HEADER_SIZE + keyLen + valueLen;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Stores the pending batch, which is emptied either way
+ *
+ * @param follower
+ * @param err
+ * @return false if not all of it was stored
+ */
+static bool batch_flush(struct follower *follower, struct dc_error *err)
+{
+    size_t pending = follower->pending;
+    size_t stored = 0;
+
+    if (pending && dc_error_has_no_error(err))
+    {
+        stored = follower->store(follower->env, err, follower->arg,
+                                 follower->records, pending);
+        follower->applied += stored;
+    }
+    follower->pending = 0;
+    follower->scratch_len = 0;
+
+    return stored == pending && dc_error_has_no_error(err);
+}
+
+static bool parse_primary(struct follower *follower, const char *primary)
+{
+    const char *colon = strrchr(primary, ':');
+    const char *host = primary;
+    size_t hostLen;
+
+    if (colon == NULL || colon[1] == '\0' ||
+        strlen(colon + 1) >= sizeof(follower->port))
+    {
+        return false;
+    }
+    hostLen = (size_t)(colon - primary);
+    // [::1]:8080
+    if (hostLen >= 2 && host[0] == '[' && host[hostLen - 1] == ']')
+    {
+        host++;
+        hostLen -= 2;
+    }
+    if (hostLen == 0 || hostLen >= sizeof(follower->host))
+    {
+        return false;
+    }
+    memcpy(follower->host, host, hostLen);
+    follower->host[hostLen] = '\0';
+    strcpy(follower->port, colon + 1);
+
+    return true;
+}
+
+static int connect_primary(const struct follower *follower)
+{
+    struct addrinfo hints;
+    struct addrinfo *address;
+    struct addrinfo *at;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(follower->host, follower->port, &hints, &address) != 0)
+    {
+        return -1;
+    }
+    for (at = address; at != NULL && fd < 0; at = at->ai_next)
+    {
+        fd = socket(at->ai_family, at->ai_socktype, at->ai_protocol);
+        if (fd >= 0 && connect(fd, at->ai_addr, at->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(address);
+
+    return fd;
+}
+
+/**
+ * @brief Waits for the primary to send something
+ *
+ * @param follower
+ * @param fd
+ * @return false on a stop, or if the primary stayed quiet FOLLOW_TIMEOUT_MS
+ */
+static bool wait_readable(const struct follower *follower, int fd)
+{
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {follower->wake[0], POLLIN, 0}};
+    int ready;
+
+    do
+    {
+        ready = poll(fds, 2, FOLLOW_TIMEOUT_MS);
+    } while (ready < 0 && errno == EINTR);
+
+    return ready > 0 && fds[1].revents == 0;
+}
+
+/**
+ * @brief Sleeps ms unless stopped first
+ *
+ * @param follower
+ * @param ms
+ * @return true if stopped
+ */
+static bool stopped(const struct follower *follower, int ms)
+{
+    struct pollfd wake = {follower->wake[0], POLLIN, 0};
+
+    return poll(&wake, 1, ms) > 0;
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        len -= (size_t)sent;
+    }
+
+    return true;
+}
+
+static size_t get16(const uint8_t *at)
+{
+    return (size_t)((at[0] << 8) | at[1]);
+}
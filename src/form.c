@@ -0,0 +1,113 @@
+#include "form.h"
+#include <string.h>
+
+static int hex_value(char c);
+
+void form_iter_init(struct form_iter *iter, const char *str, size_t len)
+{
+    iter->pos = str;
+    iter->end = str + len;
+}
+
+bool form_next(struct form_iter *iter, struct form_field *field)
+{
+    const char *start;
+    const char *amp;
+    const char *eq;
+
+    while (iter->pos < iter->end)
+    {
+        start = iter->pos;
+        amp = memchr(start, '&', (size_t)(iter->end - start));
+        if (!amp)
+        {
+            amp = iter->end;
+        }
+        iter->pos = amp < iter->end ? amp + 1 : iter->end;
+
+        if (amp == start)
+        {
+            continue;
+        }
+
+        eq = memchr(start, '=', (size_t)(amp - start));
+        field->name = start;
+        if (eq)
+        {
+            field->name_len = (size_t)(eq - start);
+            field->value = eq + 1;
+            field->value_len = (size_t)(amp - eq - 1);
+        }
+        else
+        {
+            field->name_len = (size_t)(amp - start);
+            field->value = NULL;
+            field->value_len = 0;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool form_name_is(const struct form_field *field, const char *name)
+{
+    return strlen(name) == field->name_len &&
+           memcmp(field->name, name, field->name_len) == 0;
+}
+
+size_t form_decode(const char *src, size_t len, char *dest)
+{
+    size_t in;
+    size_t out;
+    int hi;
+    int lo;
+
+    // common case: nothing to decode
+    if (!memchr(src, '%', len) && !memchr(src, '+', len))
+    {
+        memcpy(dest, src, len);
+        dest[len] = '\0';
+        return len;
+    }
+
+    for (in = 0, out = 0; in < len; in++, out++)
+    {
+        if (src[in] == '+')
+        {
+            dest[out] = ' ';
+        }
+        else if (src[in] == '%' && in + 2 < len &&
+                 (hi = hex_value(src[in + 1])) >= 0 &&
+                 (lo = hex_value(src[in + 2])) >= 0)
+        {
+            dest[out] = (char)(hi << 4 | lo);
+            in += 2;
+        }
+        else
+        {
+            dest[out] = src[in];
+        }
+    }
+    dest[out] = '\0';
+
+    return out;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
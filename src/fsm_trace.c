@@ -0,0 +1,268 @@
+#include "fsm_trace.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RING_MASK (FSM_TRACE_RING_EVENTS - 1)
+#define DUMP_BUFFER_SIZE 4096
+
+_Static_assert((FSM_TRACE_RING_EVENTS & RING_MASK) == 0,
+               "FSM_TRACE_RING_EVENTS must be a power of 2");
+
+/**
+ * @brief One thread's events. The owner writes a slot then publishes it by
+ * bumping head; readers copy slots and re-check head to drop any the owner
+ * may have overwritten meanwhile.
+ *
+ */
+struct trace_ring
+{
+    struct trace_ring *next;
+    uint32_t thread;
+    _Atomic uint64_t head;
+    struct fsm_trace_event events[FSM_TRACE_RING_EVENTS];
+};
+
+/**
+ * @brief Fixed buffer in front of write(2) so dumps never allocate
+ *
+ */
+struct dump_out
+{
+    int fd;
+    int failed;
+    size_t len;
+    char buf[DUMP_BUFFER_SIZE];
+};
+
+static atomic_bool enabled = false;
+static const char *const *names = NULL;
+static size_t name_count = 0;
+static _Atomic(struct trace_ring *) rings = NULL;
+static atomic_uint ring_count = 0;
+static atomic_uint connection_count = 0;
+static _Thread_local struct trace_ring *local_ring = NULL;
+static _Thread_local uint32_t local_connection = 0;
+
+static struct trace_ring *get_ring(void);
+static void put_str(struct dump_out *out, const char *str);
+static void put_uint(struct dump_out *out, uint64_t value);
+static void put_us(struct dump_out *out, uint64_t ns);
+static void put_state(struct dump_out *out, int state);
+static void flush_out(struct dump_out *out);
+
+void fsm_trace_enable(const char *const state_names[], size_t state_count)
+{
+    names = state_names;
+    name_count = state_count;
+    atomic_store_explicit(&enabled, true, memory_order_release);
+}
+
+bool fsm_trace_enabled(void)
+{
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+uint32_t fsm_trace_next_connection(void)
+{
+    return atomic_fetch_add_explicit(&connection_count, 1, memory_order_relaxed) + 1;
+}
+
+void fsm_trace_set_connection(uint32_t connection)
+{
+    local_connection = connection;
+}
+
+void fsm_trace_record(int from_state, int to_state, uint64_t start_ns, uint64_t end_ns)
+{
+    struct trace_ring *ring;
+    struct fsm_trace_event *event;
+    uint64_t head;
+
+    if (!fsm_trace_enabled())
+    {
+        return;
+    }
+
+    ring = get_ring();
+    if (!ring)
+    {
+        return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    event = &ring->events[head & RING_MASK];
+    event->start_ns = start_ns;
+    event->duration_ns = end_ns - start_ns;
+    event->connection = local_connection;
+    event->from_state = (int16_t)from_state;
+    event->to_state = (int16_t)to_state;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int fsm_trace_dump(int fd)
+{
+    struct dump_out out;
+    struct trace_ring *ring;
+    struct fsm_trace_event event;
+    uint64_t head;
+    uint64_t first;
+    uint64_t i;
+    uint64_t pid = (uint64_t)getpid();
+    int comma = 0;
+
+    out.fd = fd;
+    out.failed = 0;
+    out.len = 0;
+
+    put_str(&out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (ring = atomic_load_explicit(&rings, memory_order_acquire); ring; ring = ring->next)
+    {
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        // the slot after head may already be getting rewritten, skip it
+        first = head >= FSM_TRACE_RING_EVENTS ? head - FSM_TRACE_RING_EVENTS + 1 : 0;
+        for (i = first; i < head; i++)
+        {
+            event = ring->events[i & RING_MASK];
+            atomic_thread_fence(memory_order_acquire);
+            // the owner starts rewriting slot i once its head reaches i + size
+            if (atomic_load_explicit(&ring->head, memory_order_relaxed) >= i + FSM_TRACE_RING_EVENTS)
+            {
+                continue;
+            }
+
+            put_str(&out, comma ? ",\n{\"name\":\"" : "\n{\"name\":\"");
+            put_state(&out, event.to_state);
+            put_str(&out, "\",\"cat\":\"fsm\",\"ph\":\"X\",\"ts\":");
+            put_us(&out, event.start_ns);
+            put_str(&out, ",\"dur\":");
+            put_us(&out, event.duration_ns);
+            put_str(&out, ",\"pid\":");
+            put_uint(&out, pid);
+            put_str(&out, ",\"tid\":");
+            put_uint(&out, ring->thread);
+            put_str(&out, ",\"args\":{\"connection\":");
+            put_uint(&out, event.connection);
+            put_str(&out, ",\"from\":\"");
+            put_state(&out, event.from_state);
+            put_str(&out, "\"}}");
+            comma = 1;
+        }
+    }
+    put_str(&out, "\n]}\n");
+    flush_out(&out);
+
+    return out.failed ? -1 : 0;
+}
+
+/**
+ * @brief Returns the calling thread's ring, creating and publishing it on
+ * first use. Rings outlive their threads so a dump still shows their events.
+ *
+ * @return struct trace_ring* or NULL if out of memory
+ */
+static struct trace_ring *get_ring(void)
+{
+    struct trace_ring *ring = local_ring;
+
+    if (ring)
+    {
+        return ring;
+    }
+
+    ring = (struct trace_ring *)calloc(1, sizeof(struct trace_ring));
+    if (!ring)
+    {
+        return NULL;
+    }
+    ring->thread = atomic_fetch_add_explicit(&ring_count, 1, memory_order_relaxed) + 1;
+    ring->next = atomic_load_explicit(&rings, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&rings, &ring->next, ring, memory_order_release,
+                                                  memory_order_relaxed))
+    {
+    }
+    local_ring = ring;
+
+    return ring;
+}
+
+static void put_str(struct dump_out *out, const char *str)
+{
+    size_t len = strlen(str);
+
+    if (len > sizeof(out->buf) - out->len)
+    {
+        flush_out(out);
+    }
+    memcpy(out->buf + out->len, str, len);
+    out->len += len;
+}
+
+static void put_uint(struct dump_out *out, uint64_t value)
+{
+    char digits[21];
+    size_t pos = sizeof(digits) - 1;
+
+    digits[pos] = '\0';
+    do
+    {
+        digits[--pos] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    put_str(out, digits + pos);
+}
+
+/**
+ * @brief Chrome trace timestamps are microseconds, keep nanosecond precision
+ * as three decimals
+ *
+ * @param out
+ * @param ns
+ */
+static void put_us(struct dump_out *out, uint64_t ns)
+{
+    char frac[5];
+
+    put_uint(out, ns / 1000);
+    frac[0] = '.';
+    frac[1] = (char)('0' + ns / 100 % 10);
+    frac[2] = (char)('0' + ns / 10 % 10);
+    frac[3] = (char)('0' + ns % 10);
+    frac[4] = '\0';
+    put_str(out, frac);
+}
+
+static void put_state(struct dump_out *out, int state)
+{
+    if (state >= 0 && (size_t)state < name_count && names[state])
+    {
+        put_str(out, names[state]);
+    }
+    else
+    {
+        put_str(out, "state ");
+        put_uint(out, (uint64_t)(state < 0 ? 0 : state));
+    }
+}
+
+static void flush_out(struct dump_out *out)
+{
+    size_t written = 0;
+    ssize_t count;
+
+    while (written < out->len && !out->failed)
+    {
+        count = write(out->fd, out->buf + written, out->len - written);
+        if (count < 0 && errno != EINTR)
+        {
+            out->failed = 1;
+        }
+        else if (count > 0)
+        {
+            written += (size_t)count;
+        }
+    }
+    out->len = 0;
+}
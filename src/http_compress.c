@@ -0,0 +1,320 @@
+#include "http_compress.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#define MIN_CAP 4096
+
+/**
+ * @brief One compressor per coding per thread, kept for the life of the
+ * thread and reset between responses rather than rebuilt: deflateInit2
+ * allocates a few hundred KiB of window and hash tables.
+ *
+ */
+static _Thread_local z_stream streams[2];
+static _Thread_local bool streams_ready[2];
+
+static z_stream *thread_stream(enum http_coding coding);
+static int q_value(const char *param, const char *end);
+static bool grow(struct http_body *body, size_t need);
+static bool pump(struct http_body *body, const char *data, size_t len,
+                 int flush);
+
+enum http_coding http_coding_negotiate(const char *value, size_t len)
+{
+    const char *end = value + len;
+    const char *token;
+    const char *tokenEnd;
+    const char *params;
+    size_t tokenLen;
+    int gzip = -1;
+    int deflate = -1;
+    int any = -1;
+    int q;
+
+    while (value && value < end)
+    {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+        {
+            value++;
+        }
+        token = value;
+        while (value < end && *value != ',')
+        {
+            value++;
+        }
+        params = memchr(token, ';', (size_t)(value - token));
+        tokenEnd = params ? params : value;
+        while (tokenEnd > token && (tokenEnd[-1] == ' ' || tokenEnd[-1] == '\t'))
+        {
+            tokenEnd--;
+        }
+        tokenLen = (size_t)(tokenEnd - token);
+        q = params ? q_value(params, value) : 1000;
+
+        if ((tokenLen == 4 && strncasecmp(token, "gzip", 4) == 0) ||
+            (tokenLen == 6 && strncasecmp(token, "x-gzip", 6) == 0))
+        {
+            gzip = q;
+        }
+        else if (tokenLen == 7 && strncasecmp(token, "deflate", 7) == 0)
+        {
+            deflate = q;
+        }
+        else if (tokenLen == 1 && *token == '*')
+        {
+            any = q;
+        }
+    }
+
+    // codings not named take the q-value of *, if any
+    gzip = gzip < 0 ? any : gzip;
+    deflate = deflate < 0 ? any : deflate;
+    if (gzip > 0 && gzip >= deflate)
+    {
+        return HTTP_CODING_GZIP;
+    }
+    if (deflate > 0)
+    {
+        return HTTP_CODING_DEFLATE;
+    }
+
+    return HTTP_CODING_IDENTITY;
+}
+
+const char *http_coding_name(enum http_coding coding)
+{
+    switch (coding)
+    {
+        case HTTP_CODING_GZIP:
+            return "gzip";
+        case HTTP_CODING_DEFLATE:
+            return "deflate";
+        case HTTP_CODING_IDENTITY:
+        default:
+            return NULL;
+    }
+}
+
+void http_coding_tag(char *etag, size_t size, enum http_coding coding)
+{
+    const char *name = http_coding_name(coding);
+    size_t len = strlen(etag);
+    size_t nameLen;
+
+    if (name == NULL || len < 2)
+    {
+        return;
+    }
+    nameLen = strlen(name);
+    if (len + nameLen + 2 > size)
+    {
+        return;
+    }
+    // "tag" becomes "tag-gzip"
+    etag[len - 1] = '-';
+    memcpy(etag + len, name, nameLen);
+    etag[len + nameLen] = '"';
+    etag[len + nameLen + 1] = '\0';
+}
+
+void http_body_init(struct http_body *body, struct arena *arena,
+                    enum http_coding coding)
+{
+    body->arena = arena;
+    body->coding = coding;
+    body->stream = NULL;
+    body->data = NULL;
+    body->len = 0;
+    body->cap = 0;
+    body->raw_len = 0;
+    body->failed = false;
+}
+
+bool http_body_append(struct http_body *body, const char *data, size_t len)
+{
+    char *raw;
+    size_t rawLen;
+
+    if (body->failed)
+    {
+        return false;
+    }
+    body->raw_len += len;
+
+    if (body->stream == NULL && body->coding != HTTP_CODING_IDENTITY &&
+        body->raw_len >= HTTP_COMPRESS_MIN)
+    {
+        body->stream = thread_stream(body->coding);
+        if (body->stream == NULL)
+        {
+            body->failed = true;
+            return false;
+        }
+        // what was held back so far is the first input
+        raw = body->data;
+        rawLen = body->len;
+        body->data = NULL;
+        body->len = 0;
+        body->cap = 0;
+        if (rawLen && !pump(body, raw, rawLen, Z_NO_FLUSH))
+        {
+            return false;
+        }
+    }
+
+    if (body->stream)
+    {
+        return pump(body, data, len, Z_NO_FLUSH);
+    }
+
+    if (len > body->cap - body->len && !grow(body, len))
+    {
+        return false;
+    }
+    memcpy(body->data + body->len, data, len);
+    body->len += len;
+
+    return true;
+}
+
+bool http_body_finish(struct http_body *body)
+{
+    if (body->stream)
+    {
+        return pump(body, NULL, 0, Z_FINISH);
+    }
+    body->coding = HTTP_CODING_IDENTITY;
+
+    return !body->failed;
+}
+
+static z_stream *thread_stream(enum http_coding coding)
+{
+    size_t i = coding == HTTP_CODING_GZIP ? 0 : 1;
+    z_stream *stream = &streams[i];
+
+    if (streams_ready[i])
+    {
+        return deflateReset(stream) == Z_OK ? stream : NULL;
+    }
+
+    memset(stream, 0, sizeof(*stream));
+    // 16 + the window bits asks zlib for a gzip wrapper rather than zlib's
+    if (deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     coding == HTTP_CODING_GZIP ? 16 + MAX_WBITS : MAX_WBITS,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return NULL;
+    }
+    streams_ready[i] = true;
+
+    return stream;
+}
+
+/**
+ * @brief Parses the q parameter out of ";q=0.5" style parameters
+ *
+ * @param param
+ * @param end
+ * @return q-value in thousandths, 1000 if absent
+ */
+static int q_value(const char *param, const char *end)
+{
+    int q = 0;
+    int scale = 1000;
+
+    while (param < end && (*param == ';' || *param == ' ' || *param == '\t'))
+    {
+        param++;
+    }
+    if (end - param < 2 || (param[0] != 'q' && param[0] != 'Q') ||
+        param[1] != '=')
+    {
+        return 1000;
+    }
+    param += 2;
+
+    if (param < end && *param == '1')
+    {
+        return 1000;
+    }
+    if (param < end && *param == '0')
+    {
+        param++;
+    }
+    if (param < end && *param == '.')
+    {
+        for (param++; param < end && *param >= '0' && *param <= '9' && scale > 1;
+             param++)
+        {
+            scale /= 10;
+            q += (*param - '0') * scale;
+        }
+    }
+
+    return q;
+}
+
+/**
+ * @brief Makes room for at least need more bytes, arena memory is not freed
+ * until the request ends so the buffer doubles to keep the waste bounded
+ *
+ * @param body
+ * @param need
+ * @return false if out of memory
+ */
+static bool grow(struct http_body *body, size_t need)
+{
+    size_t cap = body->cap ? body->cap * 2 : MIN_CAP;
+    char *grown;
+
+    while (cap - body->len < need)
+    {
+        cap *= 2;
+    }
+    grown = (char *)arena_alloc(body->arena, cap);
+    if (grown == NULL)
+    {
+        body->failed = true;
+        return false;
+    }
+    if (body->len)
+    {
+        memcpy(grown, body->data, body->len);
+    }
+    body->data = grown;
+    body->cap = cap;
+
+    return true;
+}
+
+static bool pump(struct http_body *body, const char *data, size_t len,
+                 int flush)
+{
+    z_stream *stream = body->stream;
+    int ret;
+
+    stream->next_in = (Bytef *)(uintptr_t)data;
+    stream->avail_in = (uInt)len;
+    do
+    {
+        if (body->cap == body->len && !grow(body, MIN_CAP))
+        {
+            return false;
+        }
+        stream->next_out = (Bytef *)(body->data + body->len);
+        stream->avail_out = (uInt)(body->cap - body->len);
+        ret = deflate(stream, flush);
+        body->len = body->cap - stream->avail_out;
+        if (ret == Z_STREAM_ERROR)
+        {
+            body->failed = true;
+            return false;
+        }
+    } while (flush == Z_FINISH ? ret != Z_STREAM_END
+                               : stream->avail_in > 0 || stream->avail_out == 0);
+
+    return true;
+}
@@ -1,48 +1,185 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 // to test: change the include to "../include/http_.h"
 #include "http_.h"
+#include "http_scan.h"
 #include "common.h"
-void process_request_line(char *req_line_str, struct request_line *req_line)
+void process_request_line(char *req_line_str, struct request_line *req_line,
+                          struct arena *arena)
 {
-    const static int bufSize = 1024;
-    char buf[1024] = {0};
+    size_t len = strlen(req_line_str);
+    const char *end_method;
+    const char *end_path;
+    const char *start_query;
 
-    // can probably turn this into a function, will get back to it later
-    char *end_method = strchr(req_line_str, ' ');
-    strncpy(buf, req_line_str, (end_method - req_line_str));
+    // malformed lines leave empty fields so the caller falls through to INVALID
+    end_method = http_scan_find(req_line_str, len, HTTP_SCAN_SPACE);
+    end_path = end_method ? http_scan_find(
+                                end_method + 1,
+                                len - (size_t)(end_method + 1 - req_line_str),
+                                HTTP_SCAN_SPACE)
+                          : NULL;
+    if (!end_path)
+    {
+        req_line->req_method = arena_strdup(arena, "");
+        req_line->path = arena_strdup(arena, "");
+        req_line->query = NULL;
+        req_line->HTTP_VER = arena_strdup(arena, "");
+        return;
+    }
 
-    // note, these have to be freed
-    req_line->req_method = strdup(buf);
-    memset(buf, '\0', bufSize);
+    req_line->req_method =
+        arena_strndup(arena, req_line_str, (size_t)(end_method - req_line_str));
+    req_line->HTTP_VER = arena_strdup(arena, end_path + 1);
 
-    char *end_path = strchr(end_method + 1, ' ');
-    strncpy(buf, end_method + 1, end_path - end_method - 1);
-    req_line->path = strdup(buf);
-    memset(buf, '\0', bufSize);
+    // the path is matched exactly, so keep the query string separate
+    start_query = memchr(end_method + 1, '?',
+                         (size_t)(end_path - end_method - 1));
+    if (start_query)
+    {
+        req_line->query = arena_strndup(arena, start_query + 1,
+                                        (size_t)(end_path - start_query - 1));
+        end_path = start_query;
+    }
+    else
+    {
+        req_line->query = NULL;
+    }
+    req_line->path = arena_strndup(arena, end_method + 1,
+                                   (size_t)(end_path - end_method - 1));
+}
+
+ssize_t getContentLengthFromString(const char *inputStr)
+{
+    return (ssize_t)http_scan_content_length(inputStr, strlen(inputStr));
+}
 
-    char *end_ver = strchr(end_path + 1, '\0');
-    strncpy(buf, end_path + 1, end_ver - end_path);
-    req_line->HTTP_VER = strdup(buf);
+size_t find_header(const char *headers, const char *name, const char **value)
+{
+    size_t nameLen = strlen(name);
+    const char *line = headers;
+    const char *headersEnd = headers + strlen(headers);
+    const char *end;
+
+    while (line && *line)
+    {
+        if (strncasecmp(line, name, nameLen) == 0 && line[nameLen] == ':')
+        {
+            line += nameLen + 1;
+            while (*line == ' ' || *line == '\t')
+            {
+                line++;
+            }
+            end = http_scan_find(line, (size_t)(headersEnd - line),
+                                 HTTP_SCAN_CR);
+            if (!end)
+            {
+                end = headersEnd;
+            }
+            *value = line;
+            return (size_t)(end - line);
+        }
+        line = http_scan_find(line, (size_t)(headersEnd - line), HTTP_SCAN_LF);
+        if (line)
+        {
+            line++;
+        }
+    }
+
+    return 0;
 }
 
-void process_request(char *request, struct http_request *req)
+bool etag_matches(const char *value, size_t len, const char *etag)
+{
+    size_t etagLen = strlen(etag);
+    const char *end = value + len;
+    const char *tag;
+
+    while (value < end)
+    {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+        {
+            value++;
+        }
+        tag = value;
+        while (value < end && *value != ',')
+        {
+            value++;
+        }
+        // trim the tag, and the W/ a weak comparison ignores
+        len = (size_t)(value - tag);
+        while (len && (tag[len - 1] == ' ' || tag[len - 1] == '\t'))
+        {
+            len--;
+        }
+        if (len > 2 && tag[0] == 'W' && tag[1] == '/')
+        {
+            tag += 2;
+            len -= 2;
+        }
+        if ((len == 1 && *tag == '*') ||
+            (len == etagLen && memcmp(tag, etag, len) == 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void process_request(char *request, struct http_request *req,
+                     struct arena *arena)
 {
     const char* endOfHeaderDelimiter = "\r\n\r\n";
-    // TODO: remove magic numbers
-    char request_line[101] = {0};
-    char *endOfFirstLine = strchr(request, '\r');
-    strncpy(request_line, request, (endOfFirstLine - request));
-    process_request_line(request_line, req->req_line);
+    size_t len = strlen(request);
+    const char *endOfFirstLine;
+    char *request_line;
+    const char *startOfBody;
+    const char *connection;
+    size_t connectionLen;
+
+    endOfFirstLine = http_scan_find(request, len, HTTP_SCAN_CR);
+    if (!endOfFirstLine)
+    {
+        endOfFirstLine = request + len;
+    }
+    request_line =
+        arena_strndup(arena, request, (size_t)(endOfFirstLine - request));
+    process_request_line(request_line, req->req_line, arena);
+
     // headers
+    startOfBody = http_scan_end_of_headers(request, len);
+    if (startOfBody)
+    {
+        req->headers = arena_strndup(arena, endOfFirstLine + 2,
+                                     (size_t)(startOfBody - endOfFirstLine));
+        startOfBody += strlen(endOfHeaderDelimiter);
+    }
+    else
+    {
+        req->headers = arena_strdup(arena, "");
+        startOfBody = endOfFirstLine + strlen(endOfFirstLine);
+    }
+
+    // HTTP/1.1 is persistent unless told otherwise, HTTP/1.0 only on request
+    connectionLen = find_header(req->headers, "Connection", &connection);
+    if (strcmp(req->req_line->HTTP_VER, "HTTP/1.1") == 0)
+    {
+        req->keep_alive =
+            !(connectionLen && strncasecmp(connection, "close", 5) == 0);
+    }
+    else
+    {
+        req->keep_alive = connectionLen &&
+                          strncasecmp(connection, "keep-alive", 10) == 0;
+    }
 
     // body
-    char *startOfBody = strstr(request, endOfHeaderDelimiter);
-    req->message_body = (char*)calloc(MAX_REQUEST_SIZE, sizeof(char));
-    strcpy( req->message_body, (startOfBody + strlen(endOfHeaderDelimiter)) );
+    req->message_body = arena_strdup(arena, startOfBody);
 }
 
 // int main()
@@ -3,10 +3,13 @@
 #include <string.h>
 
 #include "http_.h"
+#include "http_scan.h"
+#include "common.h"
 void process_response(char *response, struct http_response *res)
 {
     char response_line[1024] = {0};
-    char *end_res_line = strchr(response, '\n');
+    const char *end_res_line =
+        http_scan_find(response, strlen(response), HTTP_SCAN_LF);
     strncpy(response_line, response, end_res_line - response);
     process_status_line(response_line, res->stat_line);
     process_body(response, res);
@@ -15,10 +18,10 @@ void process_body(char *request, struct http_response *res)
 {
     size_t totallength;
     size_t body_length;
-    char *start_body;
+    const char *start_body;
 
     totallength = strlen(request);
-    start_body = strstr(request, "\r\n\r\n") + 4;
+    start_body = http_scan_end_of_headers(request, totallength) + 4;
 
     res->message_body = strndup(start_body, res->content_length);
 }
@@ -27,15 +30,18 @@ void process_status_line(char *response, struct status_line *status_line)
     char buf[1024] = {0};
     char *end_res_buf;
     int res_code;
-    char *end_http_ver;
-    char *end_status_code;
-    char *start_reason;
+    const char *end_http_ver;
+    const char *end_status_code;
+    const char *start_reason;
     size_t size;
 
     // takes the ptr to the end of the httpver "HTTP/1.0" & status
     // codes "200/400"
-    end_http_ver = strchr(response, ' ');
-    end_status_code = strchr(end_http_ver + 1, ' ');
+    size = strlen(response);
+    end_http_ver = http_scan_find(response, size, HTTP_SCAN_SPACE);
+    end_status_code = http_scan_find(
+        end_http_ver + 1, size - (size_t)(end_http_ver + 1 - response),
+        HTTP_SCAN_SPACE);
     // ptr to start of the reason phrase "OK"
     start_reason = end_status_code + 1;
 
@@ -55,25 +61,12 @@ void process_status_line(char *response, struct status_line *status_line)
 }
 void process_content_length(char *response, struct http_response *res)
 {
-    char *inputDup = strdup(response);
-    char *lengthStr;
-    char *seekToPos;
-    const char *seekTo = "Content-Length: ";
-    int length;
+    size_t length = http_scan_content_length(response, strlen(response));
 
-    if (!strstr(inputDup, seekTo))
-    {
-        length = 0;
-    }
-    else
-    {
-        seekToPos = strstr(inputDup, seekTo);
-        lengthStr = strtok(seekToPos + strlen(seekTo), " ");
-        length = atoi(lengthStr);
-    }
     // res->content_length = (int)malloc(sizeof(int));
-    res->content_length = length;
-    free(inputDup);
+    // past the buffer either way, the reader gives up once it is full
+    res->content_length =
+        length == HTTP_SCAN_TOO_LARGE ? MAX_REQUEST_SIZE : (int)length;
 }
 
 // testing purposes
@@ -0,0 +1,329 @@
+#include "http_scan.h"
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+
+#include "common.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HTTP_SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*scan_kernel)(const char *block, struct http_scan_marks *marks);
+
+static scan_kernel select_kernel(void);
+static void resolve_kernel(void);
+static void scan_scalar(const char *block, struct http_scan_marks *marks);
+#ifdef HTTP_SCAN_X86
+static void scan_sse2(const char *block, struct http_scan_marks *marks);
+static void scan_avx2(const char *block, struct http_scan_marks *marks);
+#endif
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static scan_kernel kernel = scan_scalar;
+
+bool http_scan_use(enum http_scan_kernel which)
+{
+    pthread_once(&kernel_once, resolve_kernel);
+    if (which == HTTP_SCAN_KERNEL_AUTO)
+    {
+        kernel = scan_scalar;
+        resolve_kernel();
+        return true;
+    }
+    if (which == HTTP_SCAN_KERNEL_SCALAR)
+    {
+        kernel = scan_scalar;
+        return true;
+    }
+#ifdef HTTP_SCAN_X86
+    if (which == HTTP_SCAN_KERNEL_SSE2 && __builtin_cpu_supports("sse2"))
+    {
+        kernel = scan_sse2;
+        return true;
+    }
+    if (which == HTTP_SCAN_KERNEL_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+        kernel = scan_avx2;
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+void http_scan_block(const char *buf, size_t len,
+                     struct http_scan_marks *marks)
+{
+    scan_kernel scan = select_kernel();
+    char tail[HTTP_SCAN_BLOCK];
+    uint64_t valid;
+
+    if (len >= HTTP_SCAN_BLOCK)
+    {
+        scan(buf, marks);
+        return;
+    }
+
+    // short block: pad so the kernels can always load a full block
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, buf, len);
+    scan(tail, marks);
+    valid = len ? (~(uint64_t)0 >> (HTTP_SCAN_BLOCK - len)) : 0;
+    marks->cr &= valid;
+    marks->lf &= valid;
+    marks->colon &= valid;
+    marks->space &= valid;
+}
+
+const char *http_scan_find(const char *buf, size_t len,
+                           enum http_scan_class cls)
+{
+    struct http_scan_marks marks;
+    size_t offset;
+    size_t chunk;
+    uint64_t mask;
+
+    for (offset = 0; offset < len; offset += HTTP_SCAN_BLOCK)
+    {
+        chunk = len - offset < HTTP_SCAN_BLOCK ? len - offset : HTTP_SCAN_BLOCK;
+        http_scan_block(buf + offset, chunk, &marks);
+        switch (cls)
+        {
+            case HTTP_SCAN_CR:
+                mask = marks.cr;
+                break;
+            case HTTP_SCAN_LF:
+                mask = marks.lf;
+                break;
+            case HTTP_SCAN_COLON:
+                mask = marks.colon;
+                break;
+            case HTTP_SCAN_SPACE:
+                mask = marks.space;
+                break;
+            default:
+                mask = 0;
+                break;
+        }
+        if (mask)
+        {
+            return buf + offset + (size_t)__builtin_ctzll(mask);
+        }
+    }
+
+    return NULL;
+}
+
+const char *http_scan_end_of_headers(const char *buf, size_t len)
+{
+    struct http_scan_marks marks;
+    size_t offset;
+    size_t chunk;
+    uint64_t match;
+
+    if (len < 4)
+    {
+        return NULL;
+    }
+
+    // blocks overlap by 3 bytes so a delimiter never straddles two of them
+    for (offset = 0; offset + 4 <= len; offset += HTTP_SCAN_BLOCK - 3)
+    {
+        chunk = len - offset < HTTP_SCAN_BLOCK ? len - offset : HTTP_SCAN_BLOCK;
+        http_scan_block(buf + offset, chunk, &marks);
+        match = marks.cr & (marks.lf >> 1) & (marks.cr >> 2) & (marks.lf >> 3);
+        if (match)
+        {
+            return buf + offset + (size_t)__builtin_ctzll(match);
+        }
+    }
+
+    return NULL;
+}
+
+size_t http_scan_content_length(const char *buf, size_t len)
+{
+    static const char name[] = "Content-Length:";
+    const char *end;
+    const char *line;
+    const char *next;
+    size_t length;
+
+    end = http_scan_end_of_headers(buf, len);
+    if (!end)
+    {
+        return 0;
+    }
+
+    // skip the request/status line, then walk header lines by their LFs
+    line = http_scan_find(buf, (size_t)(end - buf), HTTP_SCAN_LF);
+    while (line && line < end)
+    {
+        line++;
+        if ((size_t)(end - line) >= sizeof(name) - 1 &&
+            strncasecmp(line, name, sizeof(name) - 1) == 0)
+        {
+            line += sizeof(name) - 1;
+            while (*line == ' ' || *line == '\t')
+            {
+                line++;
+            }
+            // stops past MAX_REQUEST_SIZE, long before it could overflow
+            for (length = 0; *line >= '0' && *line <= '9'; line++)
+            {
+                length = length * 10 + (size_t)(*line - '0');
+                if (length > MAX_REQUEST_SIZE)
+                {
+                    return HTTP_SCAN_TOO_LARGE;
+                }
+            }
+            return length;
+        }
+        next = http_scan_find(line, (size_t)(end - line), HTTP_SCAN_LF);
+        line = next;
+    }
+
+    return 0;
+}
+
+static scan_kernel select_kernel(void)
+{
+    pthread_once(&kernel_once, resolve_kernel);
+
+    return kernel;
+}
+
+static void resolve_kernel(void)
+{
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernel = scan_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        kernel = scan_sse2;
+    }
+#endif
+}
+
+static void scan_scalar(const char *block, struct http_scan_marks *marks)
+{
+    unsigned int i;
+    uint64_t bit;
+
+    marks->cr = 0;
+    marks->lf = 0;
+    marks->colon = 0;
+    marks->space = 0;
+    for (i = 0; i < HTTP_SCAN_BLOCK; i++)
+    {
+        bit = (uint64_t)1 << i;
+        switch (block[i])
+        {
+            case '\r':
+                marks->cr |= bit;
+                break;
+            case '\n':
+                marks->lf |= bit;
+                break;
+            case ':':
+                marks->colon |= bit;
+                break;
+            case ' ':
+                marks->space |= bit;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+#ifdef HTTP_SCAN_X86
+__attribute__((target("sse2"))) static void scan_sse2(
+    const char *block, struct http_scan_marks *marks)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i space = _mm_set1_epi8(' ');
+    __m128i bytes;
+    unsigned int i;
+    unsigned int shift;
+
+    marks->cr = 0;
+    marks->lf = 0;
+    marks->colon = 0;
+    marks->space = 0;
+    for (i = 0; i < HTTP_SCAN_BLOCK / 16; i++)
+    {
+        bytes = _mm_loadu_si128((const __m128i *)(const void *)(block + i * 16));
+        shift = i * 16;
+        marks->cr |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+                         _mm_cmpeq_epi8(bytes, cr))
+                     << shift;
+        marks->lf |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+                         _mm_cmpeq_epi8(bytes, lf))
+                     << shift;
+        marks->colon |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+                            _mm_cmpeq_epi8(bytes, colon))
+                        << shift;
+        marks->space |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+                            _mm_cmpeq_epi8(bytes, space))
+                        << shift;
+    }
+}
+
+__attribute__((target("avx2"))) static void scan_avx2(
+    const char *block, struct http_scan_marks *marks)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i space = _mm256_set1_epi8(' ');
+    __m256i lo;
+    __m256i hi;
+
+    lo = _mm256_loadu_si256((const __m256i *)(const void *)block);
+    hi = _mm256_loadu_si256((const __m256i *)(const void *)(block + 32));
+    marks->cr =
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, cr)) |
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, cr))
+            << 32;
+    marks->lf =
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, lf)) |
+        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, lf))
+            << 32;
+    marks->colon = (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                       _mm256_cmpeq_epi8(lo, colon)) |
+                   (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                       _mm256_cmpeq_epi8(hi, colon))
+                       << 32;
+    marks->space = (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                       _mm256_cmpeq_epi8(lo, space)) |
+                   (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                       _mm256_cmpeq_epi8(hi, space))
+                       << 32;
+}
+#endif
+
+size_t http_scan_request_length(const char *buf, size_t len)
+{
+    const char *end = http_scan_end_of_headers(buf, len);
+    size_t body;
+
+    if (!end)
+    {
+        return 0;
+    }
+    body = http_scan_content_length(buf, len);
+    if (body == HTTP_SCAN_TOO_LARGE)
+    {
+        return HTTP_SCAN_TOO_LARGE;
+    }
+
+    return (size_t)(end - buf) + 4 + body;
+}
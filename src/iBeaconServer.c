@@ -19,29 +19,40 @@
 #include <dc_util/dump.h>
 #include <dc_util/streams.h>
 #include <dc_util/types.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
+#include "affinity.h"
+#include "arena.h"
+#include "change_feed.h"
 #include "common.h"
 #include "dbstuff.h"
+#include "follow.h"
+#include "form.h"
+#include "fsm_trace.h"
 #include "http_.h"
-
-/**
- * @brief Server info used in Processing-FSM
- *
- */
-struct server
-{
-    const char *dbLoc;
-    int client_socket_fd;
-    struct http_request req;
-    struct http_response res;
-};
+#include "http_compress.h"
+#include "http_scan.h"
+#include "ingest.h"
+#include "metrics.h"
+#include "routes.h"
+#include "server.h"
+#include "static_assets.h"
+#include "uring_server.h"
+#include "wal.h"
+#include "watch.h"
 
 /**
  * @brief Application settings
@@ -56,8 +67,47 @@ struct application_settings
     struct dc_setting_uint16 *port;
     struct dc_setting_bool *reuse_address;
     struct dc_setting_string *dbLoc;
+    struct dc_setting_uint16 *pool_size;
+    struct dc_setting_string *trace_file;
+    struct dc_setting_string *idle_timeout;
+    struct dc_setting_string *header_timeout;
+    struct dc_setting_string *body_timeout;
+    struct dc_setting_uint16 *backlog;
+    struct dc_setting_uint16 *max_connections;
+    struct dc_setting_uint16 *max_queued;
+    struct dc_setting_uint16 *max_requests;
+    struct dc_setting_uint16 *max_bulk_reads;
+    struct dc_setting_uint16 *retry_after;
+    struct dc_setting_bool *io_uring;
+    bool io_uring_unavailable;
+    struct dc_setting_string *static_dir;
+    struct dc_setting_uint16 *max_watchers;
+    struct dc_setting_uint16 *ingest_port;
+    struct dc_setting_uint16 *ingest_udp_port;
+    struct dc_setting_string *wal;
+    struct dc_setting_string *wal_sync;
+    struct dc_setting_uint16 *wal_batch_ms;
+    struct dc_setting_string *snapshot_dir;
+    struct dc_setting_string *follow;
+    struct dc_setting_uint16 *follow_poll_ms;
+    struct dc_setting_uint16 *warm_threads;
+    struct dc_setting_string *cpus;
+    struct dc_setting_bool *incoming_cpu;
     struct addrinfo *address;
     int server_socket_fd;
+    struct server_pool *pool;
+};
+
+/**
+ * @brief Where a write-ahead log replay stores to
+ *
+ */
+struct replay
+{
+    const struct dc_posix_env *env;
+    struct dc_error *err;
+    const char *dbLoc;
+    size_t count;
 };
 
 static struct dc_application_settings *create_settings(
@@ -68,6 +118,7 @@ static int destroy_settings(const struct dc_posix_env *env,
 static int run(const struct dc_posix_env *env, struct dc_error *err,
                struct dc_application_settings *settings);
 static void signal_handler(int signnum);
+static void trace_signal_handler(int signnum);
 static void do_create_settings(const struct dc_posix_env *env,
                                struct dc_error *err, void *arg);
 static void do_create_socket(const struct dc_posix_env *env,
@@ -76,6 +127,8 @@ static void do_set_sockopts(const struct dc_posix_env *env,
                             struct dc_error *err, void *arg);
 static void do_bind(const struct dc_posix_env *env, struct dc_error *err,
                     void *arg);
+static void start_ingest(const struct dc_posix_env *env, struct dc_error *err,
+                         struct application_settings *app_settings, int cpu);
 static void do_listen(const struct dc_posix_env *env, struct dc_error *err,
                       void *arg);
 static void do_setup(const struct dc_posix_env *env, struct dc_error *err,
@@ -118,22 +171,80 @@ static void bad_change_state(const struct dc_posix_env *env,
  */
 static volatile sig_atomic_t exit_signal = 0;
 /**
- * @brief Free structures associated with server struct, and server itself
+ * @brief When the current Processing-FSM state was entered on this thread
+ *
+ */
+static _Thread_local uint64_t state_started_ns;
+/**
+ * @brief Where SIGUSR1 dumps the FSM trace, NULL when tracing is off
+ *
+ */
+static const char *trace_path = NULL;
+/**
+ * @brief Index, 404 page and files under static_dir, responses prepared at
+ * startup
+ *
+ */
+static struct static_assets *assets = NULL;
+/**
+ * @brief Every successful PUT, published to the open watches
+ *
+ */
+static struct change_feed *feed = NULL;
+/**
+ * @brief Held exclusive from a PUT's store to its publish, so the changelog
+ * has the writes in the order the db took them, and shared by every db read,
+ * which ndbm does not keep from seeing a store half done
+ *
+ */
+static pthread_rwlock_t storeLock = PTHREAD_RWLOCK_INITIALIZER;
+/**
+ * @brief Binary ingestion on ingest_port and ingest_udp_port, none when they
+ * are off, one per CPU with incoming_cpu
+ *
+ */
+static struct ingest_listener *ingest[INGEST_MAX_LISTENERS];
+static size_t ingestCount = 0;
+/**
+ * @brief Every store is logged here before the db takes it, NULL when the
+ * log is off. Written under storeLock.
+ *
+ */
+static struct wal *wal = NULL;
+/**
+ * @brief Where PUT /admin/snapshot writes, NULL when snapshots are off
+ *
+ */
+static const char *snapshotDir = NULL;
+/**
+ * @brief Held while a snapshot is taken, one at a time
+ *
+ */
+static pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * @brief Set while a snapshot holds stores off the db's files, which the log
+ * is then alone in keeping, so it is not checkpointed. Written under
+ * storeLock.
+ *
+ */
+static bool walPinned = false;
+/**
+ * @brief Tails the primary when this server is a read-only follower, NULL
+ * otherwise
  *
- * @param server
  */
-void freeServerStruct(struct server *server);
+static struct follower *follower = NULL;
 /**
  * @brief Start the Processing FSM once a connection request is accepted
  *
  * @param env
  * @param err
+ * @param pool
  * @param client_socket_fd
- * @param dbLoc
  * @return int
  */
 int startProcessingFSM(const struct dc_posix_env *env, struct dc_error *err,
-                       int client_socket_fd, const char *dbLoc);
+                       struct server_pool *pool, int client_socket_fd);
 /**
  * @brief PROCESS state of Processing FSM calls this - reads data from client FD
  * and creates HTTP request struct representation of data
@@ -144,6 +255,36 @@ int startProcessingFSM(const struct dc_posix_env *env, struct dc_error *err,
  * @return int
  */
 int process(const struct dc_posix_env *env, struct dc_error *err, void *arg);
+/**
+ * @brief Resets the per-request state of server before a request is read
+ *
+ * @param server
+ */
+void beginRequest(struct server *server);
+/**
+ * @brief Parses the request read into server->recv_buf and picks the state
+ * that answers it
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param received result of reading the request, as from receive_data
+ * @return next state
+ */
+int handleRequest(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server, int received);
+/**
+ * @brief Runs the Processing-FSM states for one request the io_uring backend
+ * has read, calling the same state change hooks as dc_fsm_run
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param received
+ * @return true to keep the connection open
+ */
+bool serveRingRequest(const struct dc_posix_env *env, struct dc_error *err,
+                      struct server *server, int received);
 /**
  * @brief _GET state of Procesing FSM calls this - interprets GET request and
  * responds
@@ -164,6 +305,16 @@ int get(const struct dc_posix_env *env, struct dc_error *err, void *arg);
  * @return int
  */
 int put(const struct dc_posix_env *env, struct dc_error *err, void *arg);
+/**
+ * @brief Runs the handler of the route matched in PROCESS, or answers 404 when
+ * no route matched
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void dispatchRoute(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server);
 /**
  * @brief INVALID state of Processing FSM calls this - respond to
  * invalid/unsupported requests
@@ -174,6 +325,46 @@ int put(const struct dc_posix_env *env, struct dc_error *err, void *arg);
  * @return int
  */
 int invalid(const struct dc_posix_env *env, struct dc_error *err, void *arg);
+/**
+ * @brief Ends the current request: resets the request arena and either loops
+ * back to PROCESS for a keep-alive connection or closes the client-fd
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @return next state
+ */
+int finishRequest(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server);
+/**
+ * @brief Queues len bytes of response for the client-fd. Anything that does
+ * not fit in the response buffer is written straight through.
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param data
+ * @param len
+ */
+void queueResponse(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server, const char *data, size_t len);
+/**
+ * @brief Writes the queued response to the client-fd
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void flushResponse(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server);
+/**
+ * @brief Connection header line matching the keep-alive decision for the
+ * current request
+ *
+ * @param server
+ * @return const char*
+ */
+const char *connectionHeader(const struct server *server);
 /**
  * @brief Constructs HTTP response containing val in body, and writes to
  * server's client-fd
@@ -184,34 +375,205 @@ int invalid(const struct dc_posix_env *env, struct dc_error *err, void *arg);
  * @param val
  */
 void writeValToClient(const struct dc_posix_env *env, struct dc_error *err,
-                      struct server *server, char *start, char *val);
-/**
- * @brief Parses an HTTP request string for content-length, and returns value if
- * found or 0 if not.
- *
- * @param inputStr
- * @return ssize_t
- */
-ssize_t getContentLengthFromString(const char *inputStr);
+                      struct server *server, const char *start,
+                      const char *val);
 /**
- * @brief Reads an HTTP request from int file descriptor into destination
+ * @brief Reads an HTTP request from int file descriptor into destination.
+ * The client gets timeouts->idle_ms to start a request, header_ms from its
+ * first byte to the end of the headers and body_ms for the body.
  *
  * @param env
  * @param err
  * @param fd
  * @param size
- * @return 0 if successful
+ * @param timeouts
+ * @return 0 if successful, RECEIVE_TIMED_OUT if a deadline passed,
+ * RECEIVE_TOO_LARGE if the Content-Length would not fit bufSize
  */
 int receive_data(const struct dc_posix_env *env, struct dc_error *err, int fd,
-                 char *dest, size_t bufSize);
+                 char *dest, size_t bufSize,
+                 const struct server_timeouts *timeouts);
+/**
+ * @brief Waits until fd is readable or the deadline passes
+ *
+ * @param fd
+ * @param deadline monotonic ns, 0 to wait forever
+ * @return false if the deadline passed first
+ */
+bool waitForData(int fd, uint64_t deadline);
+/**
+ * @brief Reads a phase timeout setting. 0 turns the timeout off, as 0 lifts
+ * the admission limits.
+ *
+ * @param str milliseconds
+ * @param ms set to the timeout, -1 for none
+ * @return false if str is not a number of milliseconds an int holds
+ */
+bool parseTimeout(const char *str, int *ms);
+/**
+ * @brief Deadline for a phase that starts now
+ *
+ * @param ms phase timeout, negative for none
+ * @return monotonic ns, 0 for none
+ */
+uint64_t phaseDeadline(int ms);
+/**
+ * @brief Answers 408 to a client that stalled mid-request, then closes
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void deliverTimeout(const struct dc_posix_env *env, struct dc_error *err,
+                    struct server *server);
+/**
+ * @brief Answers 413 to a request whose Content-Length is over what it may
+ * send, then closes, as its body was never read
+ *
+ * @param env
+ * @param err
+ * @param server
+ */
+void deliverTooLarge(const struct dc_posix_env *env, struct dc_error *err,
+                     struct server *server);
+/**
+ * @brief Logs a batch of beacons to the write-ahead log, then stores each and
+ * publishes it to the change feed: the one path into the db. Nothing is
+ * stored if the log could not be written.
+ *
+ * @param env
+ * @param err
+ * @param dbLoc
+ * @param records
+ * @param count
+ * @param seq set to the last stored change's sequence number, 0 if none was
+ * @return the number stored
+ */
+size_t storeBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                    const char *dbLoc, const struct ingest_record *records,
+                    size_t count, uint64_t *seq);
+/**
+ * @brief Redoes a logged store at startup, a wal_visitor
+ *
+ * @param arg struct replay
+ * @param key
+ * @param value
+ * @return false if the db would not take it
+ */
+bool replayBeacon(void *arg, const char *key, const char *value);
+/**
+ * @brief Stores a batch of beacons from the ingestion port or, on a follower,
+ * from the primary's changelog, an ingest_store. Called on the ingestion or
+ * follower thread, it takes storeLock exclusive like any PUT, so GETs served
+ * meanwhile never see a store half done.
+ *
+ * @param env
+ * @param err
+ * @param arg the db location
+ * @param records
+ * @param count
+ * @return the number stored
+ */
+size_t storeIngested(const struct dc_posix_env *env, struct dc_error *err,
+                     const void *arg, const struct ingest_record *records,
+                     size_t count);
+/**
+ * @brief Admission class of the parsed request: PUTs are writes, ?all is a
+ * bulk read and any other GET a plain read
+ *
+ * @param server
+ * @param method
+ * @return enum admission_class
+ */
+enum admission_class requestClass(const struct server *server, int method);
+/**
+ * @brief Refuses a request admission control turned away, with a Retry-After
+ * so well-behaved clients back off. 503s also close the connection.
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param verdict ADMISSION_OVERLOADED or ADMISSION_THROTTLED
+ */
+void deliverOverload(const struct dc_posix_env *env, struct dc_error *err,
+                     struct server *server, enum admission_verdict verdict);
+/**
+ * @brief Sends a prepared static response, or its 304 when If-None-Match
+ * names the current ETag. Large bodies go out with sendfile from the page
+ * cache, or are handed to the io_uring backend by reference.
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param asset
+ */
+void deliverAsset(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server, const struct static_asset *asset);
+/**
+ * @brief Content coding the request's Accept-Encoding asks for
+ *
+ * @param server
+ * @return enum http_coding
+ */
+enum http_coding acceptedCoding(const struct server *server);
+/**
+ * @brief Appends one "key : value" line of a ?all dump, a db_visitor
+ *
+ * @param arg the struct http_body
+ * @param key
+ * @param keyLen
+ * @param val
+ * @param valLen
+ * @return false once the body failed
+ */
+bool appendBeacon(void *arg, const char *key, size_t keyLen, const char *val,
+                  size_t valLen);
+/**
+ * @brief Appends one record of a ?format=binary changes body, in the
+ * ingestion record encoding, a db_visitor
+ *
+ * @param arg the struct http_body
+ * @param key
+ * @param keyLen
+ * @param val
+ * @param valLen
+ * @return false once the body failed, or for a pair too long to encode
+ */
+bool appendRecord(void *arg, const char *key, size_t keyLen, const char *val,
+                  size_t valLen);
+/**
+ * @brief Finishes body and writes it after head, adding the entity headers
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param head status line and any headers of the response other than
+ * Content-Encoding, Content-Length and Connection
+ * @param body
+ */
+void writeBodyToClient(const struct dc_posix_env *env, struct dc_error *err,
+                       struct server *server, const char *head,
+                       struct http_body *body);
+/**
+ * @brief Answers 304 Not Modified if the request's If-None-Match names etag
+ *
+ * @param env
+ * @param err
+ * @param server
+ * @param etag quoted entity tag of the current representation
+ * @return true if the 304 was queued and nothing else should be sent
+ */
+bool deliverNotModified(const struct dc_posix_env *env, struct dc_error *err,
+                        struct server *server, const char *etag);
 /**
  * @brief Writes a 404 html page to the client
  * 
  */
-void deliverThe404(struct server *server);
+void deliverThe404(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server);
 
 /**
- * @brief States for Processing-FSM
+ * @brief States for Processing-FSM, in the same order as enum metrics_state
  *
  */
 enum processing_states
@@ -222,6 +584,15 @@ enum processing_states
     INVALID                       // 5
 };
 
+/**
+ * @brief Names of the Processing-FSM states for trace dumps
+ *
+ */
+static const char *const state_names[] = {
+    [DC_FSM_INIT] = "INIT", [DC_FSM_EXIT] = "EXIT", [PROCESS] = "PROCESS",
+    [GET_] = "GET_",        [PUT_] = "PUT_",        [INVALID] = "INVALID",
+};
+
 /**
  * @brief Starts the server
  *
@@ -248,6 +619,10 @@ int main(int argc, char *argv[])
     sa.sa_handler = &signal_handler;
     dc_sigaction(&env, &err, SIGINT, &sa, NULL);
     dc_sigaction(&env, &err, SIGTERM, &sa, NULL);
+    // restart interrupted accepts and reads, a dump must not end the server
+    sa.sa_handler = &trace_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    dc_sigaction(&env, &err, SIGUSR1, &sa, NULL);
 
     info = dc_application_info_create(&env, &err, "iBeaconServer");
     ret_val =
@@ -270,6 +645,31 @@ static struct dc_application_settings *create_settings(
         DEFAULT_PORT;  // ignore vscode red underline
     static const bool default_reuse = false;
     static const char *default_location = "beacons";
+    static const uint16_t default_pool_size = 16;
+    static const char *default_trace_file = NULL;
+    static const char *default_idle_timeout = "5000";
+    static const char *default_header_timeout = "10000";
+    static const char *default_body_timeout = "30000";
+    static const uint16_t default_backlog = 128;
+    static const uint16_t default_max_connections = 256;
+    static const uint16_t default_max_queued = 64;
+    static const uint16_t default_max_requests = 64;
+    static const uint16_t default_max_bulk_reads = 4;
+    static const uint16_t default_retry_after = 1;
+    static const bool default_io_uring = false;
+    static const char *default_static_dir = NULL;
+    static const uint16_t default_max_watchers = 64;
+    static const uint16_t default_ingest_port = 0;
+    static const uint16_t default_ingest_udp_port = 0;
+    static const char *default_wal = NULL;
+    static const char *default_wal_sync = "batch";
+    static const uint16_t default_wal_batch_ms = 10;
+    static const char *default_snapshot_dir = NULL;
+    static const char *default_follow = NULL;
+    static const uint16_t default_follow_poll_ms = 100;
+    static const uint16_t default_warm_threads = 4;
+    static const char *default_cpus = NULL;
+    static const bool default_incoming_cpu = false;
     struct application_settings *settings;
 
     settings = dc_malloc(env, err, sizeof(struct application_settings));
@@ -286,6 +686,33 @@ static struct dc_application_settings *create_settings(
     settings->port = dc_setting_uint16_create(env, err);
     settings->reuse_address = dc_setting_bool_create(env, err);
     settings->dbLoc = dc_setting_string_create(env, err);
+    settings->pool_size = dc_setting_uint16_create(env, err);
+    settings->trace_file = dc_setting_string_create(env, err);
+    settings->idle_timeout = dc_setting_string_create(env, err);
+    settings->header_timeout = dc_setting_string_create(env, err);
+    settings->body_timeout = dc_setting_string_create(env, err);
+    settings->backlog = dc_setting_uint16_create(env, err);
+    settings->max_connections = dc_setting_uint16_create(env, err);
+    settings->max_queued = dc_setting_uint16_create(env, err);
+    settings->max_requests = dc_setting_uint16_create(env, err);
+    settings->max_bulk_reads = dc_setting_uint16_create(env, err);
+    settings->retry_after = dc_setting_uint16_create(env, err);
+    settings->io_uring = dc_setting_bool_create(env, err);
+    settings->io_uring_unavailable = false;
+    settings->static_dir = dc_setting_string_create(env, err);
+    settings->max_watchers = dc_setting_uint16_create(env, err);
+    settings->ingest_port = dc_setting_uint16_create(env, err);
+    settings->ingest_udp_port = dc_setting_uint16_create(env, err);
+    settings->wal = dc_setting_string_create(env, err);
+    settings->wal_sync = dc_setting_string_create(env, err);
+    settings->wal_batch_ms = dc_setting_uint16_create(env, err);
+    settings->snapshot_dir = dc_setting_string_create(env, err);
+    settings->follow = dc_setting_string_create(env, err);
+    settings->follow_poll_ms = dc_setting_uint16_create(env, err);
+    settings->warm_threads = dc_setting_uint16_create(env, err);
+    settings->cpus = dc_setting_string_create(env, err);
+    settings->incoming_cpu = dc_setting_bool_create(env, err);
+    settings->pool = NULL;
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
@@ -311,6 +738,100 @@ static struct dc_application_settings *create_settings(
         {(struct dc_setting *)settings->dbLoc, dc_options_set_string, "dbLoc",
          required_argument, 'd', "DB_LOCATION", dc_string_from_string,
          "db_location", dc_string_from_config, default_location},
+        {(struct dc_setting *)settings->pool_size, dc_options_set_uint16,
+         "connections", required_argument, 'n', "CONNECTION_POOL_SIZE",
+         dc_uint16_from_string, "connection_pool_size", dc_uint16_from_config,
+         &default_pool_size},
+        {(struct dc_setting *)settings->trace_file, dc_options_set_string,
+         "trace", required_argument, 't', "TRACE_FILE", dc_string_from_string,
+         "trace_file", dc_string_from_config, default_trace_file},
+        // milliseconds, past the 65535 a uint16 setting holds; 0 for none
+        {(struct dc_setting *)settings->idle_timeout, dc_options_set_string,
+         "idle-timeout", required_argument, 'I', "IDLE_TIMEOUT",
+         dc_string_from_string, "idle_timeout", dc_string_from_config,
+         default_idle_timeout},
+        {(struct dc_setting *)settings->header_timeout, dc_options_set_string,
+         "header-timeout", required_argument, 'H', "HEADER_TIMEOUT",
+         dc_string_from_string, "header_timeout", dc_string_from_config,
+         default_header_timeout},
+        {(struct dc_setting *)settings->body_timeout, dc_options_set_string,
+         "body-timeout", required_argument, 'B', "BODY_TIMEOUT",
+         dc_string_from_string, "body_timeout", dc_string_from_config,
+         default_body_timeout},
+        {(struct dc_setting *)settings->backlog, dc_options_set_uint16,
+         "backlog", required_argument, 'b', "BACKLOG", dc_uint16_from_string,
+         "backlog", dc_uint16_from_config, &default_backlog},
+        {(struct dc_setting *)settings->max_connections, dc_options_set_uint16,
+         "max-connections", required_argument, 'm', "MAX_CONNECTIONS",
+         dc_uint16_from_string, "max_connections", dc_uint16_from_config,
+         &default_max_connections},
+        {(struct dc_setting *)settings->max_queued, dc_options_set_uint16,
+         "max-queued", required_argument, 'q', "MAX_QUEUED",
+         dc_uint16_from_string, "max_queued", dc_uint16_from_config,
+         &default_max_queued},
+        {(struct dc_setting *)settings->max_requests, dc_options_set_uint16,
+         "max-requests", required_argument, 'r', "MAX_REQUESTS",
+         dc_uint16_from_string, "max_requests", dc_uint16_from_config,
+         &default_max_requests},
+        {(struct dc_setting *)settings->max_bulk_reads, dc_options_set_uint16,
+         "max-bulk-reads", required_argument, 'a', "MAX_BULK_READS",
+         dc_uint16_from_string, "max_bulk_reads", dc_uint16_from_config,
+         &default_max_bulk_reads},
+        {(struct dc_setting *)settings->retry_after, dc_options_set_uint16,
+         "retry-after", required_argument, 'R', "RETRY_AFTER",
+         dc_uint16_from_string, "retry_after", dc_uint16_from_config,
+         &default_retry_after},
+        {(struct dc_setting *)settings->io_uring, dc_options_set_bool,
+         "io-uring", no_argument, 'U', "IO_URING", dc_flag_from_string,
+         "io_uring", dc_flag_from_config, &default_io_uring},
+        {(struct dc_setting *)settings->static_dir, dc_options_set_string,
+         "static-dir", required_argument, 'S', "STATIC_DIR",
+         dc_string_from_string, "static_dir", dc_string_from_config,
+         default_static_dir},
+        {(struct dc_setting *)settings->max_watchers, dc_options_set_uint16,
+         "max-watchers", required_argument, 'w', "MAX_WATCHERS",
+         dc_uint16_from_string, "max_watchers", dc_uint16_from_config,
+         &default_max_watchers},
+        {(struct dc_setting *)settings->ingest_port, dc_options_set_uint16,
+         "ingest-port", required_argument, 'P', "INGEST_PORT",
+         dc_uint16_from_string, "ingest_port", dc_uint16_from_config,
+         &default_ingest_port},
+        {(struct dc_setting *)settings->ingest_udp_port, dc_options_set_uint16,
+         "ingest-udp-port", required_argument, 'D', "INGEST_UDP_PORT",
+         dc_uint16_from_string, "ingest_udp_port", dc_uint16_from_config,
+         &default_ingest_udp_port},
+        {(struct dc_setting *)settings->wal, dc_options_set_string, "wal",
+         required_argument, 'W', "WAL", dc_string_from_string, "wal",
+         dc_string_from_config, default_wal},
+        {(struct dc_setting *)settings->wal_sync, dc_options_set_string,
+         "wal-sync", required_argument, 'Y', "WAL_SYNC", dc_string_from_string,
+         "wal_sync", dc_string_from_config, default_wal_sync},
+        {(struct dc_setting *)settings->wal_batch_ms, dc_options_set_uint16,
+         "wal-batch-ms", required_argument, 'M', "WAL_BATCH_MS",
+         dc_uint16_from_string, "wal_batch_ms", dc_uint16_from_config,
+         &default_wal_batch_ms},
+        {(struct dc_setting *)settings->snapshot_dir, dc_options_set_string,
+         "snapshot-dir", required_argument, 'K', "SNAPSHOT_DIR",
+         dc_string_from_string, "snapshot_dir", dc_string_from_config,
+         default_snapshot_dir},
+        {(struct dc_setting *)settings->follow, dc_options_set_string,
+         "follow", required_argument, 'F', "FOLLOW", dc_string_from_string,
+         "follow", dc_string_from_config, default_follow},
+        {(struct dc_setting *)settings->follow_poll_ms, dc_options_set_uint16,
+         "follow-poll-ms", required_argument, 'O', "FOLLOW_POLL_MS",
+         dc_uint16_from_string, "follow_poll_ms", dc_uint16_from_config,
+         &default_follow_poll_ms},
+        {(struct dc_setting *)settings->warm_threads, dc_options_set_uint16,
+         "warm-threads", required_argument, 'T', "WARM_THREADS",
+         dc_uint16_from_string, "warm_threads", dc_uint16_from_config,
+         &default_warm_threads},
+        {(struct dc_setting *)settings->cpus, dc_options_set_string, "cpus",
+         required_argument, 'C', "CPUS", dc_string_from_string, "cpus",
+         dc_string_from_config, default_cpus},
+        {(struct dc_setting *)settings->incoming_cpu, dc_options_set_bool,
+         "incoming-cpu", no_argument, 'G', "INCOMING_CPU",
+         dc_flag_from_string, "incoming_cpu", dc_flag_from_config,
+         &default_incoming_cpu},
     };
 #pragma GCC diagnostic pop
 
@@ -320,7 +841,7 @@ static struct dc_application_settings *create_settings(
         dc_calloc(env, err, (sizeof(opts) / sizeof(struct options)) + 1,
                   sizeof(struct options));
     dc_memcpy(env, settings->opts.opts, opts, sizeof(opts));
-    settings->opts.flags = "c:vh:i:p:f";
+    settings->opts.flags = "c:vh:i:p:fn:t:I:H:B:b:m:q:r:a:R:US:w:P:D:W:Y:M:K:F:O:T:C:G";
     settings->opts.env_prefix = "iBeaconServer";
 
     return (struct dc_application_settings *)settings;
@@ -337,6 +858,31 @@ static int destroy_settings(const struct dc_posix_env *env,
     dc_setting_string_destroy(env, &app_settings->hostname);
     dc_setting_uint16_destroy(env, &app_settings->port);
     dc_setting_string_destroy(env, &app_settings->dbLoc);
+    dc_setting_uint16_destroy(env, &app_settings->pool_size);
+    dc_setting_string_destroy(env, &app_settings->trace_file);
+    dc_setting_string_destroy(env, &app_settings->idle_timeout);
+    dc_setting_string_destroy(env, &app_settings->header_timeout);
+    dc_setting_string_destroy(env, &app_settings->body_timeout);
+    dc_setting_uint16_destroy(env, &app_settings->backlog);
+    dc_setting_uint16_destroy(env, &app_settings->max_connections);
+    dc_setting_uint16_destroy(env, &app_settings->max_queued);
+    dc_setting_uint16_destroy(env, &app_settings->max_requests);
+    dc_setting_uint16_destroy(env, &app_settings->max_bulk_reads);
+    dc_setting_uint16_destroy(env, &app_settings->retry_after);
+    dc_setting_bool_destroy(env, &app_settings->io_uring);
+    dc_setting_string_destroy(env, &app_settings->static_dir);
+    dc_setting_uint16_destroy(env, &app_settings->max_watchers);
+    dc_setting_uint16_destroy(env, &app_settings->ingest_port);
+    dc_setting_uint16_destroy(env, &app_settings->ingest_udp_port);
+    dc_setting_string_destroy(env, &app_settings->wal);
+    dc_setting_string_destroy(env, &app_settings->wal_sync);
+    dc_setting_uint16_destroy(env, &app_settings->wal_batch_ms);
+    dc_setting_string_destroy(env, &app_settings->snapshot_dir);
+    dc_setting_string_destroy(env, &app_settings->follow);
+    dc_setting_uint16_destroy(env, &app_settings->follow_poll_ms);
+    dc_setting_uint16_destroy(env, &app_settings->warm_threads);
+    dc_setting_string_destroy(env, &app_settings->cpus);
+    dc_setting_bool_destroy(env, &app_settings->incoming_cpu);
     dc_free(env, app_settings->opts.opts, app_settings->opts.opts_size);
     dc_free(env, app_settings, sizeof(struct application_settings));
 
@@ -489,6 +1035,89 @@ static void do_bind(const struct dc_posix_env *env, struct dc_error *err,
                     app_settings->address->ai_addr, port);
 }
 
+/**
+ * @brief Opens a TCP socket on ingest_port and a UDP one on ingest_udp_port,
+ * whichever are set, and starts a listener serving them. Steered, the
+ * sockets share their ports with the other listeners' and take the packets
+ * received on cpu, and the listener's thread runs there.
+ *
+ * @param env
+ * @param err
+ * @param app_settings
+ * @param cpu -1 for no steering
+ */
+static void start_ingest(const struct dc_posix_env *env, struct dc_error *err,
+                         struct application_settings *app_settings, int cpu)
+{
+    struct ingest_listener *listener = NULL;
+    uint16_t ingestPort;
+    uint16_t ingestUdpPort;
+    int ingestFd = -1;
+    int udpFd = -1;
+
+    ingestPort = dc_setting_uint16_get(env, app_settings->ingest_port);
+    ingestUdpPort = dc_setting_uint16_get(env, app_settings->ingest_udp_port);
+    if (ingestPort && dc_error_has_no_error(err))
+    {
+        ingestFd = dc_network_create_socket(env, err, app_settings->address);
+        if (dc_error_has_no_error(err))
+        {
+            dc_network_opt_ip_so_reuse_addr(
+                env, err, ingestFd,
+                dc_setting_bool_get(env, app_settings->reuse_address));
+            if (cpu >= 0 && dc_error_has_no_error(err) &&
+                (!affinity_share_port(ingestFd) ||
+                 !affinity_steer(ingestFd, cpu)))
+            {
+                DC_ERROR_RAISE_USER(err, "Cannot steer ingestion", -1);
+            }
+            dc_network_bind(env, err, ingestFd, app_settings->address->ai_addr,
+                            ingestPort);
+            dc_network_listen(
+                env, err, ingestFd,
+                dc_setting_uint16_get(env, app_settings->backlog));
+        }
+    }
+    if (ingestUdpPort && dc_error_has_no_error(err))
+    {
+        udpFd = dc_socket(env, err, app_settings->address->ai_family,
+                          SOCK_DGRAM, 0);
+        if (cpu >= 0 && dc_error_has_no_error(err) &&
+            (!affinity_share_port(udpFd) || !affinity_steer(udpFd, cpu)))
+        {
+            DC_ERROR_RAISE_USER(err, "Cannot steer ingestion", -1);
+        }
+        if (dc_error_has_no_error(err))
+        {
+            dc_network_bind(env, err, udpFd, app_settings->address->ai_addr,
+                            ingestUdpPort);
+        }
+    }
+    if (dc_error_has_no_error(err))
+    {
+        listener = ingest_start(
+            env, ingestFd, udpFd, cpu, storeIngested,
+            dc_setting_string_get(env, app_settings->dbLoc));
+        if (listener == NULL)
+        {
+            DC_ERROR_RAISE_USER(err, "Cannot start binary ingestion", -1);
+        }
+    }
+    if (listener == NULL)
+    {
+        if (ingestFd >= 0)
+        {
+            close(ingestFd);
+        }
+        if (udpFd >= 0)
+        {
+            close(udpFd);
+        }
+        return;
+    }
+    ingest[ingestCount++] = listener;
+}
+
 static void do_listen(const struct dc_posix_env *env, struct dc_error *err,
                       void *arg)
 {
@@ -497,163 +1126,439 @@ static void do_listen(const struct dc_posix_env *env, struct dc_error *err,
 
     DC_TRACE(env);
     app_settings = arg;
-    backlog = 5;
+    backlog = dc_setting_uint16_get(env, app_settings->backlog);
     dc_network_listen(env, err, app_settings->server_socket_fd, backlog);
 }
 
-static void do_setup(const struct dc_posix_env *env,
-                     __attribute__((unused)) struct dc_error *err,
-                     __attribute__((unused)) void *arg)
-{
-    DC_TRACE(env);
-}
-
-static bool do_accept(const struct dc_posix_env *env, struct dc_error *err,
-                      int *client_socket_fd, void *arg)
+static void do_setup(const struct dc_posix_env *env, struct dc_error *err,
+                     void *arg)
 {
     struct application_settings *app_settings;
-    bool ret_val;
-    const char * dbLoc;
+    uint16_t pool_size;
+    uint16_t ingestPort;
+    uint16_t ingestUdpPort;
+    const char *dbLoc;
+    const char *walPath;
+    const char *primary;
+    enum wal_sync walSync;
+    struct replay replay;
+    uint16_t warmThreads;
+    uint64_t warmed = 0;
+    uint64_t started;
+    uint64_t phase;
+    uint64_t took[METRICS_STARTUP_COUNT] = {0};
+    size_t i;
+    const char *cpus;
+    int steered[INGEST_MAX_LISTENERS];
+    size_t steeredCount = 0;
+
     DC_TRACE(env);
     app_settings = arg;
-    ret_val = false;
-    *client_socket_fd =
-        dc_network_accept(env, err, app_settings->server_socket_fd);
-    dbLoc = dc_setting_string_get(env, app_settings->dbLoc);
+    started = metrics_now_ns();
 
-    if (dc_error_has_error(err))
+    // pinned before the pool, buffers and arenas are allocated, so they come
+    // from the node these CPUs are on
+    cpus = dc_setting_string_get(env, app_settings->cpus);
+    if (cpus)
     {
-        if (exit_signal == true && dc_error_is_errno(err, EINTR))
+        if (affinity_pin(cpus) < 0)
         {
-            ret_val = true;
+            DC_ERROR_RAISE_USER(err, "Cannot pin to cpus", -1);
+        }
+        else
+        {
+            affinity_prefer_local_node();
         }
     }
-    else
+    pool_size = dc_setting_uint16_get(env, app_settings->pool_size);
+    dbLoc = dc_setting_string_get(env, app_settings->dbLoc);
+    app_settings->pool = server_pool_create(env, err, pool_size, dbLoc);
+    if (app_settings->pool)
     {
-        startProcessingFSM(env, err, *client_socket_fd, dbLoc);
+        // milliseconds, a stalled client must not hold the serving thread
+        if (!parseTimeout(
+                dc_setting_string_get(env, app_settings->idle_timeout),
+                &app_settings->pool->timeouts.idle_ms) ||
+            !parseTimeout(
+                dc_setting_string_get(env, app_settings->header_timeout),
+                &app_settings->pool->timeouts.header_ms) ||
+            !parseTimeout(
+                dc_setting_string_get(env, app_settings->body_timeout),
+                &app_settings->pool->timeouts.body_ms))
+        {
+            DC_ERROR_RAISE_USER(err, "Invalid timeout", -1);
+        }
+        // shed load early rather than queue it, 0 lifts a limit
+        admission_init(&app_settings->pool->admission,
+                       dc_setting_uint16_get(env, app_settings->max_connections),
+                       dc_setting_uint16_get(env, app_settings->max_queued),
+                       dc_setting_uint16_get(env, app_settings->max_requests),
+                       dc_setting_uint16_get(env, app_settings->max_bulk_reads),
+                       dc_setting_uint16_get(env, app_settings->retry_after));
     }
 
-    return ret_val;
-}
+    phase = metrics_now_ns();
+    assets = static_assets_load(
+        dc_setting_string_get(env, app_settings->static_dir));
+    if (assets == NULL)
+    {
+        DC_ERROR_RAISE_USER(err, "Cannot load static assets", -1);
+    }
+    took[METRICS_STARTUP_ASSETS] = metrics_now_ns() - phase;
 
-static void do_shutdown(const struct dc_posix_env *env,
-                        __attribute__((unused)) struct dc_error *err,
-                        __attribute__((unused)) void *arg)
-{
-    DC_TRACE(env);
-}
+    feed = change_feed_create(
+        dc_setting_uint16_get(env, app_settings->max_watchers));
+    if (feed == NULL)
+    {
+        DC_ERROR_RAISE_USER(err, "Cannot create the change feed", -1);
+    }
 
-static void do_destroy_settings(const struct dc_posix_env *env,
-                                __attribute__((unused)) struct dc_error *err,
-                                void *arg)
-{
-    struct application_settings *app_settings;
+    // redo whatever the db lost, before anything can write
+    phase = metrics_now_ns();
+    replay.count = 0;
+    walPath = dc_setting_string_get(env, app_settings->wal);
+    if (walPath && dc_error_has_no_error(err))
+    {
+        if (!wal_parse_sync(dc_setting_string_get(env, app_settings->wal_sync),
+                            &walSync))
+        {
+            DC_ERROR_RAISE_USER(err, "Invalid wal_sync", -1);
+        }
+    }
+    if (walPath && dc_error_has_no_error(err))
+    {
+        replay.env = env;
+        replay.err = err;
+        replay.dbLoc = dbLoc;
+        wal = wal_open(walPath, walSync,
+                       dc_setting_uint16_get(env, app_settings->wal_batch_ms),
+                       replayBeacon, &replay);
+        if (wal == NULL && dc_error_has_no_error(err))
+        {
+            DC_ERROR_RAISE_USER(err, "Cannot replay the write-ahead log", -1);
+        }
+        // the replayed stores are in the db for good, the log can start over
+        else if (replay.count && db_sync(dbLoc))
+        {
+            wal_checkpoint(wal);
+        }
+    }
+    took[METRICS_STARTUP_WAL_REPLAY] = metrics_now_ns() - phase;
 
-    DC_TRACE(env);
+    // pull the db into the page cache while connections wait in the backlog,
+    // rather than serve the first of them at disk latency
+    phase = metrics_now_ns();
+    warmThreads = dc_setting_uint16_get(env, app_settings->warm_threads);
+    if (warmThreads && dc_error_has_no_error(err))
+    {
+        warmed = db_warm(dbLoc, warmThreads);
+    }
+    took[METRICS_STARTUP_WARM] = metrics_now_ns() - phase;
+
+    // gateways' binary frames, on the same address as HTTP; steered, a
+    // listener for each CPU takes the packets received on it, all storing to
+    // the one db
+    ingestPort = dc_setting_uint16_get(env, app_settings->ingest_port);
+    ingestUdpPort = dc_setting_uint16_get(env, app_settings->ingest_udp_port);
+    if (dc_setting_bool_get(env, app_settings->incoming_cpu))
+    {
+        steeredCount = affinity_cpus(steered, INGEST_MAX_LISTENERS);
+        if (steeredCount == 0 && dc_error_has_no_error(err))
+        {
+            DC_ERROR_RAISE_USER(err, "Cannot list the cpus to steer to", -1);
+        }
+    }
+    if ((ingestPort || ingestUdpPort) && steeredCount == 0)
+    {
+        start_ingest(env, err, app_settings, -1);
+    }
+    for (i = 0; (ingestPort || ingestUdpPort) && i < steeredCount; i++)
+    {
+        start_ingest(env, err, app_settings, steered[i]);
+    }
+
+    snapshotDir = dc_setting_string_get(env, app_settings->snapshot_dir);
+
+    // a follower's only writer is the primary's changelog
+    primary = dc_setting_string_get(env, app_settings->follow);
+    if (primary && ingestCount && dc_error_has_no_error(err))
+    {
+        DC_ERROR_RAISE_USER(err, "A follower cannot take ingestion", -1);
+    }
+    if (primary && dc_error_has_no_error(err))
+    {
+        follower = follow_start(
+            env, primary,
+            dc_setting_uint16_get(env, app_settings->follow_poll_ms),
+            storeIngested, dbLoc);
+        if (follower == NULL)
+        {
+            DC_ERROR_RAISE_USER(err, "Cannot follow the primary", -1);
+        }
+    }
+
+    // record FSM transitions, kill -USR1 writes them to trace_path
+    trace_path = dc_setting_string_get(env, app_settings->trace_file);
+    if (trace_path)
+    {
+        fsm_trace_enable(state_names,
+                         sizeof(state_names) / sizeof(state_names[0]));
+    }
+
+    // accepting starts once setup returns, so this is when the server is ready
+    took[METRICS_STARTUP_TOTAL] = metrics_now_ns() - started;
+    for (i = 0; i < METRICS_STARTUP_COUNT; i++)
+    {
+        metrics_startup((enum metrics_startup)i, took[i]);
+    }
+    if (dc_error_has_no_error(err))
+    {
+        printf("ready in %.1f ms: static assets %.1f ms, wal replay %.1f ms "
+               "(%zu records), warm-up %.1f ms (%" PRIu64
+               " bytes, %u threads)\n",
+               (double)took[METRICS_STARTUP_TOTAL] / 1e6,
+               (double)took[METRICS_STARTUP_ASSETS] / 1e6,
+               (double)took[METRICS_STARTUP_WAL_REPLAY] / 1e6, replay.count,
+               (double)took[METRICS_STARTUP_WARM] / 1e6, warmed,
+               (unsigned)warmThreads);
+        fflush(stdout);
+    }
+}
+
+static bool do_accept(const struct dc_posix_env *env, struct dc_error *err,
+                      int *client_socket_fd, void *arg)
+{
+    struct application_settings *app_settings;
+    bool ret_val;
+    DC_TRACE(env);
+    app_settings = arg;
+    ret_val = false;
+
+    // the io_uring backend takes over the listening socket until shutdown
+    if (!app_settings->io_uring_unavailable &&
+        dc_setting_bool_get(env, app_settings->io_uring))
+    {
+        if (uring_server_run(env, err, app_settings->pool,
+                             app_settings->server_socket_fd, serveRingRequest,
+                             &exit_signal) == 0)
+        {
+            *client_socket_fd = -1;
+            return true;
+        }
+        printf("io_uring unavailable (%s), using blocking I/O\n",
+               strerror(errno));
+        app_settings->io_uring_unavailable = true;
+    }
+
+    *client_socket_fd =
+        dc_network_accept(env, err, app_settings->server_socket_fd);
+
+    if (dc_error_has_error(err))
+    {
+        if (exit_signal == true && dc_error_is_errno(err, EINTR))
+        {
+            ret_val = true;
+        }
+    }
+    else if (admission_connection(&app_settings->pool->admission,
+                                  *client_socket_fd,
+                                  app_settings->server_socket_fd) !=
+             ADMISSION_ADMIT)
+    {
+        admission_reject_connection(&app_settings->pool->admission,
+                                    *client_socket_fd);
+        metrics_request(METRICS_ROUTE_UNMATCHED, SERVICE_UNAVAILABLE);
+        dc_close(env, err, *client_socket_fd);
+    }
+    else
+    {
+        startProcessingFSM(env, err, app_settings->pool, *client_socket_fd);
+        admission_connection_done(&app_settings->pool->admission);
+    }
+
+    return ret_val;
+}
+
+static void do_shutdown(const struct dc_posix_env *env,
+                        __attribute__((unused)) struct dc_error *err,
+                        void *arg)
+{
+    struct application_settings *app_settings;
+
+    DC_TRACE(env);
+    app_settings = arg;
+    follow_stop(&follower);
+    while (ingestCount > 0)
+    {
+        ingest_stop(&ingest[--ingestCount]);
+    }
+    server_pool_destroy(env, &app_settings->pool);
+    static_assets_destroy(&assets);
+    // ends the open watches
+    change_feed_destroy(&feed);
+    // nothing stores any more
+    wal_close(&wal);
+}
+
+static void do_destroy_settings(const struct dc_posix_env *env,
+                                __attribute__((unused)) struct dc_error *err,
+                                void *arg)
+{
+    struct application_settings *app_settings;
+
+    DC_TRACE(env);
     app_settings = arg;
     dc_freeaddrinfo(env, app_settings->address);
 }
 
 int startProcessingFSM(const struct dc_posix_env *env, struct dc_error *err,
-                       int client_socket_fd, const char *dbLoc)
+                       struct server_pool *pool, int client_socket_fd)
 {
     int ret_val;
-    struct dc_fsm_info *fsm_info;
+    struct server *server;
     static struct dc_fsm_transition transitions[] = {
         {DC_FSM_INIT, PROCESS, process},
         {PROCESS, GET_, get},
         {PROCESS, PUT_, put},
         {PROCESS, INVALID, invalid},
+        {PROCESS, DC_FSM_EXIT, NULL},
+        {GET_, PROCESS, process},
+        {PUT_, PROCESS, process},
         {GET_, DC_FSM_EXIT, NULL},
         {PUT_, DC_FSM_EXIT, NULL},
         {INVALID, DC_FSM_EXIT, NULL},
     };
 
     ret_val = EXIT_SUCCESS;
-    fsm_info = dc_fsm_info_create(env, err, "ProcessingFSM");
-    // dc_fsm_info_set_will_change_state(fsm_info, will_change_state);
-    // dc_fsm_info_set_did_change_state(fsm_info, did_change_state);
-    dc_fsm_info_set_bad_change_state(fsm_info, bad_change_state);
+    server = server_pool_checkout(env, err, pool, client_socket_fd);
 
-    if (dc_error_has_no_error(err))
+    if (server != NULL && dc_error_has_no_error(err))
     {
         int from_state;
         int to_state;
 
-        struct server *server =
-            (struct server *)dc_malloc(env, err, sizeof(struct server));
-        server->req.req_line = (struct request_line *)dc_malloc(
-            env, err, sizeof(struct request_line));
-        server->res.stat_line = (struct status_line *)dc_malloc(
-            env, err, sizeof(struct status_line));
-        server->client_socket_fd = client_socket_fd;
-        server->dbLoc = dbLoc;
-
-        ret_val = dc_fsm_run(env, err, fsm_info, &from_state, &to_state, server,
-                             transitions);
-        dc_fsm_info_destroy(env, &fsm_info);
-
-        freeServerStruct(server);
+        metrics_connection_opened();
+        if (fsm_trace_enabled())
+        {
+            fsm_trace_set_connection(fsm_trace_next_connection());
+        }
+        dc_fsm_info_set_will_change_state(server->fsm_info, will_change_state);
+        dc_fsm_info_set_did_change_state(server->fsm_info, did_change_state);
+        dc_fsm_info_set_bad_change_state(server->fsm_info, bad_change_state);
+        ret_val = dc_fsm_run(env, err, server->fsm_info, &from_state,
+                             &to_state, server, transitions);
+
+        server_pool_checkin(env, pool, server);
+        metrics_connection_closed();
     }
     else
     {
         printf("error");
+        dc_close(env, err, client_socket_fd);
     }
     return ret_val;
 }
 
-void freeServerStruct(struct server *server)
-{
-    free(server->req.req_line->HTTP_VER);
-    free(server->req.req_line->path);
-    free(server->req.req_line->req_method);
-    free(server->req.req_line);
-    free(server->req.message_body);
-
-    free(server->res.stat_line);
-
-    free(server);
-}
-
 int process(const struct dc_posix_env *env, struct dc_error *err, void *arg)
 {
     // display("process");
     struct server *server = (struct server *)arg;
-    int next_state;
-    char *request;
-    char *buffer;
+    int received;
 
     if (dc_error_has_error(err))
     {
         // some error handling
     }
 
-    // allocate max size for request
-    request = (char *)dc_calloc(env, err, MAX_REQUEST_SIZE, sizeof(char));
-    buffer = (char *)dc_malloc(env, err, 1024);
+    beginRequest(server);
 
     // read from client_socket_fd up to max size in request
-    if (receive_data(env, err, server->client_socket_fd, request,
-                                    MAX_REQUEST_SIZE) != 0)
+    received = receive_data(env, err, server->client_socket_fd,
+                            server->recv_buf, MAX_REQUEST_SIZE,
+                            server->timeouts);
+
+    return handleRequest(env, err, server, received);
+}
+
+void beginRequest(struct server *server)
+{
+    // everything request-scoped comes from the arena, released by
+    // finishRequest; the request line stays all NULL until one is parsed
+    server->req.req_line = (struct request_line *)arena_calloc(
+        server->arena, 1, sizeof(struct request_line));
+    server->req.keep_alive = false;
+    server->status = 0;
+    server->route = NULL;
+}
+
+int handleRequest(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server, int received)
+{
+    int next_state;
+    int method;
+    char *request = server->recv_buf;
+    enum admission_verdict verdict;
+
+    if (received == RECEIVE_TIMED_OUT && request[0] != '\0')
+    {
+        deliverTimeout(env, err, server);
+        return finishRequest(env, err, server);
+    }
+    if (received == RECEIVE_TOO_LARGE)
+    {
+        deliverTooLarge(env, err, server);
+        return finishRequest(env, err, server);
+    }
+    if (received != EXIT_SUCCESS && received != RECEIVE_TIMED_OUT)
     {
         next_state = INVALID;
         return next_state;
     }
 
+    // peer closed an idle keep-alive connection, or sat on it too long
+    if (request[0] == '\0')
+    {
+        if (!server->defer_io)
+        {
+            dc_close(env, err, server->client_socket_fd);
+        }
+        return DC_FSM_EXIT;
+    }
+
+    metrics_bytes(strlen(request), 0);
     printf("\n%s\n", request);
 
     // this will process the request and store in the server struct
-    process_request(request, &server->req);
-
-    free(request);
-    free(buffer);
+    process_request(request, &server->req, server->arena);
+    // the blocking backend serves one connection at a time, a client keeping
+    // its socket open would hold everyone else in the backlog; only the
+    // io_uring backend, which waits on every connection at once, keeps them
+    if (!server->defer_io)
+    {
+        server->req.keep_alive = false;
+    }
 
     // printf("\nREQ LINE\n%s\n%s\n%s\n",  server->req.req_line->req_method,
     // server->req.req_line->path, server->req.req_line->HTTP_VER);
     // printf("BODY\n%s\n", server->req.message_body);
-    if (strcmp(server->req.req_line->req_method, "GET") == 0)
+    method = parse_method(server->req.req_line->req_method);
+    server->route = route_lookup(method, server->req.req_line->path,
+                                 strlen(server->req.req_line->path));
+    if (method == GET || method == PUT)
+    {
+        server->admission_class = requestClass(server, method);
+        verdict = admission_request(server->admission, server->admission_class);
+        if (verdict != ADMISSION_ADMIT)
+        {
+            deliverOverload(env, err, server, verdict);
+            return finishRequest(env, err, server);
+        }
+        server->admitted = true;
+    }
+
+    if (method == GET)
         next_state = GET_;
-    else if (strcmp(server->req.req_line->req_method, "PUT") == 0)
+    else if (method == PUT)
         next_state = PUT_;
     else
         next_state = INVALID;
@@ -664,227 +1569,1141 @@ int process(const struct dc_posix_env *env, struct dc_error *err, void *arg)
 int get(const struct dc_posix_env *env, struct dc_error *err, void *arg)
 {
     struct server *server = (struct server *)arg;
-    int next_state;
-    char *val = (char *)calloc(1024, sizeof(char));
 
-    if (strstr(server->req.req_line->path, "all"))
+    dispatchRoute(env, err, server);
+
+    return finishRequest(env, err, server);
+}
+
+void dispatchRoute(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server)
+{
+    const struct static_asset *asset;
+
+    if (server->route)
+    {
+        server->route->handler(env, err, server);
+    }
+    else if (parse_method(server->req.req_line->req_method) == GET &&
+             (asset = static_assets_find(assets, server->req.req_line->path,
+                                         strlen(server->req.req_line->path))))
+    {
+        deliverAsset(env, err, server, asset);
+    }
+    else
     {
-        // get all
-        // some db_fetch call
-        db_fetch_all(env, err, val, server->dbLoc);
-        printf("%s\n", val);
+        deliverThe404(env, err, server);
+    }
+
+    if (dc_error_has_error(err))
+    {
+        display("error");
+    }
+}
+
+void getIndex(const struct dc_posix_env *env, struct dc_error *err,
+              struct server *server)
+{
+    deliverAsset(env, err, server, &assets->index);
+}
+
+void getBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server)
+{
+    char start[128];
+    char etag[DB_ETAG_SIZE];
+    const char *query = server->req.req_line->query;
+    struct form_iter iter;
+    struct form_field field;
+    struct http_body body;
+    enum http_coding coding;
+    char *key;
+    char *val;
 
-        char *start =
-            "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: ";
+    if (query == NULL)
+    {
+        deliverThe404(env, err, server);
+        return;
+    }
+
+    form_iter_init(&iter, query, strlen(query));
+    if (!form_next(&iter, &field))
+    {
+        deliverThe404(env, err, server);
+        return;
+    }
+
+    if (field.value == NULL && form_name_is(&field, "all"))
+    {
+        key = NULL;
+    }
+    // ?key=KEY, or the bare ?KEY the curses client sends
+    else if (field.value != NULL && form_name_is(&field, "key"))
+    {
+        key = (char *)arena_alloc(server->arena, field.value_len + 1);
+        form_decode(field.value, field.value_len, key);
+    }
+    else
+    {
+        key = (char *)arena_alloc(server->arena, field.name_len + 1);
+        form_decode(field.name, field.name_len, key);
+    }
+
+    // tagged before the fetch, a store in between only costs a full response
+    coding = key ? HTTP_CODING_IDENTITY : acceptedCoding(server);
+    pthread_rwlock_rdlock(&storeLock);
+    db_etag(key, etag);
+    pthread_rwlock_unlock(&storeLock);
+    http_coding_tag(etag, sizeof(etag), coding);
+    if (deliverNotModified(env, err, server, etag))
+    {
+        return;
+    }
+
+    if (key == NULL)
+    {
+        // streamed from the db through the compressor, never held raw
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nETag: "
+                 "%s\r\n",
+                 etag);
+        http_body_init(&body, server->arena, coding);
+        pthread_rwlock_rdlock(&storeLock);
+        db_fetch_all(env, err, appendBeacon, &body, server->dbLoc);
+        pthread_rwlock_unlock(&storeLock);
+        writeBodyToClient(env, err, server, start, &body);
+        return;
+    }
+
+    snprintf(start, sizeof(start),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nETag: "
+             "%s\r\nContent-Length: ",
+             etag);
+    val = (char *)arena_alloc(server->arena, BUFFER_SMALL_SIZE);
+    val[0] = '\0';
+
+    pthread_rwlock_rdlock(&storeLock);
+    db_fetch(env, err, key, val, server->dbLoc);
+    pthread_rwlock_unlock(&storeLock);
+    if (strstr(val, "Not found"))
+    {
+        deliverThe404(env, err, server);
+    }
+    else
+    {
         writeValToClient(env, err, server, start, val);
-        
     }
-    else if (strstr(server->req.req_line->path, "?"))
+}
+
+void getMetrics(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server)
+{
+    const char *head = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; "
+                       "version=0.0.4\r\n";
+    const char *routeNames[METRICS_MAX_ROUTES] = {NULL};
+    struct http_body encoded;
+    size_t routeCount = (size_t)route_table_mask + 1;
+    size_t cap = MAX_REQUEST_SIZE;
+    size_t len;
+    size_t i;
+    char *label;
+    char *body;
+
+    if (routeCount > METRICS_MAX_ROUTES)
+    {
+        routeCount = METRICS_MAX_ROUTES;
+    }
+    for (i = 0; i < routeCount; i++)
     {
-        // get by id
-        // construct id
-        // display("get by id");
-        char *path = strdup(server->req.req_line->path);
-        char *key;
+        if (route_table[i].path)
+        {
+            label = (char *)arena_alloc(server->arena,
+                                        route_table[i].path_len + 8);
+            sprintf(label, "%s %s", method_name((int)route_table[i].method),
+                    route_table[i].path);
+            routeNames[i] = label;
+        }
+    }
 
-        // extract_key(path, key, "?")
-        key = strtok(path, "?");  // returns piece before "?"
-        key = strtok(NULL, " ");  // NOW we have key. strtok is weird
+    body = (char *)arena_alloc(server->arena, cap);
+    len = metrics_render(body, cap, routeNames, routeCount);
+    if (len >= cap)
+    {
+        // other threads keep counting between the two passes, leave headroom
+        cap = len + 1024;
+        body = (char *)arena_alloc(server->arena, cap);
+        metrics_render(body, cap, routeNames, routeCount);
+    }
 
-        // printf("%s\n", key);
+    // scrapers ask for gzip, the label-heavy text shrinks several times
+    http_body_init(&encoded, server->arena, acceptedCoding(server));
+    http_body_append(&encoded, body, strlen(body));
+    writeBodyToClient(env, err, server, head, &encoded);
+}
 
-        db_fetch(env, err, key, val, server->dbLoc);
-        // printf("val returned from db: %s\n", val);
-        if (strstr(val, "Not found")) {
-            deliverThe404(server);
+void getTrace(const struct dc_posix_env *env, struct dc_error *err,
+              struct server *server)
+{
+    const char *head = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\n"
+                       "Connection: close\r\n\r\n";
+    FILE *dump;
+    char chunk[4096];
+    size_t count;
+
+    // the dump is streamed without a length, so the close ends the body
+    server->req.keep_alive = false;
+    server->status = 200;
+    queueResponse(env, err, server, head, strlen(head));
+    if (server->defer_io)
+    {
+        // there is no fd to stream to, collect the dump for the backend
+        dump = tmpfile();
+        if (dump && fsm_trace_dump(fileno(dump)) == 0)
+        {
+            rewind(dump);
+            while ((count = fread(chunk, 1, sizeof(chunk), dump)) > 0)
+            {
+                queueResponse(env, err, server, chunk, count);
+            }
         }
-        else {
-            char *start =
-            "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: ";
-            writeValToClient(env, err, server, start, val);
+        if (dump)
+        {
+            fclose(dump);
         }
-        
-        free(path);
+        return;
     }
-    else if (strcmp(server->req.req_line->path, "/") == 0 ||
-             strcmp(server->req.req_line->path, "/index") == 0 ||
-             strcmp(server->req.req_line->path, "/index.html") == 0)
+    flushResponse(env, err, server);
+    if (dc_error_has_no_error(err))
     {
-        char *start =
-            "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: ";
-        char *val = "Welcome to the Beacon Server ";
-        writeValToClient(env, err, server, start, val);
+        fsm_trace_dump(server->client_socket_fd);
     }
-    else
+}
+
+void putSnapshot(const struct dc_posix_env *env, struct dc_error *err,
+                 struct server *server)
+{
+    char start[160];
+    char result[PATH_MAX + 32];
+    char tmpPath[PATH_MAX];
+    char path[PATH_MAX];
+    uint64_t seq;
+    bool cloneless;
+    bool exists = false;
+    bool ok;
+
+    if (snapshotDir == NULL)
     {
-        deliverThe404(server);
+        deliverThe404(env, err, server);
+        return;
+    }
+    if (pthread_mutex_trylock(&snapshotLock) != 0)
+    {
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 %d Conflict\r\nContent-Type: "
+                 "text/plain\r\nContent-Length: ",
+                 CONFLICT);
+        writeValToClient(env, err, server, start,
+                         "409 Conflict: a snapshot is running\n");
+        return;
     }
 
-    if (dc_error_has_no_error(err))
+    // the fence: stores wait while the files are cloned, reads go on, and the
+    // copy is the db as of seq
+    snprintf(tmpPath, sizeof(tmpPath), "%s/.snapshot", snapshotDir);
+    pthread_rwlock_rdlock(&storeLock);
+    ok = db_copy(server->dbLoc, tmpPath, true);
+    cloneless = !ok && errno == EOPNOTSUPP;
+    seq = change_feed_seq(feed);
+    pthread_rwlock_unlock(&storeLock);
+
+    // without reflinks the files are copied as of seq while stores go on to
+    // the log and are held in memory, then the held ones are written to the
+    // files; stores only wait for that, not for the copy
+    if (cloneless && wal)
+    {
+        pthread_rwlock_wrlock(&storeLock);
+        walPinned = db_hold(server->dbLoc);
+        seq = change_feed_seq(feed);
+        pthread_rwlock_unlock(&storeLock);
+
+        ok = walPinned && db_copy(server->dbLoc, tmpPath, false);
+
+        pthread_rwlock_wrlock(&storeLock);
+        db_release(env, err, server->dbLoc);
+        walPinned = false;
+        pthread_rwlock_unlock(&storeLock);
+        // the snapshot fails with the held stores, as a PUT with its store
+        ok = ok && dc_error_has_no_error(err);
+        dc_error_reset(err);
+        cloneless = false;
+    }
+
+    // with no stores in between, or after a clock step, seq can repeat
+    snprintf(path, sizeof(path), "%s/beacons-%" PRIu64, snapshotDir, seq);
+    if (ok && db_exists(path))
+    {
+        exists = true;
+        ok = false;
+    }
+    ok = ok && db_sync(tmpPath) && db_rename(tmpPath, path);
+    pthread_mutex_unlock(&snapshotLock);
+    if (cloneless)
+    {
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 %d Not Implemented\r\nContent-Type: "
+                 "text/plain\r\nContent-Length: ",
+                 NOT_IMPLEMENTED);
+        writeValToClient(env, err, server, start,
+                         "501 Not Implemented: the db cannot be cloned here, "
+                         "a copy needs --wal\n");
+        return;
+    }
+    if (exists)
+    {
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 %d Conflict\r\nContent-Type: "
+                 "text/plain\r\nContent-Length: ",
+                 CONFLICT);
+        snprintf(result, sizeof(result), "409 Conflict: %s exists\n", path);
+        writeValToClient(env, err, server, start, result);
+        return;
+    }
+    if (!ok)
+    {
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 %d Service Unavailable\r\nContent-Type: "
+                 "text/plain\r\nContent-Length: ",
+                 SERVICE_UNAVAILABLE);
+        writeValToClient(env, err, server, start,
+                         "503 Service Unavailable: snapshot failed\n");
+        return;
+    }
+
+    snprintf(start, sizeof(start),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nX-Change-Seq: "
+             "%" PRIu64 "\r\nContent-Length: ",
+             seq);
+    snprintf(result, sizeof(result), "%s\n", path);
+    writeValToClient(env, err, server, start, result);
+}
+
+int finishRequest(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server)
+{
+    flushResponse(env, err, server);
+    // a deferred response may live in the arena until the backend sends it
+    if (!server->defer_io)
+    {
+        arena_reset(server->arena);
+    }
+    if (server->admitted)
+    {
+        admission_request_done(server->admission, server->admission_class);
+        server->admitted = false;
+    }
+    metrics_request(server->route ? (size_t)(server->route - route_table)
+                                  : METRICS_ROUTE_UNMATCHED,
+                    server->status);
+
+    if (server->req.keep_alive && dc_error_has_no_error(err))
+    {
+        return PROCESS;
+    }
+
+    if (dc_error_has_no_error(err) && !server->defer_io)
     {
         dc_close(env, err, server->client_socket_fd);
     }
-    else {
-        display("error");
+
+    return DC_FSM_EXIT;
+}
+
+const char *connectionHeader(const struct server *server)
+{
+    return server->req.keep_alive ? "Connection: keep-alive\r\n"
+                                  : "Connection: close\r\n";
+}
+
+bool serveRingRequest(const struct dc_posix_env *env, struct dc_error *err,
+                      struct server *server, int received)
+{
+    static int (*const actions[])(const struct dc_posix_env *,
+                                  struct dc_error *, void *) = {
+        [GET_ - GET_] = get,
+        [PUT_ - GET_] = put,
+        [INVALID - GET_] = invalid,
+    };
+    int from = PROCESS;
+    int to = PROCESS;
+    int next;
+
+    beginRequest(server);
+    do
+    {
+        will_change_state(env, err, server->fsm_info, from, to);
+        next = to == PROCESS ? handleRequest(env, err, server, received)
+                             : actions[to - GET_](env, err, server);
+        did_change_state(env, err, server->fsm_info, from, to, next);
+        from = to;
+        to = next;
+    } while (to >= GET_ && to <= INVALID);
+
+    return to == PROCESS;
+}
+
+void deliverAsset(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server, const struct static_asset *asset)
+{
+    int keep = server->req.keep_alive;
+    const char *match;
+    size_t matchLen;
+    off_t offset = 0;
+    ssize_t sent;
+
+    matchLen = asset->status == 200
+                   ? find_header(server->req.headers, "If-None-Match", &match)
+                   : 0;
+    if (matchLen && etag_matches(match, matchLen, asset->etag))
+    {
+        server->status = 304;
+        queueResponse(env, err, server, asset->not_modified[keep],
+                      asset->not_modified_len[keep]);
+        return;
     }
 
-    free(val);
-    next_state = DC_FSM_EXIT;
-    return next_state;
+    server->status = asset->status;
+    queueResponse(env, err, server, asset->response[keep],
+                  asset->response_len[keep]);
+    if (!static_asset_is_large(asset))
+    {
+        return;
+    }
+    if (server->defer_io)
+    {
+        // sent from the mapping once the headers in out are gone
+        server->out_ref = asset->body;
+        server->out_ref_len = asset->body_len;
+        return;
+    }
+
+    flushResponse(env, err, server);
+#if defined(__linux__)
+    while (dc_error_has_no_error(err) && (size_t)offset < asset->body_len)
+    {
+        sent = sendfile(server->client_socket_fd, asset->fd, &offset,
+                        asset->body_len - (size_t)offset);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            // the client got part of the body, only a close can tell it
+            server->req.keep_alive = false;
+            break;
+        }
+        metrics_bytes(0, (size_t)sent);
+    }
+#else
+    (void)offset;
+    (void)sent;
+    dc_write(env, err, server->client_socket_fd, asset->body, asset->body_len);
+    metrics_bytes(0, asset->body_len);
+#endif
 }
 
-void deliverThe404(struct server *server) {
-    char *response = (char *)calloc(2048, sizeof(char));
-    char *start = "HTTP/1.0 404 Not Found\r\nContent-Type: text/html\r\nContent-Length: ";
-    char * html404 = "<!DOCTYPE html><html><head><title>Hey, 404 Not Found</title></head><body><p>404 Not Found: Don't do that.</p></body></html>";
-    sprintf(response, "%s%d\r\n\r\n%s", start, strlen(html404), html404);
-    write(STDOUT_FILENO, response,
-        strlen(response));
-    write(server->client_socket_fd, response,
-                strlen(response));
+enum http_coding acceptedCoding(const struct server *server)
+{
+    const char *accept;
+    size_t acceptLen;
+
+    acceptLen = find_header(server->req.headers, "Accept-Encoding", &accept);
+
+    return http_coding_negotiate(acceptLen ? accept : NULL, acceptLen);
+}
+
+bool appendBeacon(void *arg, const char *key, size_t keyLen, const char *val,
+                  size_t valLen)
+{
+    struct http_body *body = (struct http_body *)arg;
+
+    return http_body_append(body, key, keyLen) &&
+           http_body_append(body, " : ", 3) &&
+           http_body_append(body, val, valLen) &&
+           http_body_append(body, "\n", 1);
+}
+
+bool appendRecord(void *arg, const char *key, size_t keyLen, const char *val,
+                  size_t valLen)
+{
+    struct http_body *body = (struct http_body *)arg;
+    uint8_t header[INGEST_RECORD_HEADER_SIZE];
+
+    header[0] = (uint8_t)(keyLen >> 8);
+    header[1] = (uint8_t)keyLen;
+    header[2] = (uint8_t)(valLen >> 8);
+    header[3] = (uint8_t)valLen;
+
+    return keyLen <= UINT16_MAX && valLen <= UINT16_MAX &&
+           http_body_append(body, (const char *)header, sizeof(header)) &&
+           http_body_append(body, key, keyLen) &&
+           http_body_append(body, val, valLen);
+}
+
+void writeBodyToClient(const struct dc_posix_env *env, struct dc_error *err,
+                       struct server *server, const char *head,
+                       struct http_body *body)
+{
+    const char *errStart =
+        "HTTP/1.0 500 Internal Server Error\r\nContent-Type: "
+        "text/plain\r\nContent-Length: ";
+    const char *coding;
+    char entity[128];
+    int entityLen;
+
+    if (!http_body_finish(body))
+    {
+        writeValToClient(env, err, server, errStart,
+                         "500 Internal Server Error\n");
+        return;
+    }
+
+    coding = http_coding_name(body->coding);
+    entityLen = snprintf(entity, sizeof(entity),
+                         "Vary: Accept-Encoding\r\n%s%s%sContent-Length: "
+                         "%zu\r\n%s\r\n",
+                         coding ? "Content-Encoding: " : "", coding ? coding : "",
+                         coding ? "\r\n" : "", body->len,
+                         connectionHeader(server));
+    server->status = (int)strtol(head + sizeof("HTTP/1.0"), NULL, 10);
+    queueResponse(env, err, server, head, strlen(head));
+    queueResponse(env, err, server, entity, (size_t)entityLen);
+    if (body->len)
+    {
+        queueResponse(env, err, server, body->data, body->len);
+    }
+}
+
+bool deliverNotModified(const struct dc_posix_env *env, struct dc_error *err,
+                        struct server *server, const char *etag)
+{
+    char head[128];
+    const char *match;
+    size_t matchLen;
+    int len;
+
+    matchLen = find_header(server->req.headers, "If-None-Match", &match);
+    if (matchLen == 0 || !etag_matches(match, matchLen, etag))
+    {
+        return false;
+    }
+
+    server->status = NOT_MODIFIED;
+    len = snprintf(head, sizeof(head),
+                   "HTTP/1.0 %d Not Modified\r\nETag: %s\r\n%s\r\n",
+                   NOT_MODIFIED, etag, connectionHeader(server));
+    queueResponse(env, err, server, head, (size_t)len);
+
+    return true;
+}
+
+void deliverThe404(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server) {
+    deliverAsset(env, err, server, &assets->not_found);
+}
+
+void queueResponse(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server, const char *data, size_t len)
+{
+    size_t cap;
+    char *grown;
+
+    if (len <= server->out_cap - server->out_len)
+    {
+        memcpy(server->out + server->out_len, data, len);
+        server->out_len += len;
+    }
+    else if (server->defer_io)
+    {
+        // nothing may be written yet, grow the response into the arena
+        cap = (server->out_len + len) * 2;
+        grown = (char *)arena_alloc(server->arena, cap);
+        if (grown == NULL)
+        {
+            return;
+        }
+        memcpy(grown, server->out, server->out_len);
+        if (server->out_pooled == NULL)
+        {
+            server->out_pooled = server->out;
+        }
+        server->out = grown;
+        server->out_cap = cap;
+        memcpy(server->out + server->out_len, data, len);
+        server->out_len += len;
+    }
+    else
+    {
+        flushResponse(env, err, server);
+        dc_write(env, err, STDOUT_FILENO, data, len);
+        dc_write(env, err, server->client_socket_fd, data, len);
+        metrics_bytes(0, len);
+    }
+}
 
-    free(response);
+void flushResponse(const struct dc_posix_env *env, struct dc_error *err,
+                   struct server *server)
+{
+    if (server->out_len > 0 && !server->defer_io)
+    {
+        dc_write(env, err, STDOUT_FILENO, server->out, server->out_len);
+        dc_write(env, err, server->client_socket_fd, server->out,
+                 server->out_len);
+        metrics_bytes(0, server->out_len);
+        server->out_len = 0;
+    }
 }
 
 void writeValToClient(const struct dc_posix_env *env, struct dc_error *err,
-                      struct server *server, char *start, char *val)
+                      struct server *server, const char *start,
+                      const char *val)
 {
     if (val)
     {
-        char *response = (char *)calloc(MAX_REQUEST_SIZE, sizeof(char));
-        sprintf(response, "%s%d\r\n\r\n%s", start, strlen(val), val);
-        dc_write(env, err, STDOUT_FILENO, response,
-            strlen(response));
-        dc_write(env, err, server->client_socket_fd, response,
-                 strlen(response));
-        free(response);
+        size_t valLen = strlen(val);
+        char lengthLine[64];
+        int lengthLen;
+
+        // start is "HTTP/1.x NNN ...", keep the status for the request metrics
+        server->status = (int)strtol(start + sizeof("HTTP/1.0"), NULL, 10);
+        // start ends with "Content-Length: ", slot the connection header after
+        lengthLen = snprintf(lengthLine, sizeof(lengthLine), "%zu\r\n%s\r\n",
+                             valLen, connectionHeader(server));
+        queueResponse(env, err, server, start, strlen(start));
+        queueResponse(env, err, server, lengthLine, (size_t)lengthLen);
+        queueResponse(env, err, server, val, valLen);
     }
 }
 
 int put(const struct dc_posix_env *env, struct dc_error *err, void *arg)
 {
     struct server *server = (struct server *)arg;
-    int next_state;
-    char *putBody = strdup(server->req.message_body);
+
+    dispatchRoute(env, err, server);
+
+    return finishRequest(env, err, server);
+}
+
+void putBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server)
+{
+    const char *putBody = server->req.message_body;
+    struct form_iter iter;
+    struct form_field valField;
+    struct form_field keyField;
+    char start[128];
     char *key;
     char *val;
-    const char *response =
-        "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: "
-        "13\r\n\r\nPUT Complete\n";
-    const char *badResponse =
+    size_t keyLen;
+    size_t valLen;
+    struct ingest_record beacon;
+    uint64_t seq;
+    const char *badStart =
         "HTTP/1.0 400 Bad Request\r\nContent-Type: "
-        "text/plain\r\nContent-Length: 16\r\n\r\n400 Bad Request\n";
+        "text/plain\r\nContent-Length: ";
 
-    // attempt at failure handling
-    if (!strstr(putBody, "="))
+    if (follower)
     {
-        dc_write(env, err, server->client_socket_fd, badResponse,
-                 strlen(badResponse));
-                 free(putBody);
-        return DC_FSM_EXIT;
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 %d Method Not Allowed\r\nAllow: GET\r\n"
+                 "Content-Type: text/plain\r\nContent-Length: ",
+                 METHOD_NOT_ALLOWED);
+        writeValToClient(env, err, server, start,
+                         "405 Method Not Allowed: read-only follower\n");
+        return;
     }
 
-    // TODO: protect against seg fault from improperly formatted PUT
-    // extract_key(path, key, "?")
-    val = strtok(putBody, "=");  // returns piece before "?"
-    val = strtok(NULL, "&");     // now we have key. strtok is weird
-    key = strtok(NULL, "=");
-    key = strtok(NULL, "&");
+    // body is "<name>=VALUE&<name>=KEY", anything else is a bad request
+    form_iter_init(&iter, putBody, strlen(putBody));
+    if (!form_next(&iter, &valField) || !form_next(&iter, &keyField) ||
+        valField.value == NULL || keyField.value == NULL)
+    {
+        writeValToClient(env, err, server, badStart, "400 Bad Request\n");
+        return;
+    }
 
-    db_store(env, err, key, val, server->dbLoc);
+    val = (char *)arena_alloc(server->arena, valField.value_len + 1);
+    valLen = form_decode(valField.value, valField.value_len, val);
+    key = (char *)arena_alloc(server->arena, keyField.value_len + 1);
+    keyLen = form_decode(keyField.value, keyField.value_len, key);
 
-    dc_write(env, err, server->client_socket_fd, response, strlen(response));
+    // the db keeps C strings, a decoded NUL would cut the pair short;
+    // ingestion refuses the same records
+    if (keyLen == 0 || strlen(key) != keyLen || strlen(val) != valLen)
+    {
+        writeValToClient(env, err, server, badStart, "400 Bad Request\n");
+        return;
+    }
 
-    if (dc_error_has_no_error(err))
+    // the same limit as ingestion, so a GET can always send the pair back
+    if (keyLen + valLen > INGEST_MAX_RECORD)
     {
-        dc_close(env, err, server->client_socket_fd);
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 %d Payload Too Large\r\nContent-Type: "
+                 "text/plain\r\nContent-Length: ",
+                 PAYLOAD_TOO_LARGE);
+        writeValToClient(env, err, server, start, "413 Payload Too Large\n");
+        return;
     }
 
-    free(putBody);
-    next_state = DC_FSM_EXIT;
-    return next_state;
+    beacon.key = key;
+    beacon.value = val;
+    storeBeacons(env, err, server->dbLoc, &beacon, 1, &seq);
+
+    // the client can sync from its own write on
+    snprintf(start, sizeof(start),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nX-Change-Seq: "
+             "%" PRIu64 "\r\nContent-Length: ",
+             seq);
+    writeValToClient(env, err, server, start, "PUT Complete\n");
 }
 
-int invalid(const struct dc_posix_env *env, struct dc_error *err, void *arg)
+size_t storeBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                    const char *dbLoc, const struct ingest_record *records,
+                    size_t count, uint64_t *seq)
 {
-    struct server *server = (struct server *)arg;
-    int next_state;
-    const char *basicHTTPMessage =
-        "HTTP/1.0 400 Bad Request\r\nContent-Type: "
-        "text/plain\r\nContent-Length: 16\r\n\r\n400 Bad Request\n";
+    size_t stored = 0;
+    size_t logged = count;
 
-    dc_write(env, err, server->client_socket_fd, basicHTTPMessage,
-             strlen(basicHTTPMessage));
+    *seq = 0;
+    // one lock for the batch, its changes stay together in the changelog
+    pthread_rwlock_wrlock(&storeLock);
+    if (wal)
+    {
+        // one write, and under always one sync, for the whole batch
+        logged = 0;
+        while (logged < count &&
+               wal_append(wal, records[logged].key, records[logged].value))
+        {
+            logged++;
+        }
+        if (!wal_commit(wal))
+        {
+            logged = 0;
+        }
+    }
 
-    if (dc_error_has_no_error(err))
+    // only what is in the log goes into the db
+    while (stored < logged)
     {
-        dc_close(env, err, server->client_socket_fd);
+        db_store(env, err, records[stored].key, records[stored].value, dbLoc);
+        if (dc_error_has_error(err))
+        {
+            break;
+        }
+        *seq = change_feed_publish(feed, records[stored].key,
+                                   records[stored].value);
+        stored++;
     }
 
-    next_state = DC_FSM_EXIT;
-    return next_state;
+    if (logged < count && dc_error_has_no_error(err))
+    {
+        DC_ERROR_RAISE_USER(err, "Cannot write the write-ahead log", -1);
+    }
+
+    // once the db is on disk its stores need no redoing
+    if (wal && !walPinned && wal_size(wal) > WAL_CHECKPOINT_BYTES &&
+        db_sync(dbLoc))
+    {
+        wal_checkpoint(wal);
+    }
+    pthread_rwlock_unlock(&storeLock);
+
+    return stored;
+}
+
+size_t storeIngested(const struct dc_posix_env *env, struct dc_error *err,
+                     const void *arg, const struct ingest_record *records,
+                     size_t count)
+{
+    uint64_t seq;
+
+    return storeBeacons(env, err, (const char *)arg, records, count, &seq);
+}
+
+bool replayBeacon(void *arg, const char *key, const char *value)
+{
+    struct replay *replay = (struct replay *)arg;
+
+    db_store(replay->env, replay->err, key, value, replay->dbLoc);
+    replay->count++;
+
+    return dc_error_has_no_error(replay->err);
+}
+
+void getChanges(const struct dc_posix_env *env, struct dc_error *err,
+                struct server *server)
+{
+    char start[160];
+    const char *query = server->req.req_line->query;
+    struct change **changes = NULL;
+    struct form_iter iter;
+    struct form_field field;
+    struct http_body body;
+    const char *sync;
+    const char *type = "text/plain";
+    db_visitor append = appendBeacon;
+    uint64_t since = 0;
+    uint64_t seq;
+    bool haveSince = false;
+    char *end;
+    int taken = CHANGE_FEED_GONE;
+    int i;
+
+    if (query)
+    {
+        form_iter_init(&iter, query, strlen(query));
+        while (form_next(&iter, &field))
+        {
+            if (field.value && field.value_len &&
+                form_name_is(&field, "since"))
+            {
+                since = strtoull(field.value, &end, 10);
+                haveSince = end == field.value + field.value_len;
+            }
+            // what followers ask for, any key or value survives it
+            else if (field.value && form_name_is(&field, "format") &&
+                     field.value_len == 6 &&
+                     strncmp(field.value, "binary", 6) == 0)
+            {
+                append = appendRecord;
+                type = "application/octet-stream";
+            }
+        }
+    }
+
+    http_body_init(&body, server->arena, acceptedCoding(server));
+    if (haveSince)
+    {
+        changes = (struct change **)arena_alloc(
+            server->arena, CHANGE_FEED_LOG * sizeof(struct change *));
+    }
+    if (changes)
+    {
+        taken = change_feed_since(feed, since, changes, CHANGE_FEED_LOG, &seq);
+    }
+
+    if (taken == CHANGE_FEED_GONE)
+    {
+        // numbered and walked with stores held off, the snapshot is the db
+        // as of seq
+        pthread_rwlock_rdlock(&storeLock);
+        seq = change_feed_seq(feed);
+        db_fetch_all(env, err, append, &body, server->dbLoc);
+        pthread_rwlock_unlock(&storeLock);
+        sync = "snapshot";
+    }
+    else
+    {
+        // oldest first, applied in order they leave the consumer current
+        for (i = 0; i < taken; i++)
+        {
+            append(&body, changes[i]->key, changes[i]->key_len,
+                   changes[i]->value, changes[i]->value_len);
+            change_release(changes[i]);
+        }
+        sync = "delta";
+    }
+
+    snprintf(start, sizeof(start),
+             "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nX-Change-Seq: "
+             "%" PRIu64 "\r\nX-Change-Sync: %s\r\n",
+             type, seq, sync);
+    writeBodyToClient(env, err, server, start, &body);
+}
+
+void watchBeacons(const struct dc_posix_env *env, struct dc_error *err,
+                  struct server *server)
+{
+    const char *query = server->req.req_line->query;
+    struct change_subscriber *sub;
+    struct form_iter iter;
+    struct form_field field;
+    const char *prefix = "";
+    char *decoded;
+    char *end;
+    long major = -1;
+    int fd;
+
+    if (query)
+    {
+        form_iter_init(&iter, query, strlen(query));
+        while (form_next(&iter, &field))
+        {
+            if (field.value && form_name_is(&field, "prefix"))
+            {
+                decoded =
+                    (char *)arena_alloc(server->arena, field.value_len + 1);
+                form_decode(field.value, field.value_len, decoded);
+                prefix = decoded;
+            }
+            else if (field.value && field.value_len &&
+                     form_name_is(&field, "major"))
+            {
+                major = strtol(field.value, &end, 10);
+                if (end != field.value + field.value_len || major < 0)
+                {
+                    major = -1;
+                }
+            }
+        }
+    }
+
+    sub = change_feed_subscribe(feed, prefix, strlen(prefix), major);
+    if (sub == NULL)
+    {
+        deliverOverload(env, err, server, ADMISSION_OVERLOADED);
+        return;
+    }
+
+    // the stream gets its own thread and its own copy of the socket, the
+    // backend closes its copy once this returns with nothing queued
+    fd = dup(server->client_socket_fd);
+    if (fd < 0 || !watch_start(sub, fd))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        change_feed_unsubscribe(sub);
+        deliverOverload(env, err, server, ADMISSION_OVERLOADED);
+        return;
+    }
+
+    server->status = OK;
+    server->req.keep_alive = false;
+}
+
+int invalid(const struct dc_posix_env *env, struct dc_error *err, void *arg)
+{
+    struct server *server = (struct server *)arg;
+    const char *badStart =
+        "HTTP/1.0 400 Bad Request\r\nContent-Type: "
+        "text/plain\r\nContent-Length: ";
+
+    // never trust the framing of a request we could not parse
+    server->req.keep_alive = false;
+    writeValToClient(env, err, server, badStart, "400 Bad Request\n");
+
+    return finishRequest(env, err, server);
 }
 
 int receive_data(const struct dc_posix_env *env, struct dc_error *err, int fd,
-                 char *dest, size_t bufSize)
+                 char *dest, size_t bufSize,
+                 const struct server_timeouts *timeouts)
 {
     ssize_t count;
     ssize_t totalWritten = 0;
+    ssize_t scanned = 0;
     const char *endOfHeadersDelimiter = "\r\n\r\n";
-    char *endOfHeaders;
+    const char *endOfHeaders;
     ssize_t spaceInDest;
-    int totalLength = MAX_REQUEST_SIZE;
-    int contentLength;
+    size_t totalLength = MAX_REQUEST_SIZE;
+    size_t headerLength;
+    size_t contentLength;
     bool foundEndOfHeaders = false;
+    uint64_t deadline = phaseDeadline(timeouts->idle_ms);
 
-    while (totalWritten < totalLength &&
-           ((count = dc_read(env, err, fd, dest + totalWritten, bufSize)) != 0))
+    dest[0] = '\0';
+    while ((size_t)totalWritten < totalLength)
     {
         // check space remaining. if going over, abort.
-        spaceInDest = MAX_REQUEST_SIZE - 1 - totalWritten;
-        if (count > spaceInDest)
+        spaceInDest = (ssize_t)bufSize - 1 - totalWritten;
+        if (spaceInDest <= 0)
+        {
+            return EXIT_FAILURE;
+        }
+
+        if (!waitForData(fd, deadline))
+        {
+            return RECEIVE_TIMED_OUT;
+        }
+        count = dc_read(env, err, fd, dest + totalWritten, (size_t)spaceInDest);
+        if (count < 0)
         {
             return EXIT_FAILURE;
         }
+        if (count == 0)
+        {
+            break;
+        }
+
+        // the header clock starts with the first byte of the request
+        if (totalWritten == 0)
+        {
+            deadline = phaseDeadline(timeouts->header_ms);
+        }
 
+        // dest is not zeroed up front, keep it a valid string for the parser
         totalWritten += count;
+        dest[totalWritten] = '\0';
 
         if (!foundEndOfHeaders)
         {
-            endOfHeaders = strstr(dest, endOfHeadersDelimiter);
+            // only rescan the new bytes, plus 3 in case the delimiter straddles
+            endOfHeaders = http_scan_end_of_headers(
+                dest + scanned, (size_t)(totalWritten - scanned));
+            scanned = totalWritten > 3 ? totalWritten - 3 : 0;
             if (endOfHeaders)
             {
                 foundEndOfHeaders = true;
-                int headerLength =
-                    endOfHeaders - dest + strlen(endOfHeadersDelimiter);
-                contentLength = getContentLengthFromString(dest);
+                headerLength = (size_t)(endOfHeaders - dest) +
+                               strlen(endOfHeadersDelimiter);
+                contentLength = http_scan_content_length(
+                    dest, (size_t)totalWritten);
+                // refused before the body is read, not cut off part way
+                if (contentLength == HTTP_SCAN_TOO_LARGE ||
+                    contentLength > bufSize - 1 - headerLength)
+                {
+                    return RECEIVE_TOO_LARGE;
+                }
                 totalLength = headerLength + contentLength;
+                deadline = phaseDeadline(timeouts->body_ms);
             }
         }
     }
     return EXIT_SUCCESS;
 }
 
-ssize_t getContentLengthFromString(const char *inputStr)
+bool parseTimeout(const char *str, int *ms)
 {
-    char *inputDup = strdup(inputStr);
-    const char *seekTo = "Content-Length: ";
-    int length;
+    char *end;
+    unsigned long value;
 
-    if (!strstr(inputDup, seekTo))
+    errno = 0;
+    value = strtoul(str, &end, 10);
+    if (end == str || *end != '\0' || *str == '-' || errno == ERANGE ||
+        value > INT_MAX)
     {
-        length = 0;
+        return false;
     }
-    else
+    *ms = value == 0 ? -1 : (int)value;
+
+    return true;
+}
+
+uint64_t phaseDeadline(int ms)
+{
+    return ms < 0 ? 0 : metrics_now_ns() + (uint64_t)ms * 1000000u;
+}
+
+bool waitForData(int fd, uint64_t deadline)
+{
+    struct pollfd pfd;
+    uint64_t now;
+    int timeout;
+    int ready;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    do
+    {
+        timeout = -1;
+        if (deadline)
+        {
+            now = metrics_now_ns();
+            if (now >= deadline)
+            {
+                return false;
+            }
+            // round up so we never wake just before the deadline
+            timeout = (int)((deadline - now + 999999) / 1000000);
+        }
+        ready = poll(&pfd, 1, timeout);
+    } while (ready < 0 && errno == EINTR);
+
+    // errors and hangups are left for the read to report
+    return ready != 0;
+}
+
+void deliverTimeout(const struct dc_posix_env *env, struct dc_error *err,
+                    struct server *server)
+{
+    char start[96];
+
+    snprintf(start, sizeof(start),
+             "HTTP/1.0 %d Request Timeout\r\nContent-Type: "
+             "text/plain\r\nContent-Length: ",
+             REQUEST_TIMEOUT);
+    server->req.keep_alive = false;
+    writeValToClient(env, err, server, start, "408 Request Timeout\n");
+}
+
+void deliverTooLarge(const struct dc_posix_env *env, struct dc_error *err,
+                     struct server *server)
+{
+    char start[96];
+
+    snprintf(start, sizeof(start),
+             "HTTP/1.0 %d Payload Too Large\r\nContent-Type: "
+             "text/plain\r\nContent-Length: ",
+             PAYLOAD_TOO_LARGE);
+    server->req.keep_alive = false;
+    writeValToClient(env, err, server, start, "413 Payload Too Large\n");
+}
+
+enum admission_class requestClass(const struct server *server, int method)
+{
+    const char *query = server->req.req_line->query;
+    struct form_iter iter;
+    struct form_field field;
+
+    if (method == PUT)
+    {
+        return ADMISSION_WRITE;
+    }
+
+    if (query)
+    {
+        form_iter_init(&iter, query, strlen(query));
+        if (form_next(&iter, &field) && field.value == NULL &&
+            form_name_is(&field, "all"))
+        {
+            return ADMISSION_BULK_READ;
+        }
+    }
+
+    // without a place to resume from a sync starts with the whole db
+    if (strcmp(server->req.req_line->path, "/ibeacons/changes") == 0 &&
+        (query == NULL || strstr(query, "since=") == NULL))
+    {
+        return ADMISSION_BULK_READ;
+    }
+
+    return ADMISSION_READ;
+}
+
+void deliverOverload(const struct dc_posix_env *env, struct dc_error *err,
+                     struct server *server, enum admission_verdict verdict)
+{
+    char start[128];
+
+    if (verdict == ADMISSION_THROTTLED)
     {
-        char *lengthStr;
-        char *seekToPos = strstr(inputDup, seekTo);
-        lengthStr = strtok(seekToPos + strlen(seekTo), " ");
-        length = atoi(lengthStr);
+        snprintf(start, sizeof(start),
+                 "HTTP/1.0 %d Too Many Requests\r\nContent-Type: "
+                 "text/plain\r\nRetry-After: %u\r\nContent-Length: ",
+                 TOO_MANY_REQUESTS, server->admission->retry_after);
+        writeValToClient(env, err, server, start, "429 Too Many Requests\n");
+        return;
     }
 
-    free(inputDup);
-    return length;
+    snprintf(start, sizeof(start),
+             "HTTP/1.0 %d Service Unavailable\r\nContent-Type: "
+             "text/plain\r\nRetry-After: %u\r\nContent-Length: ",
+             SERVICE_UNAVAILABLE, server->admission->retry_after);
+    server->req.keep_alive = false;
+    writeValToClient(env, err, server, start, "503 Service Unavailable\n");
 }
 
 void signal_handler(__attribute__((unused)) int signnum)
@@ -893,6 +2712,23 @@ void signal_handler(__attribute__((unused)) int signnum)
     exit_signal = 1;
 }
 
+static void trace_signal_handler(__attribute__((unused)) int signnum)
+{
+    int savedErrno = errno;
+    int fd;
+
+    if (trace_path)
+    {
+        fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            fsm_trace_dump(fd);
+            close(fd);
+        }
+    }
+    errno = savedErrno;
+}
+
 static void error_reporter(const struct dc_error *err)
 {
     if (err->type == DC_ERROR_ERRNO)
@@ -925,22 +2761,33 @@ static void trace(const struct dc_posix_env *env, const char *file_name,
             line_number);
 }
 
-static void will_change_state(const struct dc_posix_env *env,
-                              struct dc_error *err,
-                              const struct dc_fsm_info *info, int from_state_id,
-                              int to_state_id)
+static void will_change_state(__attribute__((unused))
+                              const struct dc_posix_env *env,
+                              __attribute__((unused)) struct dc_error *err,
+                              __attribute__((unused))
+                              const struct dc_fsm_info *info,
+                              __attribute__((unused)) int from_state_id,
+                              __attribute__((unused)) int to_state_id)
 {
-    printf("%s: will change %d -> %d\n", dc_fsm_info_get_name(info),
-           from_state_id, to_state_id);
+    state_started_ns = metrics_now_ns();
 }
 
-static void did_change_state(const struct dc_posix_env *env,
-                             struct dc_error *err,
+static void did_change_state(__attribute__((unused))
+                             const struct dc_posix_env *env,
+                             __attribute__((unused)) struct dc_error *err,
+                             __attribute__((unused))
                              const struct dc_fsm_info *info, int from_state_id,
-                             int to_state_id, int next_id)
+                             int to_state_id,
+                             __attribute__((unused)) int next_id)
 {
-    printf("%s: did change %d -> %d moving to %d\n", dc_fsm_info_get_name(info),
-           from_state_id, to_state_id, next_id);
+    uint64_t now = metrics_now_ns();
+
+    if (to_state_id >= PROCESS && to_state_id <= INVALID)
+    {
+        metrics_state((enum metrics_state)(to_state_id - PROCESS),
+                      now - state_started_ns);
+    }
+    fsm_trace_record(from_state_id, to_state_id, state_started_ns, now);
 }
 
 static void bad_change_state(const struct dc_posix_env *env,
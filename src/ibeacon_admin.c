@@ -0,0 +1,182 @@
+/*
+ * Admin commands for a running iBeaconServer.
+ *
+ *     snapshot  writes a point-in-time copy of the db into the server's
+ *               --snapshot-dir without stopping writes, and prints its name
+ *               and the change sequence number it was taken at.
+ *
+ * usage: ibeacon_admin [-h host] [-p port] command
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#define ADMIN_BUFFER_SIZE 4096
+
+static void usage(const char *name);
+static int connect_to(const char *host, const char *port);
+static int send_all(int fd, const char *data, size_t len);
+static bool print_response(int fd);
+
+int main(int argc, char *argv[])
+{
+    static const char snapshot[] =
+        "PUT /admin/snapshot HTTP/1.0\r\nContent-Length: 0\r\n\r\n";
+    const char *host = "127.0.0.1";
+    const char *port;
+    char defaultPort[8];
+    bool ok;
+    int fd;
+    int opt;
+
+    snprintf(defaultPort, sizeof(defaultPort), "%d", DEFAULT_PORT);
+    port = defaultPort;
+
+    while ((opt = getopt(argc, argv, "h:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || strcmp(argv[optind], "snapshot") != 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fd = connect_to(host, port);
+    if (fd < 0)
+    {
+        fprintf(stderr, "ibeacon_admin: cannot connect to %s:%s\n", host, port);
+        return EXIT_FAILURE;
+    }
+    ok = send_all(fd, snapshot, sizeof(snapshot) - 1) == 0 &&
+         print_response(fd);
+    close(fd);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-h host] [-p port] snapshot\n", name);
+}
+
+static int connect_to(const char *host, const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *address;
+    struct addrinfo *at;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &address) != 0)
+    {
+        return -1;
+    }
+    for (at = address; at != NULL && fd < 0; at = at->ai_next)
+    {
+        fd = socket(at->ai_family, at->ai_socktype, at->ai_protocol);
+        if (fd >= 0 && connect(fd, at->ai_addr, at->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(address);
+
+    return fd;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    ssize_t count;
+
+    while (len > 0)
+    {
+        count = send(fd, data, len, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return -1;
+        }
+        data += count;
+        len -= (size_t)count;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Reads the response until the server closes, which an HTTP/1.0
+ * request asks it to, and prints its body to stdout, or the status line to
+ * stderr if it is not a 200
+ *
+ * @param fd
+ * @return true for a 200
+ */
+static bool print_response(int fd)
+{
+    char buf[ADMIN_BUFFER_SIZE];
+    size_t len = 0;
+    ssize_t got;
+    char *body;
+    char *eol;
+
+    while (len < sizeof(buf) - 1)
+    {
+        got = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        len += (size_t)got;
+    }
+    buf[len] = '\0';
+
+    body = strstr(buf, "\r\n\r\n");
+    eol = strstr(buf, "\r\n");
+    if (body == NULL || eol == NULL)
+    {
+        fprintf(stderr, "ibeacon_admin: no response\n");
+        return false;
+    }
+    if (strncasecmp(buf, "HTTP/1.0 200 ", 13) != 0 &&
+        strncasecmp(buf, "HTTP/1.1 200 ", 13) != 0)
+    {
+        fprintf(stderr, "ibeacon_admin: %.*s: %s", (int)(eol - buf), buf,
+                body + 4);
+        return false;
+    }
+    fputs(body + 4, stdout);
+
+    return true;
+}
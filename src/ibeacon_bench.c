@@ -0,0 +1,527 @@
+/*
+ * Load generator for iBeaconServer. Each thread drives one connection over
+ * loopback, mixing GETs and PUTs over a fixed key space, and the run ends with
+ * throughput and latency percentiles.
+ *
+ * usage: ibeacon_bench [-h host] [-p port] [-c threads] [-d seconds]
+ *                      [-n requests] [-r put_percent] [-k keys]
+ *                      [-z zipf_exponent] [-s payload_bytes] [-C]
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "http_scan.h"
+
+#define BENCH_BUFFER_SIZE 65536
+#define KEY_SIZE 32
+
+/**
+ * @brief Run parameters shared by every thread
+ *
+ */
+struct bench_config
+{
+    const char *host;
+    const char *port;
+    unsigned int threads;
+    double seconds;
+    unsigned long requests;
+    unsigned int put_percent;
+    unsigned int keys;
+    double zipf;
+    size_t payload;
+    bool keep_alive;
+    struct addrinfo *address;
+    double *zipf_cdf;
+};
+
+/**
+ * @brief Per-thread state and results
+ *
+ */
+struct bench_worker
+{
+    const struct bench_config *config;
+    pthread_t thread;
+    uint64_t rng;
+    int fd;
+    uint64_t *latencies;
+    size_t count;
+    size_t cap;
+    unsigned long errors;
+    unsigned long connects;
+    uint64_t bytes;
+    char *buf;
+    char *payload;
+};
+
+static void usage(const char *name);
+static void *run_worker(void *arg);
+static int do_request(struct bench_worker *worker, const char *request,
+                      size_t len);
+static int send_all(int fd, const char *data, size_t len);
+static int connect_to(const struct bench_config *config);
+static unsigned int pick_key(struct bench_worker *worker);
+static uint64_t next_random(struct bench_worker *worker);
+static uint64_t now_ns(void);
+static int compare_u64(const void *a, const void *b);
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p);
+
+int main(int argc, char *argv[])
+{
+    struct bench_config config = {"127.0.0.1", NULL, 8, 10.0, 0, 10,
+                                  1000, 0.0, 32, true, NULL, NULL};
+    struct bench_worker *workers;
+    struct addrinfo hints;
+    char defaultPort[8];
+    uint64_t *all;
+    uint64_t start;
+    uint64_t elapsed;
+    size_t total = 0;
+    unsigned long errors = 0;
+    unsigned long connects = 0;
+    uint64_t bytes = 0;
+    uint64_t sum = 0;
+    double seconds;
+    unsigned int i;
+    size_t j;
+    int opt;
+
+    snprintf(defaultPort, sizeof(defaultPort), "%d", DEFAULT_PORT);
+    config.port = defaultPort;
+
+    while ((opt = getopt(argc, argv, "h:p:c:d:n:r:k:z:s:C")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                config.host = optarg;
+                break;
+            case 'p':
+                config.port = optarg;
+                break;
+            case 'c':
+                config.threads = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                config.seconds = strtod(optarg, NULL);
+                break;
+            case 'n':
+                config.requests = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                config.put_percent = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                config.keys = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                config.zipf = strtod(optarg, NULL);
+                break;
+            case 's':
+                config.payload = strtoul(optarg, NULL, 10);
+                break;
+            case 'C':
+                config.keep_alive = false;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (config.threads == 0 || config.keys == 0 || config.put_percent > 100 ||
+        config.payload == 0 || config.payload > BENCH_BUFFER_SIZE / 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(config.host, config.port, &hints, &config.address) != 0)
+    {
+        fprintf(stderr, "ibeacon_bench: cannot resolve %s:%s\n", config.host,
+                config.port);
+        return EXIT_FAILURE;
+    }
+
+    // zipf: P(rank k) proportional to 1 / k^s, sampled from the cumulative sum
+    if (config.zipf > 0.0)
+    {
+        double norm = 0.0;
+
+        config.zipf_cdf = malloc(config.keys * sizeof(double));
+        for (i = 0; i < config.keys; i++)
+        {
+            norm += 1.0 / pow((double)(i + 1), config.zipf);
+            config.zipf_cdf[i] = norm;
+        }
+        for (i = 0; i < config.keys; i++)
+        {
+            config.zipf_cdf[i] /= norm;
+        }
+    }
+
+    workers = calloc(config.threads, sizeof(struct bench_worker));
+    start = now_ns();
+    for (i = 0; i < config.threads; i++)
+    {
+        workers[i].config = &config;
+        workers[i].rng = 0x9E3779B97F4A7C15ull * (i + 1);
+        workers[i].fd = -1;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    for (i = 0; i < config.threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].count;
+        errors += workers[i].errors;
+        connects += workers[i].connects;
+        bytes += workers[i].bytes;
+    }
+    elapsed = now_ns() - start;
+
+    all = malloc((total ? total : 1) * sizeof(uint64_t));
+    for (i = 0, j = 0; i < config.threads; i++)
+    {
+        memcpy(all + j, workers[i].latencies,
+               workers[i].count * sizeof(uint64_t));
+        j += workers[i].count;
+        free(workers[i].latencies);
+    }
+    qsort(all, total, sizeof(uint64_t), compare_u64);
+    for (j = 0; j < total; j++)
+    {
+        sum += all[j];
+    }
+
+    seconds = (double)elapsed / 1e9;
+    printf("threads %u, %s, %u%% PUT, %u keys (%s), %zu byte payloads\n",
+           config.threads, config.keep_alive ? "keep-alive" : "close",
+           config.put_percent, config.keys,
+           config.zipf > 0.0 ? "zipf" : "uniform", config.payload);
+    printf("requests   %zu in %.2fs, %lu errors, %lu connections\n", total,
+           seconds, errors, connects);
+    printf("throughput %.1f req/s, %.2f MB/s received\n",
+           (double)total / seconds, (double)bytes / seconds / 1e6);
+    if (total)
+    {
+        printf("latency    mean %.1fus p50 %.1fus p99 %.1fus p999 %.1fus "
+               "max %.1fus\n",
+               (double)sum / (double)total / 1e3,
+               (double)percentile(all, total, 0.50) / 1e3,
+               (double)percentile(all, total, 0.99) / 1e3,
+               (double)percentile(all, total, 0.999) / 1e3,
+               (double)all[total - 1] / 1e3);
+    }
+
+    free(all);
+    free(workers);
+    free(config.zipf_cdf);
+    freeaddrinfo(config.address);
+
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-c threads] [-d seconds]\n"
+            "       [-n requests per thread] [-r put percent] [-k keys]\n"
+            "       [-z zipf exponent, 0 for uniform] [-s payload bytes]\n"
+            "       [-C close after each request]\n",
+            name);
+}
+
+static void *run_worker(void *arg)
+{
+    struct bench_worker *worker = (struct bench_worker *)arg;
+    const struct bench_config *config = worker->config;
+    const char *version = config->keep_alive ? "HTTP/1.1" : "HTTP/1.0";
+    uint64_t deadline = now_ns() + (uint64_t)(config->seconds * 1e9);
+    char *request;
+    char key[KEY_SIZE];
+    unsigned long sent;
+    size_t i;
+    int len;
+
+    worker->buf = malloc(BENCH_BUFFER_SIZE);
+    worker->payload = malloc(config->payload + 1);
+    request = malloc(BENCH_BUFFER_SIZE);
+    worker->cap = 4096;
+    worker->latencies = malloc(worker->cap * sizeof(uint64_t));
+
+    for (sent = 0; config->requests ? sent < config->requests
+                                    : now_ns() < deadline;
+         sent++)
+    {
+        snprintf(key, sizeof(key), "beacon-%06u", pick_key(worker));
+        if (next_random(worker) % 100 < config->put_percent)
+        {
+            for (i = 0; i < config->payload; i++)
+            {
+                worker->payload[i] = (char)('a' + next_random(worker) % 26);
+            }
+            worker->payload[config->payload] = '\0';
+            len = snprintf(request, BENCH_BUFFER_SIZE,
+                           "PUT /ibeacons/data %s\r\nHost: %s\r\n"
+                           "Content-Length: %zu\r\n\r\ndata=%s&key=%s",
+                           version, config->host,
+                           config->payload + strlen(key) + 10, worker->payload,
+                           key);
+        }
+        else
+        {
+            len = snprintf(request, BENCH_BUFFER_SIZE,
+                           "GET /ibeacons/data?key=%s %s\r\nHost: %s\r\n\r\n",
+                           key, version, config->host);
+        }
+
+        if (do_request(worker, request, (size_t)len) != 0)
+        {
+            worker->errors++;
+        }
+    }
+
+    if (worker->fd >= 0)
+    {
+        close(worker->fd);
+    }
+    free(request);
+    free(worker->payload);
+    free(worker->buf);
+
+    return NULL;
+}
+
+/**
+ * @brief Sends one request and reads the whole response, reconnecting first
+ * if there is no open connection. Records the latency on success.
+ *
+ * @return 0 on success
+ */
+static int do_request(struct bench_worker *worker, const char *request,
+                      size_t len)
+{
+    uint64_t start = now_ns();
+    const char *end = NULL;
+    const char *closing;
+    size_t have = 0;
+    size_t need = 0;
+    ssize_t count;
+    bool retried = false;
+
+    for (;;)
+    {
+        if (worker->fd < 0)
+        {
+            worker->fd = connect_to(worker->config);
+            if (worker->fd < 0)
+            {
+                return -1;
+            }
+            worker->connects++;
+        }
+
+        if (send_all(worker->fd, request, len) == 0)
+        {
+            break;
+        }
+        // the server may have dropped an idle keep-alive connection
+        close(worker->fd);
+        worker->fd = -1;
+        if (retried)
+        {
+            return -1;
+        }
+        retried = true;
+    }
+
+    while (need == 0 || have < need)
+    {
+        count = read(worker->fd, worker->buf + have,
+                     BENCH_BUFFER_SIZE - 1 - have);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            close(worker->fd);
+            worker->fd = -1;
+            return -1;
+        }
+        have += (size_t)count;
+        if (need == 0)
+        {
+            end = http_scan_end_of_headers(worker->buf, have);
+            if (end)
+            {
+                need = http_scan_request_length(worker->buf, have);
+            }
+            else if (have == BENCH_BUFFER_SIZE - 1)
+            {
+                close(worker->fd);
+                worker->fd = -1;
+                return -1;
+            }
+        }
+        if (need > BENCH_BUFFER_SIZE - 1)
+        {
+            close(worker->fd);
+            worker->fd = -1;
+            return -1;
+        }
+    }
+
+    // the blocking backend answers every request with Connection: close
+    worker->buf[have] = '\0';
+    closing = strstr(worker->buf, "\r\nConnection: close\r\n");
+    if (!worker->config->keep_alive || (closing != NULL && closing < end))
+    {
+        close(worker->fd);
+        worker->fd = -1;
+    }
+
+    worker->bytes += have;
+    if (worker->count == worker->cap)
+    {
+        worker->cap *= 2;
+        worker->latencies =
+            realloc(worker->latencies, worker->cap * sizeof(uint64_t));
+    }
+    worker->latencies[worker->count++] = now_ns() - start;
+
+    // anything but 2xx or 404 (key not stored yet) counts as an error
+    return strncmp(worker->buf + 9, "2", 1) == 0 ||
+                   strncmp(worker->buf + 9, "404", 3) == 0
+               ? 0
+               : -1;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    ssize_t count;
+
+    while (len > 0)
+    {
+        count = send(fd, data, len, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return -1;
+        }
+        data += count;
+        len -= (size_t)count;
+    }
+
+    return 0;
+}
+
+static int connect_to(const struct bench_config *config)
+{
+    int fd;
+    int one = 1;
+
+    fd = socket(config->address->ai_family, config->address->ai_socktype,
+                config->address->ai_protocol);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, config->address->ai_addr, config->address->ai_addrlen) !=
+        0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static unsigned int pick_key(struct bench_worker *worker)
+{
+    const struct bench_config *config = worker->config;
+    double u;
+    unsigned int lo;
+    unsigned int hi;
+
+    if (!config->zipf_cdf)
+    {
+        return (unsigned int)(next_random(worker) % config->keys);
+    }
+
+    u = (double)(next_random(worker) >> 11) / 9007199254740992.0;
+    lo = 0;
+    hi = config->keys - 1;
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (config->zipf_cdf[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * @brief xorshift64*, one stream per thread
+ *
+ */
+static uint64_t next_random(struct bench_worker *worker)
+{
+    worker->rng ^= worker->rng >> 12;
+    worker->rng ^= worker->rng << 25;
+    worker->rng ^= worker->rng >> 27;
+    return worker->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p)
+{
+    size_t index = (size_t)ceil(p * (double)count);
+
+    return sorted[index ? index - 1 : 0];
+}
@@ -0,0 +1,731 @@
+// recvmmsg(2) is a GNU extension
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include "ingest.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "affinity.h"
+#include "metrics.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * @brief Receive buffer a connection starts with, room for many small frames
+ * per read
+ *
+ */
+#define IN_MIN (64 * 1024)
+/**
+ * @brief Acks a connection may owe before it is read from again, a gateway
+ * that does not read its acks gets no further
+ *
+ */
+#define OUT_ACKS 64
+/**
+ * @brief Receives per wakeup before the TCP connections get a turn
+ *
+ */
+#define UDP_ROUNDS 16
+/**
+ * @brief Receive buffer asked for on the UDP socket, bursts queue here while
+ * a batch is being stored
+ *
+ */
+#define UDP_RCVBUF (4 * 1024 * 1024)
+
+/**
+ * @brief One gateway connection
+ *
+ */
+struct ingest_conn
+{
+    int fd;
+    uint8_t *in;
+    size_t in_len;
+    size_t in_cap;
+    uint8_t out[OUT_ACKS * INGEST_HEADER_SIZE];
+    size_t out_len;
+    bool closing;
+};
+
+struct ingest_listener
+{
+    const struct dc_posix_env *env;
+    int listen_fd;
+    int udp_fd;
+    int cpu;
+    int wake[2];
+    ingest_store store;
+    const void *arg;
+    pthread_t thread;
+    struct ingest_conn *conns[INGEST_MAX_CONNECTIONS];
+    size_t conn_count;
+    struct ingest_record records[INGEST_BATCH];
+    size_t pending;
+    char *scratch;
+    size_t scratch_len;
+    uint8_t *datagrams;
+};
+
+static void *serve(void *arg);
+static void accept_all(struct ingest_listener *listener);
+static bool conn_serve(struct ingest_listener *listener,
+                       struct ingest_conn *conn, short revents);
+static bool conn_read(struct ingest_listener *listener,
+                      struct ingest_conn *conn);
+static void conn_frames(struct ingest_listener *listener,
+                        struct ingest_conn *conn);
+static bool frame_valid(const uint8_t *records, size_t len);
+static size_t frame_store(struct ingest_listener *listener,
+                          struct dc_error *err, const uint8_t *records,
+                          size_t len);
+static const uint8_t *batch_add(struct ingest_listener *listener,
+                                struct dc_error *err, const uint8_t *record,
+                                size_t *stored);
+static size_t batch_flush(struct ingest_listener *listener,
+                          struct dc_error *err);
+static void receive_datagrams(struct ingest_listener *listener);
+static int receive_batch(struct ingest_listener *listener, size_t *lens);
+static bool conn_flush(struct ingest_conn *conn);
+static void conn_ack(struct ingest_conn *conn, enum ingest_status status,
+                     uint32_t stored);
+static void conn_close(struct ingest_conn *conn);
+static void set_nonblocking(int fd);
+static uint16_t get16(const uint8_t *at);
+static uint32_t get32(const uint8_t *at);
+
+struct ingest_listener *ingest_start(const struct dc_posix_env *env,
+                                     int listen_fd, int udp_fd, int cpu,
+                                     ingest_store store, const void *arg)
+{
+    struct ingest_listener *listener;
+    int rcvbuf = UDP_RCVBUF;
+    sigset_t all;
+    sigset_t old;
+    int rc;
+
+    listener = calloc(1, sizeof(struct ingest_listener));
+    if (listener == NULL)
+    {
+        return NULL;
+    }
+    // each record unpacks to key\0value\0
+    listener->scratch = malloc(INGEST_BATCH * (INGEST_MAX_RECORD + 2));
+    // a byte over the limit per slot tells an oversized datagram apart
+    listener->datagrams =
+        udp_fd >= 0 ? malloc(INGEST_UDP_BATCH * (INGEST_MAX_DATAGRAM + 1))
+                    : NULL;
+    if (listener->scratch == NULL ||
+        (udp_fd >= 0 && listener->datagrams == NULL) ||
+        pipe(listener->wake) != 0)
+    {
+        free(listener->datagrams);
+        free(listener->scratch);
+        free(listener);
+        return NULL;
+    }
+    listener->env = env;
+    listener->listen_fd = listen_fd;
+    listener->udp_fd = udp_fd;
+    listener->cpu = cpu;
+    listener->store = store;
+    listener->arg = arg;
+    if (listen_fd >= 0)
+    {
+        set_nonblocking(listen_fd);
+    }
+    if (udp_fd >= 0)
+    {
+        set_nonblocking(udp_fd);
+        setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    // signals stay with the serving threads, which act on them
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&listener->thread, NULL, serve, listener);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        close(listener->wake[0]);
+        close(listener->wake[1]);
+        free(listener->datagrams);
+        free(listener->scratch);
+        free(listener);
+        return NULL;
+    }
+
+    return listener;
+}
+
+void ingest_stop(struct ingest_listener **plistener)
+{
+    struct ingest_listener *listener = *plistener;
+    size_t i;
+
+    if (listener == NULL)
+    {
+        return;
+    }
+
+    if (write(listener->wake[1], "", 1) == 1)
+    {
+        pthread_join(listener->thread, NULL);
+    }
+    for (i = 0; i < listener->conn_count; i++)
+    {
+        conn_close(listener->conns[i]);
+    }
+    if (listener->listen_fd >= 0)
+    {
+        close(listener->listen_fd);
+    }
+    if (listener->udp_fd >= 0)
+    {
+        close(listener->udp_fd);
+    }
+    close(listener->wake[0]);
+    close(listener->wake[1]);
+    free(listener->datagrams);
+    free(listener->scratch);
+    free(listener);
+    *plistener = NULL;
+}
+
+static void *serve(void *arg)
+{
+    struct ingest_listener *listener = (struct ingest_listener *)arg;
+    struct pollfd fds[3 + INGEST_MAX_CONNECTIONS];
+    struct ingest_conn *conn;
+    size_t polled;
+    bool open;
+    size_t i;
+
+    // on the CPU that takes its sockets' packets, whose caches hold them
+    if (listener->cpu >= 0)
+    {
+        affinity_pin_thread(listener->cpu);
+    }
+
+    fds[0].fd = listener->wake[0];
+    fds[0].events = POLLIN;
+    // poll skips negative fds, so a transport that is off costs nothing
+    fds[1].fd = listener->listen_fd;
+    fds[1].events = POLLIN;
+    fds[2].fd = listener->udp_fd;
+    fds[2].events = POLLIN;
+
+    for (;;)
+    {
+        polled = listener->conn_count;
+        for (i = 0; i < polled; i++)
+        {
+            conn = listener->conns[i];
+            fds[3 + i].fd = conn->fd;
+            fds[3 + i].events = (short)(
+                (conn->out_len ? POLLOUT : 0) |
+                (!conn->closing && conn->out_len < sizeof(conn->out) ? POLLIN
+                                                                      : 0));
+            fds[3 + i].revents = 0;
+        }
+        if (poll(fds, 3 + polled, -1) < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (fds[0].revents)
+        {
+            break;
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            receive_datagrams(listener);
+        }
+
+        // walked backwards so a closed connection can take the last one's
+        // place, which has either been seen to already or was not polled
+        for (i = polled; i-- > 0;)
+        {
+            conn = listener->conns[i];
+            open = !fds[3 + i].revents ||
+                   conn_serve(listener, conn, fds[3 + i].revents);
+            if (!open)
+            {
+                conn_close(conn);
+                listener->conns[i] = listener->conns[--listener->conn_count];
+            }
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            accept_all(listener);
+        }
+    }
+    buffer_pool_thread_flush();
+
+    return NULL;
+}
+
+static void accept_all(struct ingest_listener *listener)
+{
+    struct ingest_conn *conn;
+    int fd;
+
+    while ((fd = accept(listener->listen_fd, NULL, NULL)) >= 0)
+    {
+        conn = listener->conn_count < INGEST_MAX_CONNECTIONS
+                   ? calloc(1, sizeof(struct ingest_conn))
+                   : NULL;
+        if (conn == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        set_nonblocking(fd);
+        conn->fd = fd;
+        listener->conns[listener->conn_count++] = conn;
+    }
+}
+
+/**
+ * @brief Moves a connection along after poll saw revents on it
+ *
+ * @param listener
+ * @param conn
+ * @param revents
+ * @return false once the connection should close
+ */
+static bool conn_serve(struct ingest_listener *listener,
+                       struct ingest_conn *conn, short revents)
+{
+    size_t before;
+
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) && !conn_read(listener, conn))
+    {
+        return false;
+    }
+    if (!conn_flush(conn))
+    {
+        return false;
+    }
+    // frames that waited on room for their acks, no new data will wake them
+    while (conn->in_len && !conn->out_len && !conn->closing)
+    {
+        before = conn->in_len;
+        conn_frames(listener, conn);
+        if (!conn_flush(conn))
+        {
+            return false;
+        }
+        if (conn->in_len == before)
+        {
+            break;
+        }
+    }
+
+    return !conn->closing || conn->out_len;
+}
+
+/**
+ * @brief Reads what the gateway sent and handles every whole frame in it
+ *
+ * @param listener
+ * @param conn
+ * @return false once the connection should close
+ */
+static bool conn_read(struct ingest_listener *listener,
+                      struct ingest_conn *conn)
+{
+    size_t need = INGEST_HEADER_SIZE;
+    size_t cap;
+    uint8_t *grown;
+    ssize_t got;
+
+    // nothing more is read once framing is lost, only the ack goes out
+    if (conn->closing || conn->out_len == sizeof(conn->out))
+    {
+        return true;
+    }
+    if (conn->in_len >= INGEST_HEADER_SIZE)
+    {
+        need += get32(conn->in + 4);
+    }
+    if (conn->in_cap < need || conn->in_cap < IN_MIN)
+    {
+        cap = need > IN_MIN ? need : IN_MIN;
+        grown = realloc(conn->in, cap);
+        if (grown == NULL)
+        {
+            return false;
+        }
+        conn->in = grown;
+        conn->in_cap = cap;
+    }
+
+    got = recv(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len,
+               0);
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                     errno != EINTR))
+    {
+        return false;
+    }
+    if (got > 0)
+    {
+        conn->in_len += (size_t)got;
+        conn_frames(listener, conn);
+    }
+
+    return true;
+}
+
+static void conn_frames(struct ingest_listener *listener,
+                        struct ingest_conn *conn)
+{
+    struct dc_error err;
+    size_t off = 0;
+    size_t len;
+    size_t stored;
+
+    dc_error_init(&err, NULL);
+    while (!conn->closing && conn->out_len < sizeof(conn->out) &&
+           conn->in_len - off >= INGEST_HEADER_SIZE)
+    {
+        len = get32(conn->in + off + 4);
+        if (get16(conn->in + off) != INGEST_MAGIC ||
+            conn->in[off + 2] != INGEST_VERSION || len > INGEST_MAX_FRAME)
+        {
+            conn_ack(conn, INGEST_BAD_FRAME, 0);
+            conn->closing = true;
+            break;
+        }
+        if (conn->in_len - off - INGEST_HEADER_SIZE < len)
+        {
+            break;
+        }
+
+        off += INGEST_HEADER_SIZE;
+        if (!frame_valid(conn->in + off, len))
+        {
+            conn_ack(conn, INGEST_BAD_FRAME, 0);
+            conn->closing = true;
+            break;
+        }
+        stored = frame_store(listener, &err, conn->in + off, len);
+        conn_ack(conn,
+                 dc_error_has_error(&err) ? INGEST_STORE_FAILED : INGEST_OK,
+                 (uint32_t)stored);
+        dc_error_reset(&err);
+        off += len;
+    }
+
+    if (off)
+    {
+        memmove(conn->in, conn->in + off, conn->in_len - off);
+        conn->in_len -= off;
+    }
+}
+
+/**
+ * @brief Checks every record of a frame before any is stored, so a bad frame
+ * stores nothing
+ *
+ * @param records
+ * @param len
+ * @return bool
+ */
+static bool frame_valid(const uint8_t *records, size_t len)
+{
+    const uint8_t *end = records + len;
+    size_t keyLen;
+    size_t valueLen;
+
+    while (records < end)
+    {
+        if ((size_t)(end - records) < INGEST_RECORD_HEADER_SIZE)
+        {
+            return false;
+        }
+        keyLen = get16(records);
+        valueLen = get16(records + 2);
+        records += INGEST_RECORD_HEADER_SIZE;
+        // the db keeps C strings, an embedded NUL would cut the record short
+        if (keyLen == 0 || keyLen + valueLen > INGEST_MAX_RECORD ||
+            (size_t)(end - records) < keyLen + valueLen ||
+            memchr(records, '\0', keyLen + valueLen) != NULL)
+        {
+            return false;
+        }
+        records += keyLen + valueLen;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Hands a valid frame's records to the store a batch at a time
+ *
+ * @param listener
+ * @param err
+ * @param records
+ * @param len
+ * @return the number stored
+ */
+static size_t frame_store(struct ingest_listener *listener,
+                          struct dc_error *err, const uint8_t *records,
+                          size_t len)
+{
+    const uint8_t *end = records + len;
+    size_t stored = 0;
+
+    while (records < end && dc_error_has_no_error(err))
+    {
+        records = batch_add(listener, err, records, &stored);
+    }
+
+    return stored + batch_flush(listener, err);
+}
+
+/**
+ * @brief Unpacks a valid record into the pending batch, storing the batch
+ * first if it is full
+ *
+ * @param listener
+ * @param err
+ * @param record
+ * @param stored increased by what a store of the full batch stored
+ * @return the record after this one
+ */
+static const uint8_t *batch_add(struct ingest_listener *listener,
+                                struct dc_error *err, const uint8_t *record,
+                                size_t *stored)
+{
+    size_t keyLen = get16(record);
+    size_t valueLen = get16(record + 2);
+    char *scratch;
+
+    if (listener->pending == INGEST_BATCH)
+    {
+        *stored += batch_flush(listener, err);
+    }
+    record += INGEST_RECORD_HEADER_SIZE;
+    scratch = listener->scratch + listener->scratch_len;
+    listener->records[listener->pending].key = scratch;
+    memcpy(scratch, record, keyLen);
+    scratch[keyLen] = '\0';
+    scratch += keyLen + 1;
+    listener->records[listener->pending].value = scratch;
+    memcpy(scratch, record + keyLen, valueLen);
+    scratch[valueLen] = '\0';
+    listener->scratch_len += keyLen + valueLen + 2;
+    listener->pending++;
+
+    return record + keyLen + valueLen;
+}
+
+/**
+ * @brief Stores the pending batch, which is emptied either way
+ *
+ * @param listener
+ * @param err
+ * @return the number stored
+ */
+static size_t batch_flush(struct ingest_listener *listener,
+                          struct dc_error *err)
+{
+    size_t stored = 0;
+
+    if (listener->pending && dc_error_has_no_error(err))
+    {
+        stored = listener->store(listener->env, err, listener->arg,
+                                 listener->records, listener->pending);
+    }
+    listener->pending = 0;
+    listener->scratch_len = 0;
+
+    return stored;
+}
+
+/**
+ * @brief Drains the UDP socket a batch of datagrams at a time, storing their
+ * records together
+ *
+ * @param listener
+ */
+static void receive_datagrams(struct ingest_listener *listener)
+{
+    struct dc_error err;
+    size_t lens[INGEST_UDP_BATCH];
+    const uint8_t *datagram;
+    const uint8_t *records;
+    const uint8_t *end;
+    size_t stored = 0;
+    size_t rejected = 0;
+    int round;
+    int got;
+    int i;
+
+    dc_error_init(&err, NULL);
+    for (round = 0; round < UDP_ROUNDS; round++)
+    {
+        got = receive_batch(listener, lens);
+        for (i = 0; i < got; i++)
+        {
+            datagram = listener->datagrams +
+                       (size_t)i * (INGEST_MAX_DATAGRAM + 1);
+            if (lens[i] < INGEST_HEADER_SIZE || lens[i] > INGEST_MAX_DATAGRAM ||
+                get16(datagram) != INGEST_MAGIC ||
+                datagram[2] != INGEST_VERSION ||
+                get32(datagram + 4) != lens[i] - INGEST_HEADER_SIZE ||
+                !frame_valid(datagram + INGEST_HEADER_SIZE,
+                             lens[i] - INGEST_HEADER_SIZE))
+            {
+                rejected++;
+                continue;
+            }
+            records = datagram + INGEST_HEADER_SIZE;
+            end = datagram + lens[i];
+            while (records < end)
+            {
+                records = batch_add(listener, &err, records, &stored);
+            }
+            // nobody to tell, a failed store loses its batch and no more
+            dc_error_reset(&err);
+        }
+        if (got < INGEST_UDP_BATCH)
+        {
+            break;
+        }
+    }
+    stored += batch_flush(listener, &err);
+    dc_error_reset(&err);
+    metrics_ingest(METRICS_INGEST_UDP, stored, rejected);
+}
+
+/**
+ * @brief Takes up to INGEST_UDP_BATCH datagrams without waiting, with one
+ * system call where there is recvmmsg
+ *
+ * @param listener
+ * @param lens set to each datagram's length
+ * @return number taken
+ */
+static int receive_batch(struct ingest_listener *listener, size_t *lens)
+{
+    size_t slot = INGEST_MAX_DATAGRAM + 1;
+    int got;
+#if defined(__linux__)
+    struct mmsghdr msgs[INGEST_UDP_BATCH];
+    struct iovec iov[INGEST_UDP_BATCH];
+    int i;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < INGEST_UDP_BATCH; i++)
+    {
+        iov[i].iov_base = listener->datagrams + (size_t)i * slot;
+        iov[i].iov_len = slot;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    got = recvmmsg(listener->udp_fd, msgs, INGEST_UDP_BATCH, MSG_DONTWAIT,
+                   NULL);
+    for (i = 0; i < got; i++)
+    {
+        lens[i] = msgs[i].msg_len;
+    }
+#else
+    ssize_t len;
+
+    for (got = 0; got < INGEST_UDP_BATCH; got++)
+    {
+        len = recv(listener->udp_fd, listener->datagrams + (size_t)got * slot,
+                   slot, MSG_DONTWAIT);
+        if (len < 0)
+        {
+            break;
+        }
+        lens[got] = (size_t)len;
+    }
+#endif
+
+    return got < 0 ? 0 : got;
+}
+
+/**
+ * @brief Sends what acks the socket takes
+ *
+ * @param conn
+ * @return false once the connection should close
+ */
+static bool conn_flush(struct ingest_conn *conn)
+{
+    ssize_t sent;
+
+    if (conn->out_len == 0)
+    {
+        return true;
+    }
+    sent = send(conn->fd, conn->out, conn->out_len, MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    memmove(conn->out, conn->out + sent, conn->out_len - (size_t)sent);
+    conn->out_len -= (size_t)sent;
+
+    return true;
+}
+
+static void conn_ack(struct ingest_conn *conn, enum ingest_status status,
+                     uint32_t stored)
+{
+    uint8_t *ack = conn->out + conn->out_len;
+
+    ack[0] = (uint8_t)(INGEST_MAGIC >> 8);
+    ack[1] = (uint8_t)(INGEST_MAGIC & 0xff);
+    ack[2] = INGEST_VERSION;
+    ack[3] = (uint8_t)status;
+    ack[4] = (uint8_t)(stored >> 24);
+    ack[5] = (uint8_t)(stored >> 16);
+    ack[6] = (uint8_t)(stored >> 8);
+    ack[7] = (uint8_t)stored;
+    conn->out_len += INGEST_HEADER_SIZE;
+    metrics_ingest(METRICS_INGEST_TCP, stored, status == INGEST_BAD_FRAME);
+}
+
+static void conn_close(struct ingest_conn *conn)
+{
+    close(conn->fd);
+    free(conn->in);
+    free(conn);
+}
+
+static void set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags >= 0)
+    {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+static uint16_t get16(const uint8_t *at)
+{
+    return (uint16_t)((at[0] << 8) | at[1]);
+}
+
+static uint32_t get32(const uint8_t *at)
+{
+    return ((uint32_t)at[0] << 24) | ((uint32_t)at[1] << 16) |
+           ((uint32_t)at[2] << 8) | (uint32_t)at[3];
+}
@@ -0,0 +1,479 @@
+#include "metrics.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// histogram upper bounds in microseconds, plus an implicit +Inf bucket
+static const uint64_t bucket_bounds_us[] = {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+};
+#define BUCKET_COUNT (sizeof(bucket_bounds_us) / sizeof(bucket_bounds_us[0]) + 1)
+
+// statuses broken out by label, anything else is counted under "other"
+static const int tracked_statuses[] = {200, 304, 400, 404, 405, 408, 413, 429, 500, 503};
+#define STATUS_COUNT (sizeof(tracked_statuses) / sizeof(tracked_statuses[0]) + 1)
+
+static const char *const state_names[METRICS_STATE_COUNT] = {"PROCESS", "GET_", "PUT_", "INVALID"};
+static const char *const db_op_names[METRICS_DB_OP_COUNT] = {"store", "fetch", "fetch_all"};
+static const char *const cache_names[METRICS_CACHE_COUNT] = {"connection_pool", "buffer_pool"};
+static const char *const ingest_names[METRICS_INGEST_COUNT] = {"tcp", "udp", "follow"};
+static const char *const startup_names[METRICS_STARTUP_COUNT] = {"static_assets", "wal_replay", "warm_up", "total"};
+
+typedef _Atomic uint64_t counter;
+
+struct histogram
+{
+    counter buckets[BUCKET_COUNT];
+    counter sum_ns;
+};
+
+/**
+ * @brief One thread's counters. Only the owning thread writes them, so updates
+ * are plain relaxed load/store pairs; scrapes read them concurrently and sum
+ * across shards.
+ *
+ */
+struct metrics_shard
+{
+    struct metrics_shard *next;
+    counter requests[METRICS_MAX_ROUTES][STATUS_COUNT];
+    counter bytes_in;
+    counter bytes_out;
+    counter connections_opened;
+    counter connections_closed;
+    counter cache_hits[METRICS_CACHE_COUNT];
+    counter cache_misses[METRICS_CACHE_COUNT];
+    counter ingest_records[METRICS_INGEST_COUNT];
+    counter ingest_rejected[METRICS_INGEST_COUNT];
+    struct histogram db_ops[METRICS_DB_OP_COUNT];
+    struct histogram states[METRICS_STATE_COUNT];
+};
+
+/**
+ * @brief Totals gathered from every shard at scrape time
+ *
+ */
+struct metrics_totals
+{
+    uint64_t requests[METRICS_MAX_ROUTES][STATUS_COUNT];
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connections_opened;
+    uint64_t connections_closed;
+    uint64_t cache_hits[METRICS_CACHE_COUNT];
+    uint64_t cache_misses[METRICS_CACHE_COUNT];
+    uint64_t ingest_records[METRICS_INGEST_COUNT];
+    uint64_t ingest_rejected[METRICS_INGEST_COUNT];
+    uint64_t db_ops[METRICS_DB_OP_COUNT][BUCKET_COUNT + 1];
+    uint64_t states[METRICS_STATE_COUNT][BUCKET_COUNT + 1];
+};
+
+/**
+ * @brief Output cursor for metrics_render
+ *
+ */
+struct render_buf
+{
+    char *buf;
+    size_t cap;
+    size_t len;
+};
+
+static _Atomic(struct metrics_shard *) shards = NULL;
+// written once by the starting thread, not worth a shard
+static counter startup_ns[METRICS_STARTUP_COUNT];
+static _Thread_local struct metrics_shard *local_shard = NULL;
+
+static struct metrics_shard *get_shard(void);
+static inline void add(counter *c, uint64_t n);
+static void observe(struct histogram *hist, uint64_t ns);
+static size_t status_index(int status);
+static void sum_histogram(uint64_t *out, const struct histogram *hist);
+static void render_histogram(struct render_buf *out, const char *name, const char *label_name,
+                             const char *label, const uint64_t *hist);
+static void append(struct render_buf *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_request(size_t route_id, int status)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (!shard)
+    {
+        return;
+    }
+    if (route_id >= METRICS_MAX_ROUTES)
+    {
+        route_id = METRICS_ROUTE_UNMATCHED;
+    }
+    add(&shard->requests[route_id][status_index(status)], 1);
+}
+
+void metrics_bytes(uint64_t in, uint64_t out)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (shard)
+    {
+        add(&shard->bytes_in, in);
+        add(&shard->bytes_out, out);
+    }
+}
+
+void metrics_connection_opened(void)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (shard)
+    {
+        add(&shard->connections_opened, 1);
+    }
+}
+
+void metrics_connection_closed(void)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (shard)
+    {
+        add(&shard->connections_closed, 1);
+    }
+}
+
+void metrics_db_op(enum metrics_db_op op, uint64_t ns)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (shard)
+    {
+        observe(&shard->db_ops[op], ns);
+    }
+}
+
+void metrics_state(enum metrics_state state, uint64_t ns)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (shard)
+    {
+        observe(&shard->states[state], ns);
+    }
+}
+
+void metrics_cache(enum metrics_cache cache, bool hit)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (shard)
+    {
+        add(hit ? &shard->cache_hits[cache] : &shard->cache_misses[cache], 1);
+    }
+}
+
+void metrics_ingest(enum metrics_ingest transport, uint64_t records, uint64_t rejected)
+{
+    struct metrics_shard *shard = get_shard();
+
+    if (shard)
+    {
+        add(&shard->ingest_records[transport], records);
+        add(&shard->ingest_rejected[transport], rejected);
+    }
+}
+
+void metrics_startup(enum metrics_startup phase, uint64_t ns)
+{
+    atomic_store_explicit(&startup_ns[phase], ns, memory_order_relaxed);
+}
+
+size_t metrics_render(char *buf, size_t cap, const char *const route_names[], size_t route_count)
+{
+    struct metrics_totals *totals;
+    struct metrics_shard *shard;
+    struct render_buf out = {buf, cap, 0};
+    const char *label;
+    size_t route;
+    size_t status;
+    size_t i;
+    size_t j;
+
+    totals = (struct metrics_totals *)calloc(1, sizeof(struct metrics_totals));
+    if (!totals)
+    {
+        return 0;
+    }
+
+    for (shard = atomic_load_explicit(&shards, memory_order_acquire); shard; shard = shard->next)
+    {
+        for (route = 0; route < METRICS_MAX_ROUTES; route++)
+        {
+            for (status = 0; status < STATUS_COUNT; status++)
+            {
+                totals->requests[route][status] +=
+                    atomic_load_explicit(&shard->requests[route][status], memory_order_relaxed);
+            }
+        }
+        totals->bytes_in += atomic_load_explicit(&shard->bytes_in, memory_order_relaxed);
+        totals->bytes_out += atomic_load_explicit(&shard->bytes_out, memory_order_relaxed);
+        totals->connections_opened += atomic_load_explicit(&shard->connections_opened, memory_order_relaxed);
+        totals->connections_closed += atomic_load_explicit(&shard->connections_closed, memory_order_relaxed);
+        for (i = 0; i < METRICS_CACHE_COUNT; i++)
+        {
+            totals->cache_hits[i] += atomic_load_explicit(&shard->cache_hits[i], memory_order_relaxed);
+            totals->cache_misses[i] += atomic_load_explicit(&shard->cache_misses[i], memory_order_relaxed);
+        }
+        for (i = 0; i < METRICS_INGEST_COUNT; i++)
+        {
+            totals->ingest_records[i] += atomic_load_explicit(&shard->ingest_records[i], memory_order_relaxed);
+            totals->ingest_rejected[i] += atomic_load_explicit(&shard->ingest_rejected[i], memory_order_relaxed);
+        }
+        for (i = 0; i < METRICS_DB_OP_COUNT; i++)
+        {
+            sum_histogram(totals->db_ops[i], &shard->db_ops[i]);
+        }
+        for (i = 0; i < METRICS_STATE_COUNT; i++)
+        {
+            sum_histogram(totals->states[i], &shard->states[i]);
+        }
+    }
+
+    if (buf && cap)
+    {
+        buf[0] = '\0';
+    }
+
+    append(&out, "# HELP ibeacon_requests_total Requests served, by route and status.\n"
+                 "# TYPE ibeacon_requests_total counter\n");
+    for (route = 0; route < METRICS_MAX_ROUTES; route++)
+    {
+        if (route == METRICS_ROUTE_UNMATCHED)
+        {
+            label = "unmatched";
+        }
+        else if (route < route_count && route_names[route])
+        {
+            label = route_names[route];
+        }
+        else
+        {
+            continue;
+        }
+        for (status = 0; status < STATUS_COUNT; status++)
+        {
+            if (!totals->requests[route][status])
+            {
+                continue;
+            }
+            if (status < STATUS_COUNT - 1)
+            {
+                append(&out, "ibeacon_requests_total{route=\"%s\",status=\"%d\"} %" PRIu64 "\n", label,
+                       tracked_statuses[status], totals->requests[route][status]);
+            }
+            else
+            {
+                append(&out, "ibeacon_requests_total{route=\"%s\",status=\"other\"} %" PRIu64 "\n", label,
+                       totals->requests[route][status]);
+            }
+        }
+    }
+
+    append(&out,
+           "# HELP ibeacon_received_bytes_total Bytes read from clients.\n"
+           "# TYPE ibeacon_received_bytes_total counter\n"
+           "ibeacon_received_bytes_total %" PRIu64 "\n"
+           "# HELP ibeacon_sent_bytes_total Bytes written to clients.\n"
+           "# TYPE ibeacon_sent_bytes_total counter\n"
+           "ibeacon_sent_bytes_total %" PRIu64 "\n"
+           "# HELP ibeacon_active_connections Connections currently being served.\n"
+           "# TYPE ibeacon_active_connections gauge\n"
+           "ibeacon_active_connections %" PRIu64 "\n",
+           totals->bytes_in, totals->bytes_out,
+           totals->connections_opened - totals->connections_closed);
+
+    append(&out, "# HELP ibeacon_cache_hits_total Cache lookups served without allocating.\n"
+                 "# TYPE ibeacon_cache_hits_total counter\n");
+    for (i = 0; i < METRICS_CACHE_COUNT; i++)
+    {
+        append(&out, "ibeacon_cache_hits_total{cache=\"%s\"} %" PRIu64 "\n", cache_names[i],
+               totals->cache_hits[i]);
+    }
+    append(&out, "# HELP ibeacon_cache_misses_total Cache lookups that fell back to allocating.\n"
+                 "# TYPE ibeacon_cache_misses_total counter\n");
+    for (i = 0; i < METRICS_CACHE_COUNT; i++)
+    {
+        append(&out, "ibeacon_cache_misses_total{cache=\"%s\"} %" PRIu64 "\n", cache_names[i],
+               totals->cache_misses[i]);
+    }
+
+    append(&out, "# HELP ibeacon_ingest_records_total Records stored from the binary ingestion port or a primary.\n"
+                 "# TYPE ibeacon_ingest_records_total counter\n");
+    for (i = 0; i < METRICS_INGEST_COUNT; i++)
+    {
+        append(&out, "ibeacon_ingest_records_total{transport=\"%s\"} %" PRIu64 "\n", ingest_names[i],
+               totals->ingest_records[i]);
+    }
+    append(&out, "# HELP ibeacon_ingest_rejected_total Frames the binary ingestion port turned away, failed syncs with a primary.\n"
+                 "# TYPE ibeacon_ingest_rejected_total counter\n");
+    for (i = 0; i < METRICS_INGEST_COUNT; i++)
+    {
+        append(&out, "ibeacon_ingest_rejected_total{transport=\"%s\"} %" PRIu64 "\n", ingest_names[i],
+               totals->ingest_rejected[i]);
+    }
+
+    append(&out, "# HELP ibeacon_startup_seconds Time the last start spent in each phase before serving.\n"
+                 "# TYPE ibeacon_startup_seconds gauge\n");
+    for (i = 0; i < METRICS_STARTUP_COUNT; i++)
+    {
+        append(&out, "ibeacon_startup_seconds{phase=\"%s\"} %.9f\n", startup_names[i],
+               (double)atomic_load_explicit(&startup_ns[i], memory_order_relaxed) / 1e9);
+    }
+
+    append(&out, "# HELP ibeacon_db_operation_seconds Time spent in db operations.\n"
+                 "# TYPE ibeacon_db_operation_seconds histogram\n");
+    for (i = 0; i < METRICS_DB_OP_COUNT; i++)
+    {
+        render_histogram(&out, "ibeacon_db_operation_seconds", "op", db_op_names[i], totals->db_ops[i]);
+    }
+
+    append(&out, "# HELP ibeacon_state_seconds Time spent in each Processing-FSM state.\n"
+                 "# TYPE ibeacon_state_seconds histogram\n");
+    for (j = 0; j < METRICS_STATE_COUNT; j++)
+    {
+        render_histogram(&out, "ibeacon_state_seconds", "state", state_names[j], totals->states[j]);
+    }
+
+    free(totals);
+
+    return out.len;
+}
+
+/**
+ * @brief Returns the calling thread's shard, creating and publishing it on
+ * first use. Shards outlive their threads so totals never go backwards.
+ *
+ * @return struct metrics_shard* or NULL if out of memory
+ */
+static struct metrics_shard *get_shard(void)
+{
+    struct metrics_shard *shard = local_shard;
+
+    if (shard)
+    {
+        return shard;
+    }
+
+    shard = (struct metrics_shard *)calloc(1, sizeof(struct metrics_shard));
+    if (!shard)
+    {
+        return NULL;
+    }
+    shard->next = atomic_load_explicit(&shards, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&shards, &shard->next, shard, memory_order_release,
+                                                  memory_order_relaxed))
+    {
+    }
+    local_shard = shard;
+
+    return shard;
+}
+
+/**
+ * @brief Single-writer increment: no locked read-modify-write needed since only
+ * the owning thread stores to its shard
+ *
+ * @param c
+ * @param n
+ */
+static inline void add(counter *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void observe(struct histogram *hist, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    size_t i;
+
+    for (i = 0; i < BUCKET_COUNT - 1 && us > bucket_bounds_us[i]; i++)
+    {
+    }
+    add(&hist->buckets[i], 1);
+    add(&hist->sum_ns, ns);
+}
+
+static size_t status_index(int status)
+{
+    size_t i;
+
+    for (i = 0; i < STATUS_COUNT - 1; i++)
+    {
+        if (tracked_statuses[i] == status)
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * @brief Adds a shard's histogram into out: BUCKET_COUNT bucket counts
+ * followed by the sum in nanoseconds
+ *
+ * @param out
+ * @param hist
+ */
+static void sum_histogram(uint64_t *out, const struct histogram *hist)
+{
+    size_t i;
+
+    for (i = 0; i < BUCKET_COUNT; i++)
+    {
+        out[i] += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    }
+    out[BUCKET_COUNT] += atomic_load_explicit(&hist->sum_ns, memory_order_relaxed);
+}
+
+static void render_histogram(struct render_buf *out, const char *name, const char *label_name,
+                             const char *label, const uint64_t *hist)
+{
+    uint64_t cumulative = 0;
+    size_t i;
+
+    for (i = 0; i < BUCKET_COUNT - 1; i++)
+    {
+        cumulative += hist[i];
+        append(out, "%s_bucket{%s=\"%s\",le=\"%g\"} %" PRIu64 "\n", name, label_name, label,
+               (double)bucket_bounds_us[i] / 1e6, cumulative);
+    }
+    cumulative += hist[BUCKET_COUNT - 1];
+    append(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", name, label_name, label, cumulative);
+    append(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label_name, label, (double)hist[BUCKET_COUNT] / 1e9);
+    append(out, "%s_count{%s=\"%s\"} %" PRIu64 "\n", name, label_name, label, cumulative);
+}
+
+static void append(struct render_buf *out, const char *fmt, ...)
+{
+    va_list args;
+    size_t room = out->len < out->cap ? out->cap - out->len : 0;
+    int written;
+
+    va_start(args, fmt);
+    written = vsnprintf(room ? out->buf + out->len : NULL, room, fmt, args);
+    va_end(args);
+
+    if (written > 0)
+    {
+        out->len += (size_t)written;
+    }
+}
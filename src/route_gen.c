@@ -0,0 +1,114 @@
+/*
+ * Build-time generator for the route table. Reads routes.def, finds a hash
+ * seed for which every route lands in its own slot and writes the table as C.
+ *
+ * usage: route_gen <output.c>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_.h"
+#include "route_hash.h"
+
+/**
+ * @brief A route as written in routes.def
+ *
+ */
+struct route_def
+{
+    int method;
+    const char *method_name;
+    const char *path;
+    const char *handler;
+};
+
+static const struct route_def defs[] = {
+#define ROUTE(method, path, handler) {method, #method, path, #handler},
+#include "routes.def"
+#undef ROUTE
+};
+
+#define ROUTE_COUNT (sizeof(defs) / sizeof(defs[0]))
+#define MAX_SEED_ATTEMPTS 1000000u
+
+int main(int argc, char *argv[])
+{
+    size_t size;
+    size_t i;
+    uint32_t seed;
+    int *slots;
+    FILE *out;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <output.c>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // keep the table at most half full so a seed is found quickly
+    for (size = 1; size < ROUTE_COUNT * 2; size <<= 1)
+    {
+    }
+
+    slots = malloc(size * sizeof(int));
+    for (seed = 0; seed < MAX_SEED_ATTEMPTS; seed++)
+    {
+        for (i = 0; i < size; i++)
+        {
+            slots[i] = -1;
+        }
+        for (i = 0; i < ROUTE_COUNT; i++)
+        {
+            size_t slot = route_hash(defs[i].method, defs[i].path,
+                                     strlen(defs[i].path), seed) &
+                          (size - 1);
+            if (slots[slot] != -1)
+            {
+                break;
+            }
+            slots[slot] = (int)i;
+        }
+        if (i == ROUTE_COUNT)
+        {
+            break;
+        }
+    }
+
+    if (seed == MAX_SEED_ATTEMPTS)
+    {
+        fprintf(stderr, "route_gen: no perfect hash seed found\n");
+        free(slots);
+        return EXIT_FAILURE;
+    }
+
+    out = fopen(argv[1], "w");
+    if (out == NULL)
+    {
+        perror(argv[1]);
+        free(slots);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "/* Generated by route_gen from routes.def - do not edit */\n");
+    fprintf(out, "#include \"routes.h\"\n\n");
+    fprintf(out, "const uint32_t route_seed = %uu;\n", seed);
+    fprintf(out, "const uint32_t route_table_mask = %zuu;\n", size - 1);
+    fprintf(out, "const struct route route_table[%zu] = {\n", size);
+    for (i = 0; i < size; i++)
+    {
+        if (slots[i] != -1)
+        {
+            const struct route_def *def = &defs[slots[i]];
+            fprintf(out, "    [%zu] = {%s, \"%s\", %zu, %s},\n", i,
+                    def->method_name, def->path, strlen(def->path),
+                    def->handler);
+        }
+    }
+    fprintf(out, "};\n");
+
+    fclose(out);
+    free(slots);
+
+    return EXIT_SUCCESS;
+}
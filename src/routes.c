@@ -0,0 +1,59 @@
+#include "routes.h"
+#include <string.h>
+
+#include "route_hash.h"
+
+int parse_method(const char *method)
+{
+    // every supported method differs in its first byte
+    switch (method[0])
+    {
+        case 'G':
+            return strcmp(method, "GET") == 0 ? GET : -1;
+        case 'P':
+            if (strcmp(method, "PUT") == 0)
+            {
+                return PUT;
+            }
+            return strcmp(method, "POST") == 0 ? POST : -1;
+        default:
+            return -1;
+    }
+}
+
+const char *method_name(int method)
+{
+    switch (method)
+    {
+        case GET:
+            return "GET";
+        case PUT:
+            return "PUT";
+        case POST:
+            return "POST";
+        default:
+            return "?";
+    }
+}
+
+const struct route *route_lookup(int method, const char *path,
+                                 size_t path_len)
+{
+    const struct route *route;
+
+    if (method < 0)
+    {
+        return NULL;
+    }
+
+    route = &route_table[route_hash(method, path, path_len, route_seed) &
+                         route_table_mask];
+    if (route->path == NULL || (int)route->method != method ||
+        route->path_len != path_len ||
+        memcmp(route->path, path, path_len) != 0)
+    {
+        return NULL;
+    }
+
+    return route;
+}
@@ -0,0 +1,185 @@
+#include "server.h"
+#include <dc_posix/dc_stdlib.h>
+
+#include "buffer_pool.h"
+#include "common.h"
+#include "metrics.h"
+
+static bool server_init(const struct dc_posix_env *env, struct dc_error *err,
+                        struct server *server, const char *dbLoc);
+static void server_release(const struct dc_posix_env *env,
+                           struct server *server);
+
+struct server_pool *server_pool_create(const struct dc_posix_env *env,
+                                       struct dc_error *err, size_t size,
+                                       const char *dbLoc)
+{
+    struct server_pool *pool;
+    size_t i;
+
+    pool = dc_malloc(env, err, sizeof(struct server_pool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    pool->contexts = dc_calloc(env, err, size, sizeof(struct server));
+    pool->free_list = dc_calloc(env, err, size, sizeof(struct server *));
+    pool->size = 0;
+    pool->free_count = 0;
+    pool->dbLoc = dbLoc;
+    pool->timeouts.idle_ms = -1;
+    pool->timeouts.header_ms = -1;
+    pool->timeouts.body_ms = -1;
+    admission_init(&pool->admission, 0, 0, 0, 0, 1);
+
+    if (dc_error_has_error(err))
+    {
+        server_pool_destroy(env, &pool);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        if (!server_init(env, err, &pool->contexts[i], dbLoc))
+        {
+            break;
+        }
+        pool->contexts[i].pooled = true;
+        pool->free_list[pool->free_count++] = &pool->contexts[i];
+        pool->size++;
+    }
+
+    return pool;
+}
+
+struct server *server_pool_checkout(const struct dc_posix_env *env,
+                                    struct dc_error *err,
+                                    struct server_pool *pool,
+                                    int client_socket_fd)
+{
+    struct server *server;
+
+    metrics_cache(METRICS_CACHE_CONNECTION_POOL, pool->free_count > 0);
+    if (pool->free_count > 0)
+    {
+        server = pool->free_list[--pool->free_count];
+    }
+    else
+    {
+        // exhausted, serve this connection from a throwaway context
+        server = dc_calloc(env, err, 1, sizeof(struct server));
+        if (server == NULL)
+        {
+            return NULL;
+        }
+        if (!server_init(env, err, server, pool->dbLoc))
+        {
+            dc_free(env, server, sizeof(struct server));
+            return NULL;
+        }
+        server->pooled = false;
+    }
+
+    server->client_socket_fd = client_socket_fd;
+    server->timeouts = &pool->timeouts;
+    server->admission = &pool->admission;
+    server->admitted = false;
+    server->defer_io = false;
+    server->out_len = 0;
+    server->out_ref_len = 0;
+
+    return server;
+}
+
+void server_pool_checkin(const struct dc_posix_env *env,
+                         struct server_pool *pool, struct server *server)
+{
+    // a response cut short may still be spilled into the arena
+    if (server->out_pooled)
+    {
+        server->out = server->out_pooled;
+        server->out_cap = buffer_pool_capacity(server->out);
+        server->out_pooled = NULL;
+    }
+    server->out_ref = NULL;
+    server->out_ref_len = 0;
+    arena_reset(server->arena);
+    server->client_socket_fd = -1;
+
+    if (server->pooled)
+    {
+        pool->free_list[pool->free_count++] = server;
+    }
+    else
+    {
+        server_release(env, server);
+        dc_free(env, server, sizeof(struct server));
+    }
+}
+
+void server_pool_destroy(const struct dc_posix_env *env,
+                         struct server_pool **ppool)
+{
+    struct server_pool *pool = *ppool;
+    size_t i;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < pool->size; i++)
+    {
+        server_release(env, &pool->contexts[i]);
+    }
+
+    dc_free(env, pool->contexts, pool->size * sizeof(struct server));
+    dc_free(env, pool->free_list, pool->size * sizeof(struct server *));
+    dc_free(env, pool, sizeof(struct server_pool));
+
+    if (env->null_free)
+    {
+        *ppool = NULL;
+    }
+}
+
+static bool server_init(const struct dc_posix_env *env, struct dc_error *err,
+                        struct server *server, const char *dbLoc)
+{
+    server->dbLoc = dbLoc;
+    server->client_socket_fd = -1;
+    server->fsm_info = dc_fsm_info_create(env, err, "ProcessingFSM");
+    server->arena = arena_create(REQUEST_ARENA_SIZE);
+    server->recv_buf = buffer_pool_get(MAX_REQUEST_SIZE);
+    server->out = buffer_pool_get(MAX_REQUEST_SIZE);
+    server->out_len = 0;
+    server->out_cap = server->out ? buffer_pool_capacity(server->out) : 0;
+    server->out_pooled = NULL;
+    server->out_ref = NULL;
+    server->out_ref_len = 0;
+
+    if (dc_error_has_error(err) || server->arena == NULL ||
+        server->recv_buf == NULL || server->out == NULL)
+    {
+        server_release(env, server);
+        return false;
+    }
+
+    return true;
+}
+
+static void server_release(const struct dc_posix_env *env,
+                           struct server *server)
+{
+    if (server->fsm_info)
+    {
+        dc_fsm_info_destroy(env, &server->fsm_info);
+    }
+    arena_destroy(&server->arena);
+    buffer_pool_put(server->recv_buf);
+    buffer_pool_put(server->out);
+    server->fsm_info = NULL;
+    server->recv_buf = NULL;
+    server->out = NULL;
+}
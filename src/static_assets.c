@@ -0,0 +1,454 @@
+#include "static_assets.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_DEPTH 4
+#define MIN_SLOTS 16
+
+/**
+ * @brief Assets collected while walking the directory, hashed once the
+ * walk is done
+ *
+ */
+struct asset_list
+{
+    struct static_asset *items;
+    size_t count;
+    size_t cap;
+};
+
+static const char builtin_index[] = "Welcome to the Beacon Server ";
+static const char builtin_404[] =
+    "<!DOCTYPE html><html><head><title>Hey, 404 Not Found</title></head>"
+    "<body><p>404 Not Found: Don't do that.</p></body></html>";
+static const char *const connection_lines[2] = {"Connection: close\r\n",
+                                                "Connection: keep-alive\r\n"};
+
+static bool prepare(struct static_asset *asset, const char *path, int status,
+                    const char *type, const char *body, size_t len);
+static bool load_file(struct static_asset *asset, const char *path,
+                      const char *file);
+static bool walk(struct static_assets *assets, struct asset_list *list,
+                 const char *dir, const char *prefix, int depth);
+static bool build_slots(struct static_assets *assets, struct asset_list *list);
+static void release(struct static_asset *asset);
+static const char *content_type(const char *path);
+static size_t path_hash(const char *path, size_t len);
+
+struct static_assets *static_assets_load(const char *dir)
+{
+    struct static_assets *assets;
+    struct asset_list list = {NULL, 0, 0};
+
+    assets = calloc(1, sizeof(struct static_assets));
+    if (assets == NULL)
+    {
+        return NULL;
+    }
+    assets->index.fd = -1;
+    assets->not_found.fd = -1;
+
+    if (!prepare(&assets->index, "/", 200, "text/plain", builtin_index,
+                 sizeof(builtin_index) - 1) ||
+        !prepare(&assets->not_found, "/", 404, "text/html", builtin_404,
+                 sizeof(builtin_404) - 1) ||
+        (dir && !walk(assets, &list, dir, "", 0)) ||
+        !build_slots(assets, &list))
+    {
+        while (list.count)
+        {
+            release(&list.items[--list.count]);
+        }
+        free(list.items);
+        static_assets_destroy(&assets);
+        return NULL;
+    }
+    free(list.items);
+
+    return assets;
+}
+
+void static_assets_destroy(struct static_assets **passets)
+{
+    struct static_assets *assets = *passets;
+    size_t i;
+
+    if (assets == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; assets->slots && i <= assets->mask; i++)
+    {
+        if (assets->slots[i].path)
+        {
+            release(&assets->slots[i]);
+        }
+    }
+    free(assets->slots);
+    release(&assets->index);
+    release(&assets->not_found);
+    free(assets);
+    *passets = NULL;
+}
+
+const struct static_asset *static_assets_find(const struct static_assets *assets,
+                                              const char *path, size_t len)
+{
+    size_t i;
+    const struct static_asset *asset;
+
+    if (assets->count == 0)
+    {
+        return NULL;
+    }
+
+    for (i = path_hash(path, len) & assets->mask;; i = (i + 1) & assets->mask)
+    {
+        asset = &assets->slots[i];
+        if (asset->path == NULL)
+        {
+            return NULL;
+        }
+        if (asset->path_len == len && memcmp(asset->path, path, len) == 0)
+        {
+            return asset;
+        }
+    }
+}
+
+bool static_asset_is_large(const struct static_asset *asset)
+{
+    return asset->body_len > STATIC_INLINE_MAX;
+}
+
+/**
+ * @brief Builds the ready-made responses for an asset. The body is copied in
+ * behind the headers unless it is over STATIC_INLINE_MAX, in which case
+ * asset->body must already point at it and stay valid.
+ *
+ * @param asset
+ * @param path URL path, copied
+ * @param status 200 or 404
+ * @param type Content-Type
+ * @param body
+ * @param len
+ * @return false if out of memory
+ */
+static bool prepare(struct static_asset *asset, const char *path, int status,
+                    const char *type, const char *body, size_t len)
+{
+    char head[512];
+    int head_len;
+    uint64_t hash = UINT64_C(14695981039346656037);
+    bool inline_body = len <= STATIC_INLINE_MAX;
+    size_t i;
+    int keep;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)body[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    snprintf(asset->etag, sizeof(asset->etag), "\"%016" PRIx64 "\"", hash);
+    asset->path = strdup(path);
+    asset->path_len = strlen(path);
+    asset->status = status;
+    asset->body_len = len;
+    if (asset->path == NULL)
+    {
+        return false;
+    }
+
+    for (keep = 0; keep < 2; keep++)
+    {
+        head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.0 %d %s\r\nContent-Type: %s\r\n"
+                            "Content-Length: %zu\r\n%s%s%s%s\r\n",
+                            status, status == 200 ? "OK" : "Not Found", type,
+                            len, status == 200 ? "ETag: " : "",
+                            status == 200 ? asset->etag : "",
+                            status == 200 ? "\r\n" : "", connection_lines[keep]);
+        asset->head_len[keep] = (size_t)head_len;
+        asset->response_len[keep] = (size_t)head_len + (inline_body ? len : 0);
+        asset->response[keep] = malloc(asset->response_len[keep]);
+        if (asset->response[keep] == NULL)
+        {
+            return false;
+        }
+        memcpy(asset->response[keep], head, (size_t)head_len);
+        if (inline_body)
+        {
+            memcpy(asset->response[keep] + head_len, body, len);
+        }
+
+        head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.0 304 Not Modified\r\nETag: %s\r\n%s\r\n",
+                            asset->etag, connection_lines[keep]);
+        asset->not_modified_len[keep] = (size_t)head_len;
+        asset->not_modified[keep] = strdup(head);
+        if (asset->not_modified[keep] == NULL)
+        {
+            return false;
+        }
+    }
+
+    // inline bodies are read from the response copy from now on
+    if (inline_body)
+    {
+        asset->body = asset->response[1] + asset->head_len[1];
+    }
+
+    return true;
+}
+
+/**
+ * @brief Prepares a file. Large ones are mapped and their fd kept open for
+ * sendfile, which leaves the data in the page cache.
+ *
+ * @param asset
+ * @param path URL path
+ * @param file filesystem path
+ * @return false if out of memory; unreadable files are skipped
+ */
+static bool load_file(struct static_asset *asset, const char *path,
+                      const char *file)
+{
+    struct stat st;
+    char *body;
+    ssize_t count;
+    size_t len;
+    bool ok;
+
+    asset->fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (asset->fd < 0 || fstat(asset->fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "static: skipping %s\n", file);
+        if (asset->fd >= 0)
+        {
+            close(asset->fd);
+        }
+        asset->fd = -1;
+        return true;
+    }
+    len = (size_t)st.st_size;
+
+    if (len > STATIC_INLINE_MAX)
+    {
+        body = mmap(NULL, len, PROT_READ, MAP_SHARED, asset->fd, 0);
+        if (body == MAP_FAILED)
+        {
+            fprintf(stderr, "static: skipping %s\n", file);
+            close(asset->fd);
+            asset->fd = -1;
+            return true;
+        }
+        asset->mapped = body;
+        asset->body = body;
+        return prepare(asset, path, 200, content_type(path), body, len);
+    }
+
+    body = malloc(len ? len : 1);
+    if (body == NULL)
+    {
+        close(asset->fd);
+        asset->fd = -1;
+        return false;
+    }
+    for (count = 0; (size_t)count < len;)
+    {
+        ssize_t n = read(asset->fd, body + count, len - (size_t)count);
+        if (n <= 0)
+        {
+            break;
+        }
+        count += n;
+    }
+    close(asset->fd);
+    asset->fd = -1;
+    // a file that shrank under us is served as far as it was read
+    ok = prepare(asset, path, 200, content_type(path), body, (size_t)count);
+    free(body);
+
+    return ok;
+}
+
+static bool walk(struct static_assets *assets, struct asset_list *list,
+                 const char *dir, const char *prefix, int depth)
+{
+    DIR *d;
+    struct dirent *entry;
+    struct stat st;
+    char file[PATH_MAX];
+    char path[PATH_MAX];
+    struct static_asset *asset;
+    struct static_asset *grown;
+    bool ok = true;
+
+    d = opendir(dir);
+    if (d == NULL)
+    {
+        fprintf(stderr, "static: cannot open %s\n", dir);
+        return true;
+    }
+
+    while (ok && (entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.' ||
+            snprintf(file, sizeof(file), "%s/%s", dir, entry->d_name) >= (int)sizeof(file) ||
+            snprintf(path, sizeof(path), "%s/%s", prefix, entry->d_name) >= (int)sizeof(path) ||
+            stat(file, &st) < 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            if (depth < MAX_DEPTH)
+            {
+                ok = walk(assets, list, file, path, depth + 1);
+            }
+            continue;
+        }
+
+        if (list->count == list->cap)
+        {
+            list->cap = list->cap ? list->cap * 2 : MIN_SLOTS;
+            grown = realloc(list->items, list->cap * sizeof(struct static_asset));
+            if (grown == NULL)
+            {
+                ok = false;
+                break;
+            }
+            list->items = grown;
+        }
+        asset = &list->items[list->count];
+        memset(asset, 0, sizeof(*asset));
+        ok = load_file(asset, path, file);
+        if (!ok || asset->path == NULL)
+        {
+            release(asset);
+            continue;
+        }
+        list->count++;
+
+        // the top-level pages take over from the built-ins
+        if (depth == 0 && strcmp(entry->d_name, "index.html") == 0)
+        {
+            release(&assets->index);
+            memset(&assets->index, 0, sizeof(assets->index));
+            ok = load_file(&assets->index, path, file);
+        }
+        else if (depth == 0 && strcmp(entry->d_name, "404.html") == 0 &&
+                 !static_asset_is_large(asset))
+        {
+            // same body, but answered with a 404 status
+            release(&assets->not_found);
+            memset(&assets->not_found, 0, sizeof(assets->not_found));
+            assets->not_found.fd = -1;
+            ok = prepare(&assets->not_found, path, 404, "text/html", asset->body,
+                         asset->body_len);
+        }
+    }
+    closedir(d);
+
+    return ok;
+}
+
+static bool build_slots(struct static_assets *assets, struct asset_list *list)
+{
+    size_t slots = MIN_SLOTS;
+    size_t i;
+    size_t j;
+
+    while (slots < list->count * 2)
+    {
+        slots *= 2;
+    }
+    assets->slots = calloc(slots, sizeof(struct static_asset));
+    if (assets->slots == NULL)
+    {
+        return false;
+    }
+    assets->mask = slots - 1;
+
+    for (i = 0; i < list->count; i++)
+    {
+        for (j = path_hash(list->items[i].path, list->items[i].path_len) & assets->mask;
+             assets->slots[j].path; j = (j + 1) & assets->mask)
+        {
+        }
+        assets->slots[j] = list->items[i];
+    }
+    assets->count = list->count;
+    list->count = 0;
+
+    return true;
+}
+
+static void release(struct static_asset *asset)
+{
+    int keep;
+
+    if (asset->fd >= 0)
+    {
+        munmap(asset->mapped, asset->body_len);
+        asset->mapped = NULL;
+        close(asset->fd);
+        asset->fd = -1;
+    }
+    for (keep = 0; keep < 2; keep++)
+    {
+        free(asset->response[keep]);
+        free(asset->not_modified[keep]);
+        asset->response[keep] = NULL;
+        asset->not_modified[keep] = NULL;
+    }
+    free(asset->path);
+    asset->path = NULL;
+}
+
+static const char *content_type(const char *path)
+{
+    static const char *const types[][2] = {
+        {".html", "text/html"},        {".htm", "text/html"},
+        {".css", "text/css"},          {".js", "text/javascript"},
+        {".json", "application/json"}, {".svg", "image/svg+xml"},
+        {".png", "image/png"},         {".ico", "image/x-icon"},
+        {".txt", "text/plain"},        {".map", "application/json"},
+    };
+    const char *ext = strrchr(path, '.');
+    size_t i;
+
+    for (i = 0; ext && i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if (strcmp(ext, types[i][0]) == 0)
+        {
+            return types[i][1];
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+static size_t path_hash(const char *path, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)path[i];
+        hash *= 16777619u;
+    }
+
+    return hash ^ (hash >> 15);
+}
@@ -0,0 +1,907 @@
+// syscall(2) and MAP_POPULATE are hidden under strict POSIX
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include "uring_server.h"
+#include <errno.h>
+#include <stdlib.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+    defined(__NR_io_uring_register)
+#define URING_SERVER_SUPPORTED 1
+#endif
+#endif
+#endif
+
+#ifdef URING_SERVER_SUPPORTED
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "buffer_pool.h"
+#include "common.h"
+#include "fsm_trace.h"
+#include "http_scan.h"
+#include "metrics.h"
+
+/**
+ * @brief What a completion is for, kept in the low bits of its user_data
+ * next to the connection pointer
+ *
+ */
+enum uring_op
+{
+    OP_ACCEPT,
+    OP_TICK,
+    OP_READ,
+    OP_TIMEOUT,
+    OP_SEND,
+    OP_CLOSE
+};
+
+#define OP_MASK ((uint64_t)7)
+#define TICK_SECONDS 1
+
+/**
+ * @brief The mapped submission and completion rings. Entries are filled
+ * behind sq_local_tail and published to the kernel by ring_submit.
+ *
+ */
+struct ring
+{
+    int fd;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail;
+    _Atomic unsigned int *sq_head;
+    _Atomic unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    _Atomic unsigned int *cq_head;
+    _Atomic unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+};
+
+/**
+ * @brief One client. At most one read (with its linked timeout) or one send
+ * (with its linked close) is in flight, pending counts their completions.
+ *
+ */
+struct conn
+{
+    struct conn *prev;
+    struct conn *next;
+    struct server *server;
+    size_t len;
+    size_t request_len;
+    size_t sent;
+    uint64_t deadline;
+    int buf_index;
+    unsigned int pending;
+    uint32_t trace_connection;
+    bool keep_alive;
+    bool close_linked;
+    bool closing;
+    bool closed;
+    struct __kernel_timespec ts;
+};
+
+/**
+ * @brief Everything the completion handlers need
+ *
+ */
+struct loop
+{
+    const struct dc_posix_env *env;
+    struct dc_error *err;
+    struct server_pool *pool;
+    int listen_fd;
+    uring_server_handler handler;
+    struct ring ring;
+    struct conn *conns;
+    bool multishot;
+    bool accepted;
+    bool stopping;
+    bool unavailable;
+    bool registered;
+    unsigned int drain_ticks;
+    struct __kernel_timespec tick;
+};
+
+static int ring_setup(struct ring *ring, unsigned int entries);
+static void ring_destroy(struct ring *ring);
+static bool ring_room(struct ring *ring, unsigned int count);
+static struct io_uring_sqe *ring_sqe(struct ring *ring);
+static int ring_submit(struct ring *ring, unsigned int wait);
+static void register_buffers(struct loop *loop);
+static void arm_accept(struct loop *loop);
+static void arm_tick(struct loop *loop);
+static void arm_read(struct loop *loop, struct conn *conn);
+static void arm_send(struct loop *loop, struct conn *conn);
+static void arm_close(struct loop *loop, struct conn *conn);
+static void handle(struct loop *loop, uint64_t user_data, int res,
+                   unsigned int flags);
+static void on_accept(struct loop *loop, int res, unsigned int flags);
+static void on_read(struct loop *loop, struct conn *conn, int res);
+static void on_send(struct loop *loop, struct conn *conn, int res);
+static void conn_open(struct loop *loop, int fd);
+static void conn_advance(struct loop *loop, struct conn *conn);
+static void conn_serve(struct loop *loop, struct conn *conn, int received);
+static void conn_next(struct loop *loop, struct conn *conn);
+static void conn_settle(struct loop *loop, struct conn *conn);
+static uint64_t deadline_after(int ms);
+
+int uring_server_run(const struct dc_posix_env *env, struct dc_error *err,
+                     struct server_pool *pool, int listen_fd,
+                     uring_server_handler handler,
+                     volatile sig_atomic_t *stop)
+{
+    struct loop loop;
+    struct io_uring_cqe *cqe;
+    struct conn *conn;
+    unsigned int head;
+    uint64_t user_data;
+    int res;
+    unsigned int flags;
+
+    memset(&loop, 0, sizeof(loop));
+    loop.env = env;
+    loop.err = err;
+    loop.pool = pool;
+    loop.listen_fd = listen_fd;
+    loop.handler = handler;
+    loop.multishot = true;
+    loop.tick.tv_sec = TICK_SECONDS;
+
+    if (ring_setup(&loop.ring, URING_SERVER_ENTRIES) < 0)
+    {
+        return -1;
+    }
+
+    register_buffers(&loop);
+    arm_accept(&loop);
+    arm_tick(&loop);
+    while (!loop.unavailable)
+    {
+        if (*stop && !loop.stopping)
+        {
+            loop.stopping = true;
+            for (conn = loop.conns; conn; conn = conn->next)
+            {
+                // wakes the pending read so the connection winds down
+                shutdown(conn->server->client_socket_fd, SHUT_RDWR);
+            }
+        }
+        // give stragglers a couple of ticks to finish their last send
+        if (loop.stopping && (loop.conns == NULL || loop.drain_ticks > 1))
+        {
+            break;
+        }
+
+        if (ring_submit(&loop.ring, 1) < 0 && errno != EINTR &&
+            errno != EAGAIN && errno != EBUSY)
+        {
+            break;
+        }
+
+        head = atomic_load_explicit(loop.ring.cq_head, memory_order_relaxed);
+        while (head != atomic_load_explicit(loop.ring.cq_tail, memory_order_acquire))
+        {
+            cqe = &loop.ring.cqes[head & *loop.ring.cq_mask];
+            user_data = cqe->user_data;
+            res = cqe->res;
+            flags = cqe->flags;
+            atomic_store_explicit(loop.ring.cq_head, ++head, memory_order_release);
+            handle(&loop, user_data, res, flags);
+        }
+    }
+
+    // tearing the ring down cancels whatever is still in flight, after that
+    // the leftover connections can go
+    ring_destroy(&loop.ring);
+    while (loop.conns)
+    {
+        conn = loop.conns;
+        conn->pending = 0;
+        conn->closing = true;
+        conn_settle(&loop, conn);
+    }
+
+    if (loop.unavailable)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ring_setup(struct ring *ring, unsigned int entries)
+{
+    struct io_uring_params params;
+    size_t sq_len;
+    size_t cq_len;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 2;
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+
+    sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+    }
+
+    ring->sq_map = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+    {
+        ring->sq_map = NULL;
+        ring_destroy(ring);
+        return -1;
+    }
+    ring->sq_map_len = sq_len;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_map = ring->sq_map;
+    }
+    else
+    {
+        ring->cq_map = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED)
+        {
+            ring->cq_map = NULL;
+            ring_destroy(ring);
+            return -1;
+        }
+        ring->cq_map_len = cq_len;
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        ring_destroy(ring);
+        return -1;
+    }
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_head = (_Atomic unsigned int *)((char *)ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned int *)((char *)ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_map + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned int *)((char *)ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned int *)((char *)ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map + params.cq_off.cqes);
+    ring->sq_local_tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+
+    return 0;
+}
+
+static void ring_destroy(struct ring *ring)
+{
+    int saved_errno = errno;
+
+    if (ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    if (ring->sq_map)
+    {
+        munmap(ring->sq_map, ring->sq_map_len);
+    }
+    close(ring->fd);
+    errno = saved_errno;
+}
+
+/**
+ * @brief Makes sure count entries can be queued back to back, so a linked
+ * pair is never split across two submissions
+ *
+ * @param ring
+ * @param count
+ * @return false if the kernel would not take the queued entries
+ */
+static bool ring_room(struct ring *ring, unsigned int count)
+{
+    unsigned int head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+
+    if (ring->sq_local_tail - head + count <= ring->sq_entries)
+    {
+        return true;
+    }
+    ring_submit(ring, 0);
+    head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+
+    return ring->sq_local_tail - head + count <= ring->sq_entries;
+}
+
+static struct io_uring_sqe *ring_sqe(struct ring *ring)
+{
+    unsigned int index;
+    struct io_uring_sqe *sqe;
+
+    if (!ring_room(ring, 1))
+    {
+        return NULL;
+    }
+
+    index = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+/**
+ * @brief Publishes queued entries and hands them to the kernel in one call,
+ * optionally waiting for a completion
+ *
+ * @param ring
+ * @param wait completions to wait for
+ * @return entries submitted, or -1 with errno set
+ */
+static int ring_submit(struct ring *ring, unsigned int wait)
+{
+    unsigned int head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    unsigned int count = ring->sq_local_tail - head;
+
+    atomic_store_explicit(ring->sq_tail, ring->sq_local_tail, memory_order_release);
+
+    return (int)syscall(__NR_io_uring_enter, ring->fd, count, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/**
+ * @brief Registers the pool's receive buffers, read into with READ_FIXED to
+ * save the kernel mapping the pages on every read. Without them, as on a
+ * tight RLIMIT_MEMLOCK, plain reads still work.
+ *
+ * @param loop
+ */
+static void register_buffers(struct loop *loop)
+{
+    struct iovec *iovs;
+    size_t i;
+
+    if (loop->pool->size == 0)
+    {
+        return;
+    }
+
+    iovs = calloc(loop->pool->size, sizeof(struct iovec));
+    if (iovs == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < loop->pool->size; i++)
+    {
+        iovs[i].iov_base = loop->pool->contexts[i].recv_buf;
+        iovs[i].iov_len = buffer_pool_capacity(loop->pool->contexts[i].recv_buf);
+    }
+    loop->registered = syscall(__NR_io_uring_register, loop->ring.fd,
+                               IORING_REGISTER_BUFFERS, iovs,
+                               (unsigned int)loop->pool->size) == 0;
+    free(iovs);
+}
+
+static void arm_accept(struct loop *loop)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+
+    if (sqe == NULL)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    // one submission keeps accepting until it fails, see IORING_CQE_F_MORE
+    sqe->ioprio = loop->multishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = OP_ACCEPT;
+}
+
+/**
+ * @brief A periodic timeout so the wait returns to look at the stop flag
+ * even when no client is active
+ *
+ * @param loop
+ */
+static void arm_tick(struct loop *loop)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&loop->ring);
+
+    if (sqe == NULL)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->tick;
+    sqe->len = 1;
+    sqe->user_data = OP_TICK;
+}
+
+static void arm_read(struct loop *loop, struct conn *conn)
+{
+    struct server *server = conn->server;
+    struct io_uring_sqe *sqe;
+
+    if (!ring_room(&loop->ring, 2))
+    {
+        arm_close(loop, conn);
+        return;
+    }
+
+    sqe = ring_sqe(&loop->ring);
+    sqe->opcode = conn->buf_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = server->client_socket_fd;
+    sqe->addr = (uint64_t)(uintptr_t)(server->recv_buf + conn->len);
+    sqe->len = (unsigned int)(MAX_REQUEST_SIZE - 1 - conn->len);
+    sqe->buf_index = (uint16_t)(conn->buf_index >= 0 ? conn->buf_index : 0);
+    sqe->user_data = (uint64_t)(uintptr_t)conn | OP_READ;
+    conn->pending++;
+
+    if (conn->deadline)
+    {
+        // the read is cancelled when the phase deadline passes
+        conn->ts.tv_sec = (int64_t)(conn->deadline / 1000000000u);
+        conn->ts.tv_nsec = (int64_t)(conn->deadline % 1000000000u);
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe = ring_sqe(&loop->ring);
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = (uint64_t)(uintptr_t)&conn->ts;
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS;
+        sqe->user_data = (uint64_t)(uintptr_t)conn | OP_TIMEOUT;
+        conn->pending++;
+    }
+}
+
+static void arm_send(struct loop *loop, struct conn *conn)
+{
+    struct server *server = conn->server;
+    struct io_uring_sqe *sqe;
+    bool last = server->out_ref_len == 0 || conn->sent >= server->out_len;
+
+    if (!ring_room(&loop->ring, 2))
+    {
+        arm_close(loop, conn);
+        return;
+    }
+
+    sqe = ring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = server->client_socket_fd;
+    // the headers in out, then any referenced body straight from where it lives
+    if (conn->sent < server->out_len)
+    {
+        sqe->addr = (uint64_t)(uintptr_t)(server->out + conn->sent);
+        sqe->len = (unsigned int)(server->out_len - conn->sent);
+    }
+    else
+    {
+        sqe->addr = (uint64_t)(uintptr_t)(server->out_ref + conn->sent - server->out_len);
+        sqe->len = (unsigned int)(server->out_len + server->out_ref_len - conn->sent);
+    }
+    // a short send fails the request, which also cancels the linked close
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | OP_SEND;
+    conn->pending++;
+
+    if (!conn->keep_alive && last)
+    {
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe = ring_sqe(&loop->ring);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = server->client_socket_fd;
+        sqe->user_data = (uint64_t)(uintptr_t)conn | OP_CLOSE;
+        conn->pending++;
+        conn->close_linked = true;
+        conn->closing = true;
+    }
+}
+
+static void arm_close(struct loop *loop, struct conn *conn)
+{
+    struct io_uring_sqe *sqe;
+
+    conn->closing = true;
+    sqe = ring_sqe(&loop->ring);
+    if (sqe == NULL)
+    {
+        close(conn->server->client_socket_fd);
+        conn->closed = true;
+        conn_settle(loop, conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->server->client_socket_fd;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | OP_CLOSE;
+    conn->pending++;
+}
+
+static void handle(struct loop *loop, uint64_t user_data, int res,
+                   unsigned int flags)
+{
+    struct conn *conn = (struct conn *)(uintptr_t)(user_data & ~OP_MASK);
+    enum uring_op op = (enum uring_op)(user_data & OP_MASK);
+
+    switch (op)
+    {
+        case OP_ACCEPT:
+            on_accept(loop, res, flags);
+            return;
+        case OP_TICK:
+            loop->drain_ticks += loop->stopping;
+            arm_tick(loop);
+            return;
+        case OP_READ:
+            conn->pending--;
+            on_read(loop, conn, res);
+            break;
+        case OP_TIMEOUT:
+            conn->pending--;
+            break;
+        case OP_SEND:
+            conn->pending--;
+            on_send(loop, conn, res);
+            break;
+        case OP_CLOSE:
+            conn->pending--;
+            // a cancelled linked close is redone by on_send
+            if (res != -ECANCELED)
+            {
+                conn->closed = true;
+            }
+            break;
+        default:
+            // no such op is ever submitted
+            return;
+    }
+    conn_settle(loop, conn);
+}
+
+static void on_accept(struct loop *loop, int res, unsigned int flags)
+{
+    if (res >= 0 && loop->stopping)
+    {
+        // the multishot accept outlives the stop flag
+        close(res);
+    }
+    else if (res >= 0)
+    {
+        loop->accepted = true;
+        conn_open(loop, res);
+    }
+    else if (res == -EINVAL && !loop->accepted)
+    {
+        // kernels before 5.19 have no multishot accept, older ones no accept
+        if (!loop->multishot)
+        {
+            loop->unavailable = true;
+            return;
+        }
+        loop->multishot = false;
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) && !loop->stopping)
+    {
+        arm_accept(loop);
+    }
+}
+
+static void on_read(struct loop *loop, struct conn *conn, int res)
+{
+    struct server *server = conn->server;
+
+    if (conn->closing)
+    {
+        return;
+    }
+
+    if (res == -EINTR || res == -EAGAIN)
+    {
+        arm_read(loop, conn);
+    }
+    else if (res == -ECANCELED)
+    {
+        // the linked deadline passed, same outcome as receive_data's
+        if (conn->len == 0)
+        {
+            arm_close(loop, conn);
+        }
+        else
+        {
+            conn_serve(loop, conn, RECEIVE_TIMED_OUT);
+        }
+    }
+    else if (res < 0 || (res == 0 && conn->len == 0))
+    {
+        arm_close(loop, conn);
+    }
+    else if (res == 0)
+    {
+        // peer finished sending mid-request, answer what arrived
+        conn_serve(loop, conn, EXIT_SUCCESS);
+    }
+    else
+    {
+        // the header clock starts with the first byte of the request
+        if (conn->len == 0)
+        {
+            conn->deadline = deadline_after(server->timeouts->header_ms);
+        }
+        conn->len += (size_t)res;
+        server->recv_buf[conn->len] = '\0';
+        conn_advance(loop, conn);
+    }
+}
+
+static void on_send(struct loop *loop, struct conn *conn, int res)
+{
+    struct server *server = conn->server;
+
+    if (res > 0)
+    {
+        conn->sent += (size_t)res;
+        metrics_bytes(0, (size_t)res);
+    }
+
+    if (conn->sent >= server->out_len + server->out_ref_len)
+    {
+        // a linked close is on its way, otherwise on to the next request
+        if (!conn->close_linked)
+        {
+            conn_next(loop, conn);
+        }
+        return;
+    }
+
+    conn->close_linked = false;
+    conn->closing = false;
+    if (res <= 0 || loop->stopping)
+    {
+        arm_close(loop, conn);
+    }
+    else
+    {
+        arm_send(loop, conn);
+    }
+}
+
+static void conn_open(struct loop *loop, int fd)
+{
+    struct conn *conn;
+    struct server *server;
+
+    if (admission_connection(&loop->pool->admission, fd, loop->listen_fd) !=
+        ADMISSION_ADMIT)
+    {
+        admission_reject_connection(&loop->pool->admission, fd);
+        metrics_request(METRICS_ROUTE_UNMATCHED, SERVICE_UNAVAILABLE);
+        close(fd);
+        return;
+    }
+
+    conn = calloc(1, sizeof(struct conn));
+    server = conn ? server_pool_checkout(loop->env, loop->err, loop->pool, fd) : NULL;
+    if (server == NULL)
+    {
+        free(conn);
+        dc_error_reset(loop->err);
+        admission_connection_done(&loop->pool->admission);
+        close(fd);
+        return;
+    }
+
+    server->defer_io = true;
+    conn->server = server;
+    conn->buf_index = loop->registered && server->pooled
+                          ? (int)(server - loop->pool->contexts)
+                          : -1;
+    conn->deadline = deadline_after(server->timeouts->idle_ms);
+    conn->trace_connection = fsm_trace_enabled() ? fsm_trace_next_connection() : 0;
+    conn->next = loop->conns;
+    if (loop->conns)
+    {
+        loop->conns->prev = conn;
+    }
+    loop->conns = conn;
+    metrics_connection_opened();
+
+    arm_read(loop, conn);
+}
+
+/**
+ * @brief Serves the buffered request once all of it is in, or reads more
+ *
+ * @param loop
+ * @param conn
+ */
+static void conn_advance(struct loop *loop, struct conn *conn)
+{
+    struct server *server = conn->server;
+
+    if (conn->request_len == 0)
+    {
+        conn->request_len = http_scan_request_length(server->recv_buf, conn->len);
+        if (conn->request_len)
+        {
+            conn->deadline = deadline_after(server->timeouts->body_ms);
+        }
+    }
+
+    if (conn->request_len && conn->len >= conn->request_len)
+    {
+        conn_serve(loop, conn, EXIT_SUCCESS);
+    }
+    // refused as soon as the headers say so, the body is never read
+    else if (conn->request_len > MAX_REQUEST_SIZE - 1)
+    {
+        conn_serve(loop, conn, RECEIVE_TOO_LARGE);
+    }
+    else if (conn->len >= MAX_REQUEST_SIZE - 1)
+    {
+        conn_serve(loop, conn, EXIT_FAILURE);
+    }
+    else
+    {
+        arm_read(loop, conn);
+    }
+}
+
+static void conn_serve(struct loop *loop, struct conn *conn, int received)
+{
+    struct server *server = conn->server;
+    size_t end = conn->request_len && conn->request_len < conn->len
+                     ? conn->request_len
+                     : conn->len;
+    char saved = server->recv_buf[end];
+
+    // a pipelined request behind this one stays put for conn_next
+    server->recv_buf[end] = '\0';
+    fsm_trace_set_connection(conn->trace_connection);
+    conn->keep_alive = loop->handler(loop->env, loop->err, server, received) &&
+                       !loop->stopping;
+    server->recv_buf[end] = saved;
+    conn->request_len = end;
+    if (dc_error_has_error(loop->err))
+    {
+        conn->keep_alive = false;
+        dc_error_reset(loop->err);
+    }
+
+    conn->sent = 0;
+    if (server->out_len > 0)
+    {
+        arm_send(loop, conn);
+    }
+    else if (conn->keep_alive)
+    {
+        conn_next(loop, conn);
+    }
+    else
+    {
+        arm_close(loop, conn);
+    }
+}
+
+/**
+ * @brief Clears the finished request and starts on the next one
+ *
+ * @param loop
+ * @param conn
+ */
+static void conn_next(struct loop *loop, struct conn *conn)
+{
+    struct server *server = conn->server;
+
+    if (server->out_pooled)
+    {
+        server->out = server->out_pooled;
+        server->out_cap = buffer_pool_capacity(server->out);
+        server->out_pooled = NULL;
+    }
+    server->out_len = 0;
+    server->out_ref_len = 0;
+    arena_reset(server->arena);
+
+    conn->len -= conn->request_len;
+    memmove(server->recv_buf, server->recv_buf + conn->request_len, conn->len);
+    server->recv_buf[conn->len] = '\0';
+    conn->request_len = 0;
+    conn->deadline = deadline_after(conn->len ? server->timeouts->header_ms
+                                              : server->timeouts->idle_ms);
+    conn_advance(loop, conn);
+}
+
+/**
+ * @brief Frees a closing connection once nothing of it is left in flight
+ *
+ * @param loop
+ * @param conn
+ */
+static void conn_settle(struct loop *loop, struct conn *conn)
+{
+    if (!conn->closing || conn->pending > 0)
+    {
+        return;
+    }
+
+    if (!conn->closed)
+    {
+        close(conn->server->client_socket_fd);
+    }
+    if (conn->prev)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        loop->conns = conn->next;
+    }
+    if (conn->next)
+    {
+        conn->next->prev = conn->prev;
+    }
+
+    server_pool_checkin(loop->env, loop->pool, conn->server);
+    admission_connection_done(&loop->pool->admission);
+    metrics_connection_closed();
+    free(conn);
+}
+
+static uint64_t deadline_after(int ms)
+{
+    return ms < 0 ? 0 : metrics_now_ns() + (uint64_t)ms * 1000000u;
+}
+
+#else
+
+int uring_server_run(__attribute__((unused)) const struct dc_posix_env *env,
+                     __attribute__((unused)) struct dc_error *err,
+                     __attribute__((unused)) struct server_pool *pool,
+                     __attribute__((unused)) int listen_fd,
+                     __attribute__((unused)) uring_server_handler handler,
+                     __attribute__((unused)) volatile sig_atomic_t *stop)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,412 @@
+#include "wal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/**
+ * @brief Record header: length and CRC-32 of the body
+ *
+ */
+#define HEADER_SIZE 8
+/**
+ * @brief Body header: key and value lengths
+ *
+ */
+#define BODY_HEADER_SIZE 4
+#define MIN_CAP 4096
+
+struct wal
+{
+    int fd;
+    enum wal_sync sync;
+    int batch_ms;
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    uint64_t size;
+    atomic_bool dirty;
+    pthread_t flusher;
+    bool flushing;
+    pthread_mutex_t lock;
+    pthread_cond_t stop;
+    bool stopping;
+};
+
+static bool replay(struct wal *wal, wal_visitor visit, void *arg);
+static ssize_t read_full(int fd, void *buf, size_t len);
+static bool start_flusher(struct wal *wal);
+static void *flush_loop(void *arg);
+static void put16(uint8_t *at, size_t value);
+static void put32(uint8_t *at, uint32_t value);
+static uint32_t get32(const uint8_t *at);
+
+struct wal *wal_open(const char *path, enum wal_sync sync, int batch_ms,
+                     wal_visitor visit, void *arg)
+{
+    struct wal *wal;
+
+    wal = calloc(1, sizeof(struct wal));
+    if (wal == NULL)
+    {
+        return NULL;
+    }
+    wal->sync = sync;
+    wal->batch_ms = batch_ms > 0 ? batch_ms : 1;
+    atomic_init(&wal->dirty, false);
+    wal->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (wal->fd < 0 || !replay(wal, visit, arg) ||
+        (sync == WAL_SYNC_BATCH && !start_flusher(wal)))
+    {
+        if (wal->fd >= 0)
+        {
+            close(wal->fd);
+        }
+        free(wal);
+        return NULL;
+    }
+
+    return wal;
+}
+
+void wal_close(struct wal **pwal)
+{
+    struct wal *wal = *pwal;
+
+    if (wal == NULL)
+    {
+        return;
+    }
+
+    if (wal->flushing)
+    {
+        pthread_mutex_lock(&wal->lock);
+        wal->stopping = true;
+        pthread_cond_signal(&wal->stop);
+        pthread_mutex_unlock(&wal->lock);
+        pthread_join(wal->flusher, NULL);
+        pthread_cond_destroy(&wal->stop);
+        pthread_mutex_destroy(&wal->lock);
+    }
+    wal_commit(wal);
+    fdatasync(wal->fd);
+    close(wal->fd);
+    free(wal->buf);
+    free(wal);
+    *pwal = NULL;
+}
+
+bool wal_append(struct wal *wal, const char *key, const char *value)
+{
+    size_t keyLen = strlen(key);
+    size_t valueLen = strlen(value);
+    size_t body = BODY_HEADER_SIZE + keyLen + valueLen;
+    size_t cap;
+    uint8_t *grown;
+    uint8_t *record;
+
+    if (keyLen > UINT16_MAX || valueLen > UINT16_MAX ||
+        keyLen + valueLen > WAL_MAX_RECORD)
+    {
+        return false;
+    }
+    if (HEADER_SIZE + body > wal->cap - wal->len)
+    {
+        cap = wal->cap ? wal->cap : MIN_CAP;
+        while (cap - wal->len < HEADER_SIZE + body)
+        {
+            cap *= 2;
+        }
+        grown = realloc(wal->buf, cap);
+        if (grown == NULL)
+        {
+            return false;
+        }
+        wal->buf = grown;
+        wal->cap = cap;
+    }
+
+    record = wal->buf + wal->len;
+    put16(record + HEADER_SIZE, keyLen);
+    put16(record + HEADER_SIZE + 2, valueLen);
+    memcpy(record + HEADER_SIZE + BODY_HEADER_SIZE, key, keyLen);
+    memcpy(record + HEADER_SIZE + BODY_HEADER_SIZE + keyLen, value, valueLen);
+    put32(record, (uint32_t)body);
+    put32(record + 4, (uint32_t)crc32(0L, record + HEADER_SIZE, (uInt)body));
+    wal->len += HEADER_SIZE + body;
+
+    return true;
+}
+
+bool wal_commit(struct wal *wal)
+{
+    size_t off = 0;
+    ssize_t written;
+
+    while (off < wal->len)
+    {
+        written = write(wal->fd, wal->buf + off, wal->len - off);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            // a partial record would end the next replay early, drop it
+            if (off > 0 && ftruncate(wal->fd, (off_t)wal->size) == 0)
+            {
+                lseek(wal->fd, (off_t)wal->size, SEEK_SET);
+            }
+            wal->len = 0;
+            return false;
+        }
+        off += (size_t)written;
+    }
+    wal->size += wal->len;
+    wal->len = 0;
+
+    if (wal->sync == WAL_SYNC_ALWAYS)
+    {
+        return off == 0 || fdatasync(wal->fd) == 0;
+    }
+    if (off > 0 && wal->sync == WAL_SYNC_BATCH)
+    {
+        atomic_store_explicit(&wal->dirty, true, memory_order_release);
+    }
+
+    return true;
+}
+
+uint64_t wal_size(const struct wal *wal)
+{
+    return wal->size;
+}
+
+bool wal_checkpoint(struct wal *wal)
+{
+    if (ftruncate(wal->fd, 0) != 0 || lseek(wal->fd, 0, SEEK_SET) != 0)
+    {
+        return false;
+    }
+    wal->size = 0;
+
+    return fdatasync(wal->fd) == 0;
+}
+
+bool wal_parse_sync(const char *name, enum wal_sync *sync)
+{
+    if (strcasecmp(name, "always") == 0)
+    {
+        *sync = WAL_SYNC_ALWAYS;
+    }
+    else if (strcasecmp(name, "batch") == 0)
+    {
+        *sync = WAL_SYNC_BATCH;
+    }
+    else if (strcasecmp(name, "none") == 0)
+    {
+        *sync = WAL_SYNC_NONE;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Feeds every whole record to visit and cuts the log after the last
+ * one, leaving it positioned for appends
+ *
+ * @param wal
+ * @param visit
+ * @param arg
+ * @return false if reading failed or visit did
+ */
+static bool replay(struct wal *wal, wal_visitor visit, void *arg)
+{
+    uint8_t header[HEADER_SIZE];
+    uint8_t *body = NULL;
+    char *key;
+    char *value;
+    size_t bodyLen;
+    size_t keyLen;
+    size_t valueLen;
+    ssize_t got;
+    bool ok = true;
+
+    // key\0value\0 unpacked behind the body
+    body = malloc(2 * (BODY_HEADER_SIZE + WAL_MAX_RECORD) + 2);
+    if (body == NULL)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        got = read_full(wal->fd, header, HEADER_SIZE);
+        if (got != HEADER_SIZE)
+        {
+            ok = got >= 0;
+            break;
+        }
+        bodyLen = get32(header);
+        if (bodyLen < BODY_HEADER_SIZE ||
+            bodyLen > BODY_HEADER_SIZE + WAL_MAX_RECORD)
+        {
+            break;
+        }
+        got = read_full(wal->fd, body, bodyLen);
+        if (got != (ssize_t)bodyLen)
+        {
+            ok = got >= 0;
+            break;
+        }
+        keyLen = (size_t)((body[0] << 8) | body[1]);
+        valueLen = (size_t)((body[2] << 8) | body[3]);
+        if (BODY_HEADER_SIZE + keyLen + valueLen != bodyLen ||
+            get32(header + 4) != (uint32_t)crc32(0L, body, (uInt)bodyLen))
+        {
+            break;
+        }
+
+        key = (char *)body + bodyLen;
+        memcpy(key, body + BODY_HEADER_SIZE, keyLen);
+        key[keyLen] = '\0';
+        value = key + keyLen + 1;
+        memcpy(value, body + BODY_HEADER_SIZE + keyLen, valueLen);
+        value[valueLen] = '\0';
+        if (!visit(arg, key, value))
+        {
+            ok = false;
+            break;
+        }
+        wal->size += HEADER_SIZE + bodyLen;
+    }
+    free(body);
+
+    // whatever follows the last whole record was never acknowledged
+    return ok && ftruncate(wal->fd, (off_t)wal->size) == 0 &&
+           lseek(wal->fd, (off_t)wal->size, SEEK_SET) == (off_t)wal->size;
+}
+
+static ssize_t read_full(int fd, void *buf, size_t len)
+{
+    size_t off = 0;
+    ssize_t got;
+
+    while (off < len)
+    {
+        got = read(fd, (uint8_t *)buf + off, len - off);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got < 0)
+        {
+            return -1;
+        }
+        if (got == 0)
+        {
+            break;
+        }
+        off += (size_t)got;
+    }
+
+    return (ssize_t)off;
+}
+
+static bool start_flusher(struct wal *wal)
+{
+    pthread_condattr_t attr;
+    sigset_t all;
+    sigset_t old;
+    int rc;
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal->stop, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // signals stay with the serving threads, which act on them
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&wal->flusher, NULL, flush_loop, wal);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        pthread_cond_destroy(&wal->stop);
+        pthread_mutex_destroy(&wal->lock);
+        return false;
+    }
+    wal->flushing = true;
+
+    return true;
+}
+
+/**
+ * @brief Syncs the log every batch_ms if anything was written, one sync for
+ * every commit in between
+ *
+ * @param arg
+ * @return void*
+ */
+static void *flush_loop(void *arg)
+{
+    struct wal *wal = (struct wal *)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&wal->lock);
+    while (!wal->stopping)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += wal->batch_ms / 1000;
+        deadline.tv_nsec += (long)(wal->batch_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wal->stop, &wal->lock, &deadline);
+
+        if (atomic_exchange_explicit(&wal->dirty, false, memory_order_acquire))
+        {
+            pthread_mutex_unlock(&wal->lock);
+            fdatasync(wal->fd);
+            pthread_mutex_lock(&wal->lock);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    return NULL;
+}
+
+static void put16(uint8_t *at, size_t value)
+{
+    at[0] = (uint8_t)(value >> 8);
+    at[1] = (uint8_t)value;
+}
+
+static void put32(uint8_t *at, uint32_t value)
+{
+    at[0] = (uint8_t)(value >> 24);
+    at[1] = (uint8_t)(value >> 16);
+    at[2] = (uint8_t)(value >> 8);
+    at[3] = (uint8_t)value;
+}
+
+static uint32_t get32(const uint8_t *at)
+{
+    return ((uint32_t)at[0] << 24) | ((uint32_t)at[1] << 16) |
+           ((uint32_t)at[2] << 8) | (uint32_t)at[3];
+}
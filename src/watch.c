@@ -0,0 +1,275 @@
+#include "watch.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "buffer_pool.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * @brief Changes taken off the queue per write
+ *
+ */
+#define BATCH 16
+/**
+ * @brief How often an idle stream looks for a client that hung up
+ *
+ */
+#define POLL_MS 1000
+
+/**
+ * @brief One open stream
+ *
+ */
+struct watch
+{
+    struct change_subscriber *sub;
+    int fd;
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+static const char stream_head[] =
+    "HTTP/1.0 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: "
+    "no-cache\r\nConnection: close\r\n\r\nretry: 2000\n\n";
+
+static void *stream(void *arg);
+static bool append(struct watch *watch, const char *data, size_t len);
+static bool append_json(struct watch *watch, const char *str, size_t len);
+static bool append_change(struct watch *watch, const struct change *change);
+static bool send_all(int fd, const char *data, size_t len);
+static bool hung_up(int fd);
+
+bool watch_start(struct change_subscriber *sub, int fd)
+{
+    struct watch *watch;
+    pthread_t thread;
+    pthread_attr_t attr;
+    sigset_t all;
+    sigset_t old;
+    int rc;
+
+    watch = calloc(1, sizeof(struct watch));
+    if (watch == NULL)
+    {
+        return false;
+    }
+    watch->sub = sub;
+    watch->fd = fd;
+
+    // signals stay with the serving threads, which act on them
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, stream, watch);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        free(watch);
+        return false;
+    }
+
+    return true;
+}
+
+static void *stream(void *arg)
+{
+    struct watch *watch = (struct watch *)arg;
+    struct change *changes[BATCH];
+    struct timeval timeout = {WATCH_SEND_TIMEOUT_MS / 1000,
+                              (WATCH_SEND_TIMEOUT_MS % 1000) * 1000};
+    char line[64];
+    uint64_t dropped;
+    int idle = 0;
+    bool ok;
+    int taken;
+    int i;
+
+    setsockopt(watch->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ok = send_all(watch->fd, stream_head, sizeof(stream_head) - 1);
+
+    while (ok)
+    {
+        taken = change_feed_wait(watch->sub, changes, BATCH, &dropped, POLL_MS);
+        if (taken == CHANGE_FEED_SLOW)
+        {
+            // tell the client why, it has to resync from ?all
+            send(watch->fd, "event: overflow\ndata: \n\n", 24,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+            break;
+        }
+        if (taken < 0)
+        {
+            break;
+        }
+
+        if (taken == 0 && !dropped)
+        {
+            idle += POLL_MS;
+            if (hung_up(watch->fd))
+            {
+                break;
+            }
+            if (idle < WATCH_KEEPALIVE_MS)
+            {
+                continue;
+            }
+        }
+        idle = 0;
+
+        watch->len = 0;
+        if (dropped)
+        {
+            snprintf(line, sizeof(line), "event: dropped\ndata: %" PRIu64 "\n\n",
+                     dropped);
+            ok = append(watch, line, strlen(line));
+        }
+        for (i = 0; i < taken; i++)
+        {
+            ok = ok && append_change(watch, changes[i]);
+            change_release(changes[i]);
+        }
+        if (taken == 0 && !dropped)
+        {
+            ok = append(watch, ": keepalive\n\n", 13);
+        }
+        ok = ok && send_all(watch->fd, watch->buf, watch->len);
+    }
+
+    close(watch->fd);
+    change_feed_unsubscribe(watch->sub);
+    free(watch->buf);
+    free(watch);
+    buffer_pool_thread_flush();
+
+    return NULL;
+}
+
+static bool append(struct watch *watch, const char *data, size_t len)
+{
+    size_t cap;
+    char *grown;
+
+    if (len > watch->cap - watch->len)
+    {
+        cap = watch->cap ? watch->cap : 1024;
+        while (cap - watch->len < len)
+        {
+            cap *= 2;
+        }
+        grown = realloc(watch->buf, cap);
+        if (grown == NULL)
+        {
+            return false;
+        }
+        watch->buf = grown;
+        watch->cap = cap;
+    }
+    memcpy(watch->buf + watch->len, data, len);
+    watch->len += len;
+
+    return true;
+}
+
+/**
+ * @brief Appends str as a JSON string. Escaping control characters also keeps
+ * the event's data on one line, as SSE requires.
+ *
+ * @param watch
+ * @param str
+ * @param len
+ * @return false if out of memory
+ */
+static bool append_json(struct watch *watch, const char *str, size_t len)
+{
+    char escape[8];
+    size_t start = 0;
+    size_t i;
+    unsigned char c;
+    bool ok = append(watch, "\"", 1);
+
+    for (i = 0; ok && i < len; i++)
+    {
+        c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        if (c == '"' || c == '\\')
+        {
+            escape[0] = '\\';
+            escape[1] = (char)c;
+            escape[2] = '\0';
+        }
+        else
+        {
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+        }
+        ok = append(watch, str + start, i - start) &&
+             append(watch, escape, strlen(escape));
+        start = i + 1;
+    }
+
+    return ok && append(watch, str + start, len - start) &&
+           append(watch, "\"", 1);
+}
+
+static bool append_change(struct watch *watch, const struct change *change)
+{
+    char head[64];
+
+    snprintf(head, sizeof(head), "id: %" PRIu64 "\nevent: put\ndata: {\"key\":",
+             change->seq);
+
+    return append(watch, head, strlen(head)) &&
+           append_json(watch, change->key, change->key_len) &&
+           append(watch, ",\"value\":", 9) &&
+           append_json(watch, change->value, change->value_len) &&
+           append(watch, "}\n\n", 3);
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        len -= (size_t)sent;
+    }
+
+    return true;
+}
+
+/**
+ * @brief A watch client never sends anything, so a readable socket means it
+ * closed its end (or broke protocol, which ends the stream just the same)
+ *
+ * @param fd
+ * @return true if the stream should end
+ */
+static bool hung_up(int fd)
+{
+    char byte;
+    ssize_t got = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
@@ -0,0 +1,417 @@
+/*
+ * Microbenchmarks for the HTTP parsers and the db layer. Each case runs until
+ * it has taken at least BENCH_MIN_NS and reports ns/op, allocations/op and
+ * bytes allocated/op.
+ *
+ * usage: template2_bench [name filter]
+ */
+#include <dc_posix/dc_posix_env.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "common.h"
+#include "dbstuff.h"
+#include "http_.h"
+
+#define BENCH_MIN_NS 200000000ull
+#define DB_VALUE_SIZE 48
+
+/**
+ * @brief One benchmark case; fn runs a single operation
+ *
+ */
+struct bench_case
+{
+    const char *name;
+    void (*fn)(void *ctx, size_t i);
+    void *ctx;
+};
+
+/**
+ * @brief Request parsing state: a corpus and the arena it is parsed into
+ *
+ */
+struct request_ctx
+{
+    const char *const *corpus;
+    size_t corpus_size;
+    char *buf;
+    struct arena *arena;
+    struct http_request req;
+};
+
+/**
+ * @brief Response parsing state
+ *
+ */
+struct response_ctx
+{
+    const char *const *corpus;
+    size_t corpus_size;
+    char *buf;
+    struct http_response res;
+    struct status_line line;
+};
+
+/**
+ * @brief A db file populated with a fixed number of keys
+ *
+ */
+struct db_ctx
+{
+    struct dc_posix_env *env;
+    struct dc_error *err;
+    char path[64];
+    size_t keys;
+    char *val;
+};
+
+static const char *const request_corpus[] = {
+    "GET /ibeacons/data?key=beacon-000042 HTTP/1.1\r\n"
+    "Host: localhost:8080\r\nUser-Agent: curl/8.4.0\r\nAccept: */*\r\n\r\n",
+    "GET /ibeacons/data?all HTTP/1.0\r\nHost: localhost\r\n\r\n",
+    "PUT /ibeacons/data HTTP/1.1\r\nHost: gateway-7.local:8080\r\n"
+    "User-Agent: ble-gateway/2.3\r\nContent-Type: "
+    "application/x-www-form-urlencoded\r\nContent-Length: 80\r\n"
+    "Connection: keep-alive\r\n\r\n"
+    "data=major%3D12%26minor%3D7%26rssi%3D-67%26tx%3D-59%26ts%3D1700000000&"
+    "key=b-12-7",
+    "GET /index.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: Mozilla/5.0 "
+    "(X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/120.0 Safari/537.36\r\nAccept: text/html,application/xhtml+xml,"
+    "application/xml;q=0.9,*/*;q=0.8\r\nAccept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-CA,en;q=0.9\r\nConnection: keep-alive\r\n\r\n",
+};
+
+static const char *const response_corpus[] = {
+    "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 32\r\n"
+    "Connection: keep-alive\r\n\r\nbeacon-000042 : major=12 minor=7",
+    "HTTP/1.0 404 Not Found\r\nContent-Type: text/html\r\nContent-Length: "
+    "123\r\nConnection: close\r\n\r\n<!DOCTYPE html><html><head><title>Hey, "
+    "404 Not Found</title></head><body><p>404 Not Found: Don't do "
+    "that.</p></body></html>",
+    "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 13\r\n"
+    "Connection: keep-alive\r\n\r\nPUT Complete\n",
+};
+
+#define CORPUS_SIZE(corpus) (sizeof(corpus) / sizeof((corpus)[0]))
+
+static int counting = 0;
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+
+#ifdef __GLIBC__
+/*
+ * glibc lets a program replace malloc; count every allocation, including the
+ * ones strdup and the dc libraries make, then hand off to the real allocator.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    if (counting)
+    {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (counting)
+    {
+        alloc_count++;
+        alloc_bytes += count * size;
+    }
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (counting)
+    {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#define ALLOC_COUNTING 1
+#else
+#define ALLOC_COUNTING 0
+#endif
+
+static uint64_t now_ns(void);
+static void run_case(const struct bench_case *bench);
+static void bench_process_request(void *arg, size_t i);
+static void bench_process_response(void *arg, size_t i);
+static void bench_process_content_length(void *arg, size_t i);
+static void bench_content_length_string(void *arg, size_t i);
+static void bench_db_store(void *arg, size_t i);
+static void bench_db_fetch(void *arg, size_t i);
+static bool count_bytes(void *arg, const char *key, size_t key_len,
+                        const char *val, size_t val_len);
+static void bench_db_fetch_all(void *arg, size_t i);
+static void db_populate(struct db_ctx *db, size_t keys);
+static void db_cleanup(const struct db_ctx *db);
+static void error_reporter(const struct dc_error *err);
+
+int main(int argc, char *argv[])
+{
+    struct dc_posix_env env;
+    struct dc_error err;
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    struct request_ctx req = {request_corpus, CORPUS_SIZE(request_corpus),
+                              NULL, NULL, {0}};
+    struct response_ctx res = {response_corpus, CORPUS_SIZE(response_corpus),
+                               NULL, {0}, {0}};
+    struct db_ctx small = {&env, &err, "", 8, NULL};
+    struct db_ctx medium = {&env, &err, "", 1000, NULL};
+    struct db_ctx large = {&env, &err, "", 10000, NULL};
+    size_t i;
+
+    dc_error_init(&err, error_reporter);
+    dc_posix_env_init(&env, NULL);
+
+    req.buf = malloc(MAX_REQUEST_SIZE);
+    req.arena = arena_create(REQUEST_ARENA_SIZE);
+    res.buf = malloc(MAX_REQUEST_SIZE);
+    res.res.stat_line = &res.line;
+
+    {
+        const struct bench_case cases[] = {
+            {"process_request", bench_process_request, &req},
+            {"process_response", bench_process_response, &res},
+            {"process_content_length", bench_process_content_length, &res},
+            {"getContentLengthFromString", bench_content_length_string, &req},
+            {"db_store/1000", bench_db_store, &medium},
+            {"db_store/10000", bench_db_store, &large},
+            {"db_fetch/1000", bench_db_fetch, &medium},
+            {"db_fetch/10000", bench_db_fetch, &large},
+            {"db_fetch_all/8", bench_db_fetch_all, &small},
+            {"db_fetch_all/1000", bench_db_fetch_all, &medium},
+            {"db_fetch_all/10000", bench_db_fetch_all, &large},
+        };
+
+        printf("%-28s %12s %12s %10s %12s\n", "benchmark", "iterations",
+               "ns/op", "allocs/op", "bytes/op");
+        for (i = 0; i < CORPUS_SIZE(cases); i++)
+        {
+            if (filter && !strstr(cases[i].name, filter))
+            {
+                continue;
+            }
+            if (cases[i].ctx == &small || cases[i].ctx == &medium ||
+                cases[i].ctx == &large)
+            {
+                struct db_ctx *db = (struct db_ctx *)cases[i].ctx;
+
+                if (db->val == NULL)
+                {
+                    db_populate(db, db->keys);
+                }
+            }
+            run_case(&cases[i]);
+        }
+    }
+
+    db_cleanup(&small);
+    db_cleanup(&medium);
+    db_cleanup(&large);
+    arena_destroy(&req.arena);
+    free(req.buf);
+    free(res.buf);
+
+    return dc_error_has_error(&err) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Doubles the iteration count until a run takes BENCH_MIN_NS, then
+ * reports that run
+ *
+ * @param bench
+ */
+static void run_case(const struct bench_case *bench)
+{
+    size_t iterations = 1;
+    size_t i;
+    uint64_t start;
+    uint64_t elapsed;
+
+    for (;;)
+    {
+        alloc_count = 0;
+        alloc_bytes = 0;
+        counting = 1;
+        start = now_ns();
+        for (i = 0; i < iterations; i++)
+        {
+            bench->fn(bench->ctx, i);
+        }
+        elapsed = now_ns() - start;
+        counting = 0;
+
+        if (elapsed >= BENCH_MIN_NS)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    if (ALLOC_COUNTING)
+    {
+        printf("%-28s %12zu %12.1f %10.2f %12.1f\n", bench->name, iterations,
+               (double)elapsed / (double)iterations,
+               (double)alloc_count / (double)iterations,
+               (double)alloc_bytes / (double)iterations);
+    }
+    else
+    {
+        printf("%-28s %12zu %12.1f %10s %12s\n", bench->name, iterations,
+               (double)elapsed / (double)iterations, "n/a", "n/a");
+    }
+}
+
+static void bench_process_request(void *arg, size_t i)
+{
+    struct request_ctx *ctx = (struct request_ctx *)arg;
+    const char *request = ctx->corpus[i % ctx->corpus_size];
+
+    // the server parses in place out of its receive buffer
+    strcpy(ctx->buf, request);
+    ctx->req.req_line = (struct request_line *)arena_alloc(
+        ctx->arena, sizeof(struct request_line));
+    process_request(ctx->buf, &ctx->req, ctx->arena);
+    arena_reset(ctx->arena);
+}
+
+static void bench_process_response(void *arg, size_t i)
+{
+    struct response_ctx *ctx = (struct response_ctx *)arg;
+
+    strcpy(ctx->buf, ctx->corpus[i % ctx->corpus_size]);
+    process_content_length(ctx->buf, &ctx->res);
+    process_response(ctx->buf, &ctx->res);
+    free(ctx->line.HTTP_VER);
+    free(ctx->line.reason_phrase);
+    free(ctx->res.message_body);
+}
+
+static void bench_process_content_length(void *arg, size_t i)
+{
+    struct response_ctx *ctx = (struct response_ctx *)arg;
+
+    process_content_length((char *)ctx->corpus[i % ctx->corpus_size],
+                           &ctx->res);
+}
+
+static void bench_content_length_string(void *arg, size_t i)
+{
+    struct request_ctx *ctx = (struct request_ctx *)arg;
+
+    if (getContentLengthFromString(ctx->corpus[i % ctx->corpus_size]) < 0)
+    {
+        abort();
+    }
+}
+
+static void bench_db_store(void *arg, size_t i)
+{
+    struct db_ctx *db = (struct db_ctx *)arg;
+    char key[32];
+
+    // overwrite existing keys so the db size stays put
+    snprintf(key, sizeof(key), "beacon-%06zu", i % db->keys);
+    db_store(db->env, db->err, key, db->val, db->path);
+}
+
+static void bench_db_fetch(void *arg, size_t i)
+{
+    struct db_ctx *db = (struct db_ctx *)arg;
+    char key[32];
+    char out[1024];
+
+    snprintf(key, sizeof(key), "beacon-%06zu", (i * 7919) % db->keys);
+    db_fetch(db->env, db->err, key, out, db->path);
+}
+
+static bool count_bytes(void *arg, __attribute__((unused)) const char *key,
+                        size_t key_len, __attribute__((unused)) const char *val,
+                        size_t val_len)
+{
+    *(size_t *)arg += key_len + val_len;
+
+    return true;
+}
+
+static void bench_db_fetch_all(void *arg, __attribute__((unused)) size_t i)
+{
+    struct db_ctx *db = (struct db_ctx *)arg;
+    size_t bytes = 0;
+
+    db_fetch_all(db->env, db->err, count_bytes, &bytes, db->path);
+}
+
+static void db_populate(struct db_ctx *db, size_t keys)
+{
+    char key[32];
+    size_t i;
+
+    snprintf(db->path, sizeof(db->path), "/tmp/ibeacon_bench_%ld_%zu",
+             (long)getpid(), keys);
+    db->val = malloc(DB_VALUE_SIZE + 1);
+    memset(db->val, 'v', DB_VALUE_SIZE);
+    db->val[DB_VALUE_SIZE] = '\0';
+
+    for (i = 0; i < keys; i++)
+    {
+        snprintf(key, sizeof(key), "beacon-%06zu", i);
+        db_store(db->env, db->err, key, db->val, db->path);
+    }
+}
+
+static void db_cleanup(const struct db_ctx *db)
+{
+    char file[80];
+
+    if (db->val == NULL)
+    {
+        return;
+    }
+
+    // ndbm keeps the data in one or two files depending on the backend
+    snprintf(file, sizeof(file), "%s.db", db->path);
+    unlink(file);
+    snprintf(file, sizeof(file), "%s.dir", db->path);
+    unlink(file);
+    snprintf(file, sizeof(file), "%s.pag", db->path);
+    unlink(file);
+    free(db->val);
+}
+
+static void error_reporter(const struct dc_error *err)
+{
+    fprintf(stderr, "ERROR: %s : %s : @ %zu : %s\n", err->file_name,
+            err->function_name, err->line_number, err->message);
+}
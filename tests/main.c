@@ -9,6 +9,12 @@ int main(int argc, char **argv)
 
     suite    = create_test_suite();
     reporter = create_text_reporter();
+    add_suite(suite, arena_tests());
+    add_suite(suite, form_tests());
+    add_suite(suite, http_request_tests());
+    add_suite(suite, http_scan_tests());
+    add_suite(suite, routes_tests());
+    add_suite(suite, wal_tests());
 
     if(argc > 1)
     {
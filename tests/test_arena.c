@@ -0,0 +1,113 @@
+#include "tests.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+static bool in_main_block(const struct arena *from, const void *ptr);
+
+static struct arena *arena;
+
+Describe(arena);
+BeforeEach(arena)
+{
+    arena = arena_create(256);
+}
+AfterEach(arena)
+{
+    arena_destroy(&arena);
+}
+
+static bool in_main_block(const struct arena *from, const void *ptr)
+{
+    return (const char *)ptr >= from->base &&
+           (const char *)ptr < from->base + from->size;
+}
+
+Ensure(arena, bumps_the_main_block)
+{
+    char *first = (char *)arena_alloc(arena, 1);
+    char *second = (char *)arena_alloc(arena, 1);
+
+    assert_that(first, is_equal_to(arena->base));
+    assert_that(in_main_block(arena, second), is_true);
+    assert_that((uintptr_t)second % _Alignof(max_align_t), is_equal_to(0));
+    assert_that(arena->overflow, is_null);
+}
+
+Ensure(arena, spills_into_overflow_chunks)
+{
+    char *inside = (char *)arena_alloc(arena, 200);
+    char *spill = (char *)arena_alloc(arena, 100);
+    char *again;
+    char *big;
+
+    assert_that(in_main_block(arena, inside), is_true);
+    assert_that(in_main_block(arena, spill), is_false);
+    // the second fits the chunk the first opened
+    again = (char *)arena_alloc(arena, 100);
+    assert_that(in_main_block(arena, again), is_false);
+    assert_that(arena->overflow->next, is_null);
+    // one larger than the arena gets a chunk of its own size
+    big = (char *)arena_alloc(arena, 1000);
+    assert_that(big, is_non_null);
+    assert_that(arena->overflow->size >= 1000, is_true);
+    assert_that(arena->overflow->next, is_non_null);
+
+    memset(inside, 'm', 200);
+    memset(spill, 's', 100);
+    memset(again, 'a', 100);
+    memset(big, 'b', 1000);
+    assert_that(inside[199], is_equal_to('m'));
+    assert_that(spill[99], is_equal_to('s'));
+    assert_that(again[0], is_equal_to('a'));
+}
+
+Ensure(arena, reset_frees_the_chunks)
+{
+    arena_alloc(arena, 200);
+    arena_alloc(arena, 300);
+    arena_alloc(arena, 300);
+    assert_that(arena->overflow, is_non_null);
+
+    arena_reset(arena);
+    assert_that(arena->overflow, is_null);
+    assert_that(arena->used, is_equal_to(0));
+    assert_that(arena_alloc(arena, 8), is_equal_to(arena->base));
+}
+
+Ensure(arena, calloc_zeroes_and_checks_for_overflow)
+{
+    unsigned char *block;
+    size_t i;
+
+    memset(arena->base, 0xff, arena->size);
+    block = (unsigned char *)arena_calloc(arena, 16, 8);
+    assert_that(block, is_non_null);
+    for (i = 0; i < 16 * 8; i++)
+    {
+        assert_that(block[i], is_equal_to(0));
+    }
+    assert_that(arena_calloc(arena, SIZE_MAX / 2, 4), is_null);
+}
+
+Ensure(arena, duplicates_strings)
+{
+    assert_that(arena_strdup(arena, "beacon"), is_equal_to_string("beacon"));
+    assert_that(arena_strndup(arena, "beacon", 3), is_equal_to_string("bea"));
+    assert_that(arena_strndup(arena, "be", 8), is_equal_to_string("be"));
+}
+
+TestSuite *arena_tests(void)
+{
+    TestSuite *suite = create_test_suite();
+
+    add_test_with_context(suite, arena, bumps_the_main_block);
+    add_test_with_context(suite, arena, spills_into_overflow_chunks);
+    add_test_with_context(suite, arena, reset_frees_the_chunks);
+    add_test_with_context(suite, arena, calloc_zeroes_and_checks_for_overflow);
+    add_test_with_context(suite, arena, duplicates_strings);
+
+    return suite;
+}
@@ -0,0 +1,89 @@
+#include "tests.h"
+#include <string.h>
+
+#include "form.h"
+
+Describe(form);
+BeforeEach(form) {}
+AfterEach(form) {}
+
+Ensure(form, iterates_fields_in_order)
+{
+    static const char query[] = "key=k1&value=v%201";
+    struct form_iter iter;
+    struct form_field field;
+
+    form_iter_init(&iter, query, strlen(query));
+    assert_that(form_next(&iter, &field), is_true);
+    assert_that(form_name_is(&field, "key"), is_true);
+    assert_that(field.value_len, is_equal_to(2));
+    assert_that(strncmp(field.value, "k1", 2), is_equal_to(0));
+    assert_that(form_next(&iter, &field), is_true);
+    assert_that(form_name_is(&field, "value"), is_true);
+    // still encoded
+    assert_that(field.value_len, is_equal_to(5));
+    assert_that(form_next(&iter, &field), is_false);
+}
+
+Ensure(form, skips_empty_fields_and_keeps_bare_tokens)
+{
+    static const char query[] = "&&all&&prefix=&";
+    struct form_iter iter;
+    struct form_field field;
+
+    form_iter_init(&iter, query, strlen(query));
+    assert_that(form_next(&iter, &field), is_true);
+    assert_that(form_name_is(&field, "all"), is_true);
+    assert_that(field.value, is_null);
+    assert_that(form_next(&iter, &field), is_true);
+    assert_that(form_name_is(&field, "prefix"), is_true);
+    assert_that(field.value, is_non_null);
+    assert_that(field.value_len, is_equal_to(0));
+    assert_that(form_next(&iter, &field), is_false);
+}
+
+Ensure(form, decodes_plus_and_percent_escapes)
+{
+    static const char encoded[] = "a+b%2Fc%3d";
+    char decoded[sizeof(encoded)];
+
+    assert_that(form_decode(encoded, strlen(encoded), decoded),
+                is_equal_to(6));
+    assert_that(decoded, is_equal_to_string("a b/c="));
+}
+
+Ensure(form, copies_invalid_escapes_through)
+{
+    static const char encoded[] = "100%+%zz%4";
+    char decoded[sizeof(encoded)];
+
+    assert_that(form_decode(encoded, strlen(encoded), decoded),
+                is_equal_to(strlen(encoded)));
+    assert_that(decoded, is_equal_to_string("100% %zz%4"));
+}
+
+Ensure(form, decodes_percent_00_to_an_embedded_nul)
+{
+    static const char encoded[] = "ab%00cd";
+    char decoded[sizeof(encoded)];
+    size_t len;
+
+    len = form_decode(encoded, strlen(encoded), decoded);
+    // the length says 5, strlen only sees the 2 before the NUL
+    assert_that(len, is_equal_to(5));
+    assert_that(strlen(decoded), is_equal_to(2));
+    assert_that(memcmp(decoded, "ab\0cd", 6), is_equal_to(0));
+}
+
+TestSuite *form_tests(void)
+{
+    TestSuite *suite = create_test_suite();
+
+    add_test_with_context(suite, form, iterates_fields_in_order);
+    add_test_with_context(suite, form, skips_empty_fields_and_keeps_bare_tokens);
+    add_test_with_context(suite, form, decodes_plus_and_percent_escapes);
+    add_test_with_context(suite, form, copies_invalid_escapes_through);
+    add_test_with_context(suite, form, decodes_percent_00_to_an_embedded_nul);
+
+    return suite;
+}
@@ -0,0 +1,62 @@
+#include "tests.h"
+#include <string.h>
+
+#include "http_.h"
+
+static bool matches(const char *value, const char *etag);
+
+Describe(http_request);
+BeforeEach(http_request) {}
+AfterEach(http_request) {}
+
+static bool matches(const char *value, const char *etag)
+{
+    return etag_matches(value, strlen(value), etag);
+}
+
+Ensure(http_request, matches_a_single_etag)
+{
+    assert_that(matches("\"abc\"", "\"abc\""), is_true);
+    assert_that(matches("\"abd\"", "\"abc\""), is_false);
+    assert_that(matches("\"abc", "\"abc\""), is_false);
+    assert_that(matches("", "\"abc\""), is_false);
+}
+
+Ensure(http_request, ignores_the_weak_prefix)
+{
+    assert_that(matches("W/\"abc\"", "\"abc\""), is_true);
+    assert_that(matches("w/\"abc\"", "\"abc\""), is_false);
+}
+
+Ensure(http_request, matches_any_etag_in_a_list)
+{
+    assert_that(matches("\"x\", \"y\",W/\"abc\" ", "\"abc\""), is_true);
+    assert_that(matches(" ,\"abc\",", "\"abc\""), is_true);
+    assert_that(matches("\"x\", \"y\"", "\"abc\""), is_false);
+}
+
+Ensure(http_request, matches_a_wildcard)
+{
+    assert_that(matches("*", "\"abc\""), is_true);
+    assert_that(matches(" * ", "\"abc\""), is_true);
+    assert_that(matches("**", "\"abc\""), is_false);
+}
+
+Ensure(http_request, reads_only_the_length_given)
+{
+    assert_that(etag_matches("\"abc\"", 4, "\"abc\""), is_false);
+    assert_that(etag_matches("\"abc\", *", 6, "\"abc\""), is_true);
+}
+
+TestSuite *http_request_tests(void)
+{
+    TestSuite *suite = create_test_suite();
+
+    add_test_with_context(suite, http_request, matches_a_single_etag);
+    add_test_with_context(suite, http_request, ignores_the_weak_prefix);
+    add_test_with_context(suite, http_request, matches_any_etag_in_a_list);
+    add_test_with_context(suite, http_request, matches_a_wildcard);
+    add_test_with_context(suite, http_request, reads_only_the_length_given);
+
+    return suite;
+}
@@ -0,0 +1,248 @@
+#include "tests.h"
+#include <string.h>
+
+#include "common.h"
+#include "http_scan.h"
+
+static const enum http_scan_kernel kernels[] = {
+    HTTP_SCAN_KERNEL_SCALAR, HTTP_SCAN_KERNEL_SSE2, HTTP_SCAN_KERNEL_AVX2};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+static void assert_kernels_agree(const char *buf, size_t len);
+
+Describe(http_scan);
+BeforeEach(http_scan) {}
+AfterEach(http_scan)
+{
+    http_scan_use(HTTP_SCAN_KERNEL_AUTO);
+}
+
+/**
+ * @brief Scans buf with every kernel the CPU has and holds each one's marks
+ * against the scalar kernel's
+ *
+ * @param buf
+ * @param len
+ */
+static void assert_kernels_agree(const char *buf, size_t len)
+{
+    struct http_scan_marks expected;
+    struct http_scan_marks marks;
+    size_t k;
+
+    http_scan_use(HTTP_SCAN_KERNEL_SCALAR);
+    http_scan_block(buf, len, &expected);
+    for (k = 1; k < KERNEL_COUNT; k++)
+    {
+        if (!http_scan_use(kernels[k]))
+        {
+            continue;
+        }
+        http_scan_block(buf, len, &marks);
+        assert_that(marks.cr, is_equal_to(expected.cr));
+        assert_that(marks.lf, is_equal_to(expected.lf));
+        assert_that(marks.colon, is_equal_to(expected.colon));
+        assert_that(marks.space, is_equal_to(expected.space));
+    }
+}
+
+Ensure(http_scan, kernels_agree_on_a_delimiter_at_every_offset)
+{
+    static const char delimiters[] = "\r\n: ";
+    char block[HTTP_SCAN_BLOCK];
+    struct http_scan_marks marks;
+    size_t d;
+    size_t at;
+
+    // every lane of a 16 and a 32 byte register, in each half of the block
+    for (d = 0; d < sizeof(delimiters) - 1; d++)
+    {
+        for (at = 0; at < HTTP_SCAN_BLOCK; at++)
+        {
+            memset(block, 'a', sizeof(block));
+            block[at] = delimiters[d];
+            assert_kernels_agree(block, sizeof(block));
+
+            http_scan_use(HTTP_SCAN_KERNEL_SCALAR);
+            http_scan_block(block, sizeof(block), &marks);
+            assert_that((marks.cr | marks.lf | marks.colon | marks.space),
+                        is_equal_to((uint64_t)1 << at));
+        }
+    }
+}
+
+Ensure(http_scan, kernels_agree_on_short_blocks)
+{
+    char block[HTTP_SCAN_BLOCK];
+    size_t len;
+    size_t at;
+
+    // the bytes past len must not be matched, whatever they hold
+    memset(block, '\r', sizeof(block));
+    for (len = 0; len <= HTTP_SCAN_BLOCK; len++)
+    {
+        assert_kernels_agree(block, len);
+        for (at = 0; at < len; at++)
+        {
+            memset(block, ':', sizeof(block));
+            block[at] = '\n';
+            assert_kernels_agree(block, len);
+        }
+    }
+}
+
+Ensure(http_scan, kernels_agree_on_mixed_blocks)
+{
+    static const char alphabet[] = "\r\n: \t\x0b\x0c\x8d\x8a\xba\xa0" "a\0";
+    char block[HTTP_SCAN_BLOCK];
+    uint32_t state = 1;
+    size_t round;
+    size_t i;
+
+    // dense mixes of the delimiters, bytes one bit off them and high bytes
+    for (round = 0; round < 1000; round++)
+    {
+        for (i = 0; i < sizeof(block); i++)
+        {
+            state = state * 1103515245u + 12345u;
+            block[i] = alphabet[(state >> 16) % (sizeof(alphabet) - 1)];
+        }
+        assert_kernels_agree(block, sizeof(block));
+    }
+}
+
+Ensure(http_scan, finds_end_of_headers_at_every_offset)
+{
+    char buf[3 * HTTP_SCAN_BLOCK];
+    const char *end;
+    size_t k;
+    size_t at;
+    size_t i;
+
+    for (k = 0; k < KERNEL_COUNT; k++)
+    {
+        if (!http_scan_use(kernels[k]))
+        {
+            continue;
+        }
+        // the CRLFs around it must not match, and every offset past 60
+        // puts it across the boundary of two scanned blocks
+        for (at = 0; at + 4 <= sizeof(buf); at++)
+        {
+            for (i = 0; i < sizeof(buf); i++)
+            {
+                buf[i] = "\r\na"[i % 3];
+            }
+            memset(buf + (at >= 2 ? at - 2 : 0), 'a', at >= 2 ? 2 : at);
+            memcpy(buf + at, "\r\n\r\n", 4);
+            end = http_scan_end_of_headers(buf, sizeof(buf));
+            assert_that(end, is_equal_to(buf + at));
+        }
+    }
+}
+
+Ensure(http_scan, needs_the_whole_delimiter)
+{
+    static const char head[] = "GET / HTTP/1.1\r\nHost: x\r\n\r";
+    size_t k;
+
+    for (k = 0; k < KERNEL_COUNT; k++)
+    {
+        if (!http_scan_use(kernels[k]))
+        {
+            continue;
+        }
+        assert_that(http_scan_end_of_headers(head, strlen(head)), is_null);
+        assert_that(http_scan_content_length(head, strlen(head)),
+                    is_equal_to(0));
+        assert_that(http_scan_request_length(head, strlen(head)),
+                    is_equal_to(0));
+    }
+}
+
+Ensure(http_scan, reads_content_length)
+{
+    static const char request[] =
+        "PUT /ibeacons/data HTTP/1.1\r\nHost: x\r\n"
+        "content-length:   12\r\n\r\nkey=k&value=";
+    size_t k;
+
+    for (k = 0; k < KERNEL_COUNT; k++)
+    {
+        if (!http_scan_use(kernels[k]))
+        {
+            continue;
+        }
+        assert_that(http_scan_content_length(request, strlen(request)),
+                    is_equal_to(12));
+        assert_that(http_scan_request_length(request, strlen(request)),
+                    is_equal_to(strlen(request)));
+    }
+}
+
+Ensure(http_scan, takes_a_missing_content_length_as_zero)
+{
+    static const char request[] = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+    size_t k;
+
+    for (k = 0; k < KERNEL_COUNT; k++)
+    {
+        if (!http_scan_use(kernels[k]))
+        {
+            continue;
+        }
+        assert_that(http_scan_content_length(request, strlen(request)),
+                    is_equal_to(0));
+    }
+}
+
+Ensure(http_scan, flags_an_oversized_content_length)
+{
+    static const char *const requests[] = {
+        "PUT / HTTP/1.1\r\nContent-Length: 8001\r\n\r\n",
+        // would wrap a size_t if it were read in full
+        "PUT / HTTP/1.1\r\nContent-Length: 184467440737095516170\r\n\r\n",
+    };
+    static const char fits[] = "PUT / HTTP/1.1\r\nContent-Length: 8000\r\n\r\n";
+    size_t k;
+    size_t i;
+
+    for (k = 0; k < KERNEL_COUNT; k++)
+    {
+        if (!http_scan_use(kernels[k]))
+        {
+            continue;
+        }
+        for (i = 0; i < sizeof(requests) / sizeof(requests[0]); i++)
+        {
+            assert_that(http_scan_content_length(requests[i],
+                                                 strlen(requests[i])),
+                        is_equal_to(HTTP_SCAN_TOO_LARGE));
+            assert_that(http_scan_request_length(requests[i],
+                                                 strlen(requests[i])),
+                        is_equal_to(HTTP_SCAN_TOO_LARGE));
+        }
+        assert_that(http_scan_content_length(fits, strlen(fits)),
+                    is_equal_to(MAX_REQUEST_SIZE));
+    }
+}
+
+TestSuite *http_scan_tests(void)
+{
+    TestSuite *suite = create_test_suite();
+
+    add_test_with_context(suite, http_scan,
+                          kernels_agree_on_a_delimiter_at_every_offset);
+    add_test_with_context(suite, http_scan, kernels_agree_on_short_blocks);
+    add_test_with_context(suite, http_scan, kernels_agree_on_mixed_blocks);
+    add_test_with_context(suite, http_scan,
+                          finds_end_of_headers_at_every_offset);
+    add_test_with_context(suite, http_scan, needs_the_whole_delimiter);
+    add_test_with_context(suite, http_scan, reads_content_length);
+    add_test_with_context(suite, http_scan,
+                          takes_a_missing_content_length_as_zero);
+    add_test_with_context(suite, http_scan, flags_an_oversized_content_length);
+
+    return suite;
+}
@@ -0,0 +1,68 @@
+#include "tests.h"
+#include <string.h>
+
+#include "routes.h"
+
+// Stands in for the table route_gen writes: seed 2 puts these three routes
+// in slots 1, 3 and 6 of 8
+const struct route route_table[] = {
+    [1] = {GET, "/", 1, NULL},
+    [3] = {GET, "/ibeacons/data", 14, NULL},
+    [6] = {PUT, "/ibeacons/data", 14, NULL},
+    [7] = {0, NULL, 0, NULL},
+};
+const uint32_t route_table_mask = 7;
+const uint32_t route_seed = 2;
+
+Describe(routes);
+BeforeEach(routes) {}
+AfterEach(routes) {}
+
+Ensure(routes, finds_each_route)
+{
+    assert_that(route_lookup(GET, "/", 1), is_equal_to(&route_table[1]));
+    assert_that(route_lookup(GET, "/ibeacons/data", 14),
+                is_equal_to(&route_table[3]));
+    assert_that(route_lookup(PUT, "/ibeacons/data", 14),
+                is_equal_to(&route_table[6]));
+}
+
+Ensure(routes, misses_unknown_paths)
+{
+    assert_that(route_lookup(GET, "/ibeacons", 9), is_null);
+    assert_that(route_lookup(GET, "/ibeacons/data/", 15), is_null);
+    // only the length given is compared
+    assert_that(route_lookup(GET, "/ibeacons/data?all", 14),
+                is_equal_to(&route_table[3]));
+    assert_that(route_lookup(GET, "", 0), is_null);
+}
+
+Ensure(routes, misses_the_wrong_method)
+{
+    assert_that(route_lookup(POST, "/ibeacons/data", 14), is_null);
+    assert_that(route_lookup(PUT, "/", 1), is_null);
+    assert_that(route_lookup(-1, "/", 1), is_null);
+}
+
+Ensure(routes, parses_methods)
+{
+    assert_that(parse_method("GET"), is_equal_to(GET));
+    assert_that(parse_method("PUT"), is_equal_to(PUT));
+    assert_that(parse_method("POST"), is_equal_to(POST));
+    assert_that(parse_method("PATCH"), is_equal_to(-1));
+    assert_that(parse_method("GETS"), is_equal_to(-1));
+    assert_that(method_name(PUT), is_equal_to_string("PUT"));
+    assert_that(method_name(-1), is_equal_to_string("?"));
+}
+
+TestSuite *routes_tests(void)
+{
+    TestSuite *suite = create_test_suite();
+
+    add_test_with_context(suite, routes, finds_each_route);
+    add_test_with_context(suite, routes, misses_unknown_paths);
+    add_test_with_context(suite, routes, misses_the_wrong_method);
+    add_test_with_context(suite, routes, parses_methods);
+
+    return suite;
+}
@@ -0,0 +1,213 @@
+#include "tests.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+#define MAX_SEEN 8
+
+struct seen
+{
+    size_t count;
+    char keys[MAX_SEEN][32];
+    char values[MAX_SEEN][32];
+};
+
+static bool collect(void *arg, const char *key, const char *value);
+static bool refuse(void *arg, const char *key, const char *value);
+static void write_log(size_t count);
+static off_t log_size(void);
+
+static char path[64];
+static struct seen seen;
+
+Describe(wal);
+BeforeEach(wal)
+{
+    snprintf(path, sizeof(path), "/tmp/ibeacon_wal_test_%ld", (long)getpid());
+    unlink(path);
+    memset(&seen, 0, sizeof(seen));
+}
+AfterEach(wal)
+{
+    unlink(path);
+}
+
+static bool collect(void *arg, const char *key, const char *value)
+{
+    struct seen *into = (struct seen *)arg;
+
+    if (into->count == MAX_SEEN)
+    {
+        return false;
+    }
+    snprintf(into->keys[into->count], sizeof(into->keys[0]), "%s", key);
+    snprintf(into->values[into->count], sizeof(into->values[0]), "%s", value);
+    into->count++;
+
+    return true;
+}
+
+static bool refuse(void *arg, const char *key, const char *value)
+{
+    (void)arg;
+    (void)key;
+    (void)value;
+
+    return false;
+}
+
+/**
+ * @brief Logs key0=value0 ... through a fresh log at path
+ *
+ * @param count
+ */
+static void write_log(size_t count)
+{
+    struct wal *log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    char key[16];
+    char value[16];
+    size_t i;
+
+    assert_that(log, is_non_null);
+    for (i = 0; i < count; i++)
+    {
+        snprintf(key, sizeof(key), "key%zu", i);
+        snprintf(value, sizeof(value), "value%zu", i);
+        assert_that(wal_append(log, key, value), is_true);
+    }
+    assert_that(wal_commit(log), is_true);
+    wal_close(&log);
+    memset(&seen, 0, sizeof(seen));
+}
+
+static off_t log_size(void)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+Ensure(wal, replays_records_in_order)
+{
+    struct wal *log;
+
+    write_log(3);
+    log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    assert_that(log, is_non_null);
+    assert_that(seen.count, is_equal_to(3));
+    assert_that(seen.keys[0], is_equal_to_string("key0"));
+    assert_that(seen.values[0], is_equal_to_string("value0"));
+    assert_that(seen.keys[2], is_equal_to_string("key2"));
+    assert_that(seen.values[2], is_equal_to_string("value2"));
+    assert_that(wal_size(log), is_equal_to(log_size()));
+    wal_close(&log);
+}
+
+Ensure(wal, cuts_off_a_torn_tail)
+{
+    struct wal *log;
+    off_t whole;
+    off_t torn;
+
+    write_log(2);
+    whole = log_size();
+    write_log(0);
+    log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    assert_that(wal_append(log, "key2", "value2"), is_true);
+    assert_that(wal_commit(log), is_true);
+    wal_close(&log);
+    // a crash part way through writing the third record
+    torn = log_size() - 3;
+    assert_that(truncate(path, torn), is_equal_to(0));
+
+    memset(&seen, 0, sizeof(seen));
+    log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    assert_that(log, is_non_null);
+    assert_that(seen.count, is_equal_to(2));
+    assert_that(log_size(), is_equal_to(whole));
+    assert_that(wal_size(log), is_equal_to(whole));
+
+    // appends go on from the last whole record
+    assert_that(wal_append(log, "key3", "value3"), is_true);
+    assert_that(wal_commit(log), is_true);
+    wal_close(&log);
+    memset(&seen, 0, sizeof(seen));
+    log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    assert_that(seen.count, is_equal_to(3));
+    assert_that(seen.keys[2], is_equal_to_string("key3"));
+    wal_close(&log);
+}
+
+Ensure(wal, cuts_off_a_corrupt_record)
+{
+    struct wal *log;
+    off_t whole;
+    int fd;
+
+    write_log(3);
+    whole = log_size();
+    fd = open(path, O_WRONLY);
+    // the last byte of value2
+    assert_that(pwrite(fd, "X", 1, whole - 1), is_equal_to(1));
+    close(fd);
+
+    log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    assert_that(log, is_non_null);
+    assert_that(seen.count, is_equal_to(2));
+    assert_that(log_size() < whole, is_true);
+    wal_close(&log);
+}
+
+Ensure(wal, fails_when_the_visitor_does)
+{
+    struct wal *log;
+
+    write_log(1);
+    log = wal_open(path, WAL_SYNC_NONE, 0, refuse, NULL);
+    assert_that(log, is_null);
+}
+
+Ensure(wal, checkpoint_empties_the_log)
+{
+    struct wal *log;
+
+    write_log(2);
+    log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    assert_that(wal_checkpoint(log), is_true);
+    assert_that(wal_size(log), is_equal_to(0));
+    wal_close(&log);
+    memset(&seen, 0, sizeof(seen));
+    log = wal_open(path, WAL_SYNC_NONE, 0, collect, &seen);
+    assert_that(seen.count, is_equal_to(0));
+    wal_close(&log);
+}
+
+Ensure(wal, parses_sync_modes)
+{
+    enum wal_sync sync = WAL_SYNC_NONE;
+
+    assert_that(wal_parse_sync("Always", &sync), is_true);
+    assert_that(sync, is_equal_to(WAL_SYNC_ALWAYS));
+    assert_that(wal_parse_sync("batch", &sync), is_true);
+    assert_that(sync, is_equal_to(WAL_SYNC_BATCH));
+    assert_that(wal_parse_sync("sometimes", &sync), is_false);
+    assert_that(sync, is_equal_to(WAL_SYNC_BATCH));
+}
+
+TestSuite *wal_tests(void)
+{
+    TestSuite *suite = create_test_suite();
+
+    add_test_with_context(suite, wal, replays_records_in_order);
+    add_test_with_context(suite, wal, cuts_off_a_torn_tail);
+    add_test_with_context(suite, wal, cuts_off_a_corrupt_record);
+    add_test_with_context(suite, wal, fails_when_the_visitor_does);
+    add_test_with_context(suite, wal, checkpoint_empties_the_log);
+    add_test_with_context(suite, wal, parses_sync_modes);
+
+    return suite;
+}
@@ -4,5 +4,12 @@
 
 #include <cgreen/cgreen.h>
 
+TestSuite *arena_tests(void);
+TestSuite *form_tests(void);
+TestSuite *http_request_tests(void);
+TestSuite *http_scan_tests(void);
+TestSuite *routes_tests(void);
+TestSuite *wal_tests(void);
+
 
 #endif // LIBDC_POSIX_TESTS_H